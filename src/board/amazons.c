@@ -26,11 +26,89 @@
 #include <stdio.h>
 #include <assert.h>
 
+#ifdef HAVE_MEMORY_H
+#include <memory.h>
+#endif
+
+
+/* Ray masks for all squares and directions, in a flat array.  Each
+ * mask is `num_words' long.  Rays don't include the starting square.
+ */
+struct _AmazonsRayTable {
+  int			width;
+  int			height;
+  int			num_words;
+
+  int			positions[BOARD_MAX_POSITIONS];
+  unsigned long long   *rays;
+
+  /* Masks for shifting whole bitboards by one square. */
+  unsigned long long	on_board[AMAZONS_BITBOARD_NUM_WORDS];
+  unsigned long long	not_first_column[AMAZONS_BITBOARD_NUM_WORDS];
+  unsigned long long	not_last_column[AMAZONS_BITBOARD_NUM_WORDS];
+};
+
+
+#define NUM_WORDS(width, height)	(((width) * (height) + 63) / 64)
+
+#define RAY(table, square, direction)					\
+  ((table)->rays + ((square) * 8 + (direction)) * (table)->num_words)
+
+#define SQUARE(board, pos)						\
+  (POSITION_X (pos) + (board)->width * POSITION_Y (pos))
+
+#define WORD_INDEX(square)	((square) / 64)
+#define WORD_BIT(square)	((unsigned long long) 1 << ((square) % 64))
+
 
 static inline int  amazon_has_any_legal_move
 		     (const char grid[BOARD_FULL_GRID_SIZE],
 		      int pos);
 
+static const AmazonsRayTable *
+		   get_ray_table (int width, int height);
+static void	   rebuild_bitboards (Board *board);
+static inline void set_point (Board *board, int pos, int contents);
+
+static void	   get_queen_attacks (const AmazonsRayTable *table,
+				      int square,
+				      const unsigned long long *occupied,
+				      unsigned long long *attacks);
+
+static inline void shift_bitboard (unsigned long long *bitboard,
+				   int num_words, int shift);
+static void	   expand_frontier (const AmazonsRayTable *table,
+				    const unsigned long long *frontier,
+				    const unsigned long long *empty,
+				    int use_king_moves,
+				    unsigned long long *next_frontier);
+
+
+/* Same directions as in `delta' array.  Directions with positive
+ * square increments must scan rays from the lowest bit.
+ */
+static const int  direction_x[8]	= { 0, -1,  0, 1, -1, -1,  1, 1 };
+static const int  direction_y[8]	= { 1,  0, -1, 0,  1, -1, -1, 1 };
+static const int  positive_direction[8] = { 1,  0,  0, 1,  1,  0,  0, 1 };
+
+static AmazonsRayTable *ray_tables[BOARD_MAX_WIDTH - BOARD_MIN_WIDTH + 1]
+				  [BOARD_MAX_HEIGHT - BOARD_MIN_HEIGHT + 1];
+
+#if BOARD_USE_PTHREADS
+static pthread_mutex_t	ray_tables_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+void
+amazons_reset_game_data (Board *board, int forced_reset)
+{
+  UNUSED (forced_reset);
+
+  board->data.amazons.ray_table = get_ray_table (board->width,
+						 board->height);
+  rebuild_bitboards (board);
+}
+
 
 /* Just handle weird situations when there are no amazons of either
  * color on board.  Even if a player has no legal move, he is still to
@@ -40,19 +118,18 @@ int
 amazons_adjust_color_to_play (const Board *board, BoardRuleSet rule_set,
 			      int color)
 {
-  int pos;
+  const AmazonsBitboard *amazons = board->data.amazons.amazons;
+  int num_words = board->data.amazons.ray_table->num_words;
   int have_other_color = 0;
+  int k;
 
   UNUSED (rule_set);
 
-  for (pos = POSITION (0, 0); ON_GRID (board->grid, pos);
-       pos += (BOARD_MAX_WIDTH + 1) - board->width) {
-    for (; ON_GRID (board->grid, pos); pos++) {
-      if (board->grid[pos] == color)
-	return color;
-      else if (board->grid[pos] == OTHER_COLOR (color))
-	have_other_color = 1;
-    }
+  for (k = 0; k < num_words; k++) {
+    if (amazons[COLOR_INDEX (color)].words[k])
+      return color;
+    if (amazons[COLOR_INDEX (OTHER_COLOR (color))].words[k])
+      have_other_color = 1;
   }
 
   return have_other_color ? OTHER_COLOR (color) : EMPTY;
@@ -66,15 +143,20 @@ int
 amazons_is_game_over (const Board *board, BoardRuleSet rule_set,
 		      int color_to_play)
 {
-  int pos;
+  const AmazonsRayTable *table = board->data.amazons.ray_table;
+  const unsigned long long *amazons
+    = board->data.amazons.amazons[COLOR_INDEX (color_to_play)].words;
+  int k;
 
   assert (rule_set < NUM_AMAZONS_RULE_SETS);
 
-  for (pos = POSITION (0, 0); ON_GRID (board->grid, pos);
-       pos += (BOARD_MAX_WIDTH + 1) - board->width) {
-    for (; ON_GRID (board->grid, pos); pos++) {
-      if (board->grid[pos] == color_to_play
-	  && amazon_has_any_legal_move (board->grid, pos))
+  for (k = 0; k < table->num_words; k++) {
+    unsigned long long bits;
+
+    for (bits = amazons[k]; bits; bits &= bits - 1) {
+      int square = k * 64 + BOARD_FIRST_BIT_INDEX (bits);
+
+      if (amazon_has_any_legal_move (board->grid, table->positions[square]))
 	return 0;
     }
   }
@@ -184,6 +266,42 @@ amazons_is_legal_move (const Board *board, BoardRuleSet rule_set,
 }
 
 
+/* Mark amazons of `color' that can be moved in `legal_grid', i.e. all
+ * points that are valid first stage of a move.  Full moves are
+ * enumerated with amazons_generate_moves().
+ */
+int
+amazons_get_legal_moves (const Board *board, BoardRuleSet rule_set,
+			 int color, char legal_grid[BOARD_GRID_SIZE])
+{
+  const AmazonsRayTable *table = board->data.amazons.ray_table;
+  const unsigned long long *amazons
+    = board->data.amazons.amazons[COLOR_INDEX (color)].words;
+  int num_legal_moves = 0;
+  int k;
+
+  assert (rule_set < NUM_AMAZONS_RULE_SETS);
+
+  grid_fill (legal_grid, board->width, board->height, 0);
+
+  for (k = 0; k < table->num_words; k++) {
+    unsigned long long bits;
+
+    for (bits = amazons[k]; bits; bits &= bits - 1) {
+      int pos = table->positions[k * 64 + BOARD_FIRST_BIT_INDEX (bits)];
+
+      if (rule_set == AMAZONS_RULE_SET_SGF
+	  || amazon_has_any_legal_move (board->grid, pos)) {
+	legal_grid[pos] = 1;
+	num_legal_moves++;
+      }
+    }
+  }
+
+  return num_legal_moves;
+}
+
+
 static inline int
 amazon_has_any_legal_move (const char grid[BOARD_FULL_GRID_SIZE], int pos)
 {
@@ -228,9 +346,16 @@ amazons_play_move (Board *board, int color, va_list move)
   stack_entry->shoot_arrow_to_contents
     = grid[stack_entry->misc.shoot_arrow_to];
 
-  grid[stack_entry->from]		 = EMPTY;
-  grid[stack_entry->to]			 = color;
-  grid[stack_entry->misc.shoot_arrow_to] = ARROW;
+  /* Order matters: arrow is often shot back to the "from" point. */
+  CHANGE_HASH_KEY (board, stack_entry->from, color, EMPTY);
+  set_point (board, stack_entry->from, EMPTY);
+
+  CHANGE_HASH_KEY (board, stack_entry->to, grid[stack_entry->to], color);
+  set_point (board, stack_entry->to, color);
+
+  CHANGE_HASH_KEY (board, stack_entry->misc.shoot_arrow_to,
+		   grid[stack_entry->misc.shoot_arrow_to], ARROW);
+  set_point (board, stack_entry->misc.shoot_arrow_to, ARROW);
 
   stack_entry->common.move_number = board->move_number++;
 }
@@ -242,13 +367,15 @@ amazons_undo (Board *board)
   AmazonsMoveStackEntry *stack_entry = POP_AMAZONS_MOVE_STACK_ENTRY (board);
 
   if (stack_entry->from != NULL_POSITION) {
-    board->grid[stack_entry->from]	     = board->grid[stack_entry->to];
-    board->grid[stack_entry->to]	     = stack_entry->to_contents;
-    board->grid[stack_entry->misc.shoot_arrow_to]
-      = stack_entry->shoot_arrow_to_contents;
+    set_point (board, stack_entry->from, board->grid[stack_entry->to]);
+    set_point (board, stack_entry->to, stack_entry->to_contents);
+    set_point (board, stack_entry->misc.shoot_arrow_to,
+	       stack_entry->shoot_arrow_to_contents);
   }
-  else if (stack_entry->misc.num_changes > 0)
+  else if (stack_entry->misc.num_changes > 0) {
     board_undo_changes (board, stack_entry->misc.num_changes);
+    rebuild_bitboards (board);
+  }
 
   board->move_number = stack_entry->common.move_number;
 }
@@ -263,6 +390,267 @@ amazons_apply_changes (Board *board, int num_changes)
   stack_entry->from		  = NULL_POSITION;
   stack_entry->misc.num_changes   = num_changes;
   stack_entry->common.move_number = board->move_number;
+
+  if (num_changes > 0)
+    rebuild_bitboards (board);
+}
+
+
+/* Get ray masks for given board dimensions, computing them on first
+ * use.  Tables are shared by all boards and never freed.  This is
+ * only called when a board is created or reset, so simply locking
+ * the whole lookup is cheap enough.
+ */
+static const AmazonsRayTable *
+get_ray_table (int width, int height)
+{
+  AmazonsRayTable **table_pointer = &ray_tables[width - BOARD_MIN_WIDTH]
+					       [height - BOARD_MIN_HEIGHT];
+  AmazonsRayTable *table;
+
+#if BOARD_USE_PTHREADS
+  pthread_mutex_lock (&ray_tables_lock);
+#endif
+
+  if (!*table_pointer) {
+    int num_words = NUM_WORDS (width, height);
+    int x;
+    int y;
+
+    table = utils_malloc (sizeof (AmazonsRayTable));
+
+    table->width     = width;
+    table->height    = height;
+    table->num_words = num_words;
+    table->rays	     = utils_malloc0 (width * height * 8 * num_words
+				      * sizeof (unsigned long long));
+
+    memset (table->on_board, 0, sizeof table->on_board);
+    memset (table->not_first_column, 0, sizeof table->not_first_column);
+    memset (table->not_last_column, 0, sizeof table->not_last_column);
+
+    for (y = 0; y < height; y++) {
+      for (x = 0; x < width; x++) {
+	int square = x + width * y;
+	int direction;
+
+	table->positions[square] = POSITION (x, y);
+
+	table->on_board[WORD_INDEX (square)] |= WORD_BIT (square);
+	if (x > 0)
+	  table->not_first_column[WORD_INDEX (square)] |= WORD_BIT (square);
+	if (x < width - 1)
+	  table->not_last_column[WORD_INDEX (square)] |= WORD_BIT (square);
+
+	for (direction = 0; direction < 8; direction++) {
+	  unsigned long long *ray = RAY (table, square, direction);
+	  int ray_x = x + direction_x[direction];
+	  int ray_y = y + direction_y[direction];
+
+	  while (ON_SIZED_GRID (width, height, ray_x, ray_y)) {
+	    int ray_square = ray_x + width * ray_y;
+
+	    ray[WORD_INDEX (ray_square)] |= WORD_BIT (ray_square);
+	    ray_x += direction_x[direction];
+	    ray_y += direction_y[direction];
+	  }
+	}
+      }
+    }
+
+    *table_pointer = table;
+  }
+
+  table = *table_pointer;
+
+#if BOARD_USE_PTHREADS
+  pthread_mutex_unlock (&ray_tables_lock);
+#endif
+
+  return table;
+}
+
+
+static void
+rebuild_bitboards (Board *board)
+{
+  AmazonsBoardData *data = &board->data.amazons;
+  int x;
+  int y;
+
+  memset (data->amazons, 0, sizeof data->amazons);
+  memset (&data->occupied, 0, sizeof data->occupied);
+
+  for (y = 0; y < board->height; y++) {
+    for (x = 0; x < board->width; x++) {
+      int contents = board->grid[POSITION (x, y)];
+      int square = x + board->width * y;
+
+      if (contents != EMPTY) {
+	data->occupied.words[WORD_INDEX (square)] |= WORD_BIT (square);
+	if (IS_STONE (contents)) {
+	  data->amazons[COLOR_INDEX (contents)].words[WORD_INDEX (square)]
+	    |= WORD_BIT (square);
+	}
+      }
+    }
+  }
+}
+
+
+/* Set grid contents at `pos' and update bitboards accordingly. */
+static inline void
+set_point (Board *board, int pos, int contents)
+{
+  AmazonsBoardData *data = &board->data.amazons;
+  int old_contents = board->grid[pos];
+  int square = SQUARE (board, pos);
+  int word_index = WORD_INDEX (square);
+  unsigned long long bit = WORD_BIT (square);
+
+  if (IS_STONE (old_contents))
+    data->amazons[COLOR_INDEX (old_contents)].words[word_index] &= ~bit;
+  if (IS_STONE (contents))
+    data->amazons[COLOR_INDEX (contents)].words[word_index] |= bit;
+
+  if (contents != EMPTY)
+    data->occupied.words[word_index] |= bit;
+  else
+    data->occupied.words[word_index] &= ~bit;
+
+  board->grid[pos] = contents;
+}
+
+
+/* Compute all empty squares a queen at `square' can reach given
+ * `occupied' squares.  Classical ray method: a ray is cut off with the
+ * ray of the same direction starting at the first blocker.
+ */
+static void
+get_queen_attacks (const AmazonsRayTable *table, int square,
+		   const unsigned long long *occupied,
+		   unsigned long long *attacks)
+{
+  int num_words = table->num_words;
+  int direction;
+  int k;
+
+  for (k = 0; k < num_words; k++)
+    attacks[k] = 0;
+
+  for (direction = 0; direction < 8; direction++) {
+    const unsigned long long *ray = RAY (table, square, direction);
+    const unsigned long long *blocker_ray = NULL;
+
+    if (positive_direction[direction]) {
+      for (k = WORD_INDEX (square); k < num_words; k++) {
+	if (ray[k] & occupied[k]) {
+	  blocker_ray = RAY (table,
+			     k * 64 + BOARD_FIRST_BIT_INDEX (ray[k]
+							     & occupied[k]),
+			     direction);
+	  break;
+	}
+      }
+    }
+    else {
+      for (k = WORD_INDEX (square); k >= 0; k--) {
+	if (ray[k] & occupied[k]) {
+	  blocker_ray = RAY (table,
+			     k * 64 + BOARD_LAST_BIT_INDEX (ray[k]
+							    & occupied[k]),
+			     direction);
+	  break;
+	}
+      }
+    }
+
+    if (blocker_ray) {
+      for (k = 0; k < num_words; k++)
+	attacks[k] |= ray[k] ^ blocker_ray[k];
+    }
+    else {
+      for (k = 0; k < num_words; k++)
+	attacks[k] |= ray[k];
+    }
+  }
+
+  /* Unlike chess pieces, amazons cannot move onto the blockers. */
+  for (k = 0; k < num_words; k++)
+    attacks[k] &= ~occupied[k];
+}
+
+
+/* Shift `bitboard' in place by `shift' squares towards higher bits
+ * (or lower bits if `shift' is negative.)  Absolute value of `shift'
+ * must be less than 64.
+ */
+static inline void
+shift_bitboard (unsigned long long *bitboard, int num_words, int shift)
+{
+  int k;
+
+  if (shift > 0) {
+    for (k = num_words - 1; k > 0; k--) {
+      bitboard[k] = ((bitboard[k] << shift)
+		     | (bitboard[k - 1] >> (64 - shift)));
+    }
+
+    bitboard[0] <<= shift;
+  }
+  else {
+    shift = -shift;
+
+    for (k = 0; k < num_words - 1; k++) {
+      bitboard[k] = ((bitboard[k] >> shift)
+		     | (bitboard[k + 1] << (64 - shift)));
+    }
+
+    bitboard[num_words - 1] >>= shift;
+  }
+}
+
+
+/* Find all `empty' squares reachable with one queen (or king) move
+ * from any square of `frontier'.  All frontier squares are advanced
+ * at once, one direction at a time, so the cost doesn't depend on the
+ * number of squares in the frontier.
+ */
+static void
+expand_frontier (const AmazonsRayTable *table,
+		 const unsigned long long *frontier,
+		 const unsigned long long *empty, int use_king_moves,
+		 unsigned long long *next_frontier)
+{
+  int num_words = table->num_words;
+  int direction;
+  int k;
+
+  for (k = 0; k < num_words; k++)
+    next_frontier[k] = 0;
+
+  for (direction = 0; direction < 8; direction++) {
+    int shift = direction_x[direction] + table->width * direction_y[direction];
+    const unsigned long long *mask
+      = (direction_x[direction] > 0 ? table->not_first_column
+	 : (direction_x[direction] < 0 ? table->not_last_column
+	    : table->on_board));
+    unsigned long long beam[AMAZONS_BITBOARD_NUM_WORDS];
+    unsigned long long beam_is_empty;
+
+    memcpy (beam, frontier, num_words * sizeof (unsigned long long));
+
+    do {
+      shift_bitboard (beam, num_words, shift);
+
+      for (k = 0, beam_is_empty = 1; k < num_words; k++) {
+	beam[k] &= mask[k] & empty[k];
+	next_frontier[k] |= beam[k];
+	if (beam[k])
+	  beam_is_empty = 0;
+      }
+    } while (!beam_is_empty && !use_king_moves);
+  }
 }
 
 
@@ -374,6 +762,250 @@ amazons_parse_move (int board_width, int board_height, const char *move_string,
 }
 
 
+
+
+/* Amazons-specific functions. */
+
+/* Count all legal moves (i.e. different "from", "to" and
+ * "shoot-arrow-to" triples) of `color'.
+ */
+int
+amazons_count_moves (const Board *board, int color)
+{
+  const AmazonsRayTable *table;
+  const AmazonsBitboard *amazons;
+  int num_moves = 0;
+  int i;
+
+  assert (board);
+  assert (board->game == GAME_AMAZONS);
+  assert (IS_STONE (color));
+
+  table	  = board->data.amazons.ray_table;
+  amazons = &board->data.amazons.amazons[COLOR_INDEX (color)];
+
+  for (i = 0; i < table->num_words; i++) {
+    unsigned long long from_bits;
+
+    for (from_bits = amazons->words[i]; from_bits;
+	 from_bits &= from_bits - 1) {
+      int from = i * 64 + BOARD_FIRST_BIT_INDEX (from_bits);
+      unsigned long long occupied[AMAZONS_BITBOARD_NUM_WORDS];
+      unsigned long long targets[AMAZONS_BITBOARD_NUM_WORDS];
+      int j;
+
+      /* The amazon doesn't block its own arrow once it has moved. */
+      memcpy (occupied, board->data.amazons.occupied.words,
+	      table->num_words * sizeof (unsigned long long));
+      get_queen_attacks (table, from, occupied, targets);
+      occupied[WORD_INDEX (from)] &= ~WORD_BIT (from);
+
+      for (j = 0; j < table->num_words; j++) {
+	unsigned long long to_bits;
+
+	for (to_bits = targets[j]; to_bits; to_bits &= to_bits - 1) {
+	  unsigned long long arrows[AMAZONS_BITBOARD_NUM_WORDS];
+	  int k;
+
+	  get_queen_attacks (table, j * 64 + BOARD_FIRST_BIT_INDEX (to_bits),
+			     occupied, arrows);
+	  for (k = 0; k < table->num_words; k++)
+	    num_moves += BOARD_COUNT_BITS (arrows[k]);
+	}
+      }
+    }
+  }
+
+  return num_moves;
+}
+
+
+/* Generate all legal moves of `color'.  Returned array is allocated
+ * with utils_malloc() and must be freed by the caller.  Number of
+ * moves is stored in `num_moves'.  If there are no moves, NULL is
+ * returned.
+ */
+BoardAmazonsMove *
+amazons_generate_moves (const Board *board, int color, int *num_moves)
+{
+  const AmazonsRayTable *table;
+  const AmazonsBitboard *amazons;
+  BoardAmazonsMove *moves = NULL;
+  int moves_size = 0;
+  int i;
+
+  assert (board);
+  assert (board->game == GAME_AMAZONS);
+  assert (IS_STONE (color));
+  assert (num_moves);
+
+  table	  = board->data.amazons.ray_table;
+  amazons = &board->data.amazons.amazons[COLOR_INDEX (color)];
+
+  *num_moves = 0;
+
+  for (i = 0; i < table->num_words; i++) {
+    unsigned long long from_bits;
+
+    for (from_bits = amazons->words[i]; from_bits;
+	 from_bits &= from_bits - 1) {
+      int from = i * 64 + BOARD_FIRST_BIT_INDEX (from_bits);
+      unsigned long long occupied[AMAZONS_BITBOARD_NUM_WORDS];
+      unsigned long long targets[AMAZONS_BITBOARD_NUM_WORDS];
+      int j;
+
+      memcpy (occupied, board->data.amazons.occupied.words,
+	      table->num_words * sizeof (unsigned long long));
+      get_queen_attacks (table, from, occupied, targets);
+      occupied[WORD_INDEX (from)] &= ~WORD_BIT (from);
+
+      for (j = 0; j < table->num_words; j++) {
+	unsigned long long to_bits;
+
+	for (to_bits = targets[j]; to_bits; to_bits &= to_bits - 1) {
+	  int to = j * 64 + BOARD_FIRST_BIT_INDEX (to_bits);
+	  unsigned long long arrows[AMAZONS_BITBOARD_NUM_WORDS];
+	  int num_arrows = 0;
+	  int k;
+
+	  get_queen_attacks (table, to, occupied, arrows);
+	  for (k = 0; k < table->num_words; k++)
+	    num_arrows += BOARD_COUNT_BITS (arrows[k]);
+
+	  if (*num_moves + num_arrows > moves_size) {
+	    moves_size = MAX (2 * moves_size, *num_moves + num_arrows);
+	    moves = utils_realloc (moves,
+				   moves_size * sizeof (BoardAmazonsMove));
+	  }
+
+	  for (k = 0; k < table->num_words; k++) {
+	    unsigned long long arrow_bits;
+
+	    for (arrow_bits = arrows[k]; arrow_bits;
+		 arrow_bits &= arrow_bits - 1) {
+	      int arrow = k * 64 + BOARD_FIRST_BIT_INDEX (arrow_bits);
+	      BoardAmazonsMove *move = moves + (*num_moves)++;
+
+	      move->to.x		       = to % board->width;
+	      move->to.y		       = to / board->width;
+	      move->move_data.from.x	       = from % board->width;
+	      move->move_data.from.y	       = from / board->width;
+	      move->move_data.shoot_arrow_to.x = arrow % board->width;
+	      move->move_data.shoot_arrow_to.y = arrow / board->width;
+	    }
+	  }
+	}
+      }
+    }
+  }
+
+  return moves;
+}
+
+
+/* Mark territory of both players on `grid' and return the number of
+ * black territory squares minus the number of white ones.  An empty
+ * square is considered territory of the player whose amazons reach it
+ * in fewer queen moves (or king moves if `use_king_distance' is
+ * nonzero.)  Squares that both players reach equally fast or that
+ * can't be reached at all are neutral.
+ *
+ * Only territory squares are changed in `grid', which may also be
+ * NULL if only the score is needed.  Distances for both players are
+ * computed with simultaneous breadth-first searches over bitboards,
+ * which is cheap enough to do on every move.
+ */
+int
+amazons_mark_territory_on_grid (const Board *board, char *grid,
+				int use_king_distance,
+				char black_territory_mark,
+				char white_territory_mark)
+{
+  const AmazonsRayTable *table;
+  const AmazonsBoardData *data;
+  unsigned long long empty[AMAZONS_BITBOARD_NUM_WORDS];
+  unsigned long long frontier[NUM_COLORS][AMAZONS_BITBOARD_NUM_WORDS];
+  unsigned long long reached[NUM_COLORS][AMAZONS_BITBOARD_NUM_WORDS];
+  unsigned long long territory[NUM_COLORS][AMAZONS_BITBOARD_NUM_WORDS];
+  int num_words;
+  int score = 0;
+  int k;
+
+  assert (board);
+  assert (board->game == GAME_AMAZONS);
+
+  data	    = &board->data.amazons;
+  table	    = data->ray_table;
+  num_words = table->num_words;
+
+  for (k = 0; k < num_words; k++) {
+    empty[k]		      = table->on_board[k] & ~data->occupied.words[k];
+    frontier[BLACK_INDEX][k]  = data->amazons[BLACK_INDEX].words[k];
+    frontier[WHITE_INDEX][k]  = data->amazons[WHITE_INDEX].words[k];
+    reached[BLACK_INDEX][k]   = 0;
+    reached[WHITE_INDEX][k]   = 0;
+    territory[BLACK_INDEX][k] = 0;
+    territory[WHITE_INDEX][k] = 0;
+  }
+
+  while (1) {
+    unsigned long long next_frontier[NUM_COLORS][AMAZONS_BITBOARD_NUM_WORDS];
+    int frontiers_are_empty = 1;
+
+    expand_frontier (table, frontier[BLACK_INDEX], empty, use_king_distance,
+		     next_frontier[BLACK_INDEX]);
+    expand_frontier (table, frontier[WHITE_INDEX], empty, use_king_distance,
+		     next_frontier[WHITE_INDEX]);
+
+    for (k = 0; k < num_words; k++) {
+      unsigned long long black_next = (next_frontier[BLACK_INDEX][k]
+				       & ~reached[BLACK_INDEX][k]);
+      unsigned long long white_next = (next_frontier[WHITE_INDEX][k]
+				       & ~reached[WHITE_INDEX][k]);
+
+      territory[BLACK_INDEX][k] |= (black_next
+				    & ~(reached[WHITE_INDEX][k] | white_next));
+      territory[WHITE_INDEX][k] |= (white_next
+				    & ~(reached[BLACK_INDEX][k] | black_next));
+
+      reached[BLACK_INDEX][k]  |= black_next;
+      reached[WHITE_INDEX][k]  |= white_next;
+      frontier[BLACK_INDEX][k]  = black_next;
+      frontier[WHITE_INDEX][k]  = white_next;
+
+      if (black_next || white_next)
+	frontiers_are_empty = 0;
+    }
+
+    if (frontiers_are_empty)
+      break;
+  }
+
+  for (k = 0; k < num_words; k++) {
+    score += (BOARD_COUNT_BITS (territory[BLACK_INDEX][k])
+	      - BOARD_COUNT_BITS (territory[WHITE_INDEX][k]));
+  }
+
+  if (grid) {
+    for (k = 0; k < num_words; k++) {
+      unsigned long long bits;
+
+      for (bits = territory[BLACK_INDEX][k]; bits; bits &= bits - 1) {
+	grid[table->positions[k * 64 + BOARD_FIRST_BIT_INDEX (bits)]]
+	  = black_territory_mark;
+      }
+
+      for (bits = territory[WHITE_INDEX][k]; bits; bits &= bits - 1) {
+	grid[table->positions[k * 64 + BOARD_FIRST_BIT_INDEX (bits)]]
+	  = white_territory_mark;
+      }
+    }
+  }
+
+  return score;
+}
+
+
 /*
  * Local Variables:
  * tab-width: 8
@@ -54,6 +54,8 @@ struct _AmazonsMoveStackEntry {
 };
 
 
+void		amazons_reset_game_data (Board *board, int forced_reset);
+
 int		amazons_adjust_color_to_play (const Board *board,
 					      BoardRuleSet rule_set,
 					      int color);
@@ -68,6 +70,9 @@ int		amazons_get_default_setup (int width, int height,
 int		amazons_is_legal_move (const Board *board,
 				       BoardRuleSet rule_set,
 				       int color, va_list move);
+int		amazons_get_legal_moves (const Board *board,
+					 BoardRuleSet rule_set, int color,
+					 char legal_grid[BOARD_GRID_SIZE]);
 
 void		amazons_play_move (Board *board, int color, va_list move);
 void		amazons_undo (Board *board);
@@ -0,0 +1,310 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+ * This file is part of Quarry.                                    *
+ *                                                                 *
+ * Copyright (C) 2003, 2004, 2005, 2006 Paul Pogonyshev.           *
+ *                                                                 *
+ * This program is free software; you can redistribute it and/or   *
+ * modify it under the terms of the GNU General Public License as  *
+ * published by the Free Software Foundation; either version 2 of  *
+ * the License, or (at your option) any later version.             *
+ *                                                                 *
+ * This program is distributed in the hope that it will be useful, *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of  *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the   *
+ * GNU General Public License for more details.                    *
+ *                                                                 *
+ * You should have received a copy of the GNU General Public       *
+ * License along with this program; if not, write to the Free      *
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,     *
+ * Boston, MA 02110-1301, USA.                                     *
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Board engine benchmark.  For Reversi and Amazons it enumerates all
+ * move sequences of given depth from the initial position (``perft'')
+ * and for Go it runs the ownership playouts of go_estimate_ownership()
+ * from the empty board.  Results are printed one line per benchmark as
+ * `KEY=VALUE' pairs, so that they are easy to compare with `diff' or
+ * to process with a script.  Allocations are only reported when the
+ * utilities are built with ENABLE_ALLOCATION_COUNTING.
+ */
+
+
+#include "board.h"
+#include "game-info.h"
+#include "utils.h"
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+enum {
+  OPTION_GAME = UCHAR_MAX + 1,
+  OPTION_SIZE,
+  OPTION_DEPTH,
+  OPTION_PLAYOUTS,
+
+  OPTION_HELP
+};
+
+
+static const struct option bench_options[] = {
+  { "game",		required_argument, NULL, OPTION_GAME		},
+  { "size",		required_argument, NULL, OPTION_SIZE		},
+  { "depth",		required_argument, NULL, OPTION_DEPTH		},
+  { "playouts",		required_argument, NULL, OPTION_PLAYOUTS	},
+
+  { "help",		no_argument,	   NULL, OPTION_HELP		},
+
+  {  NULL,		no_argument,	   NULL, 0			}
+};
+
+static const char *usage_string =
+  "Usage: %s [OPTION...]\n"
+  "\n"
+  "  --game=GAME        benchmark only `go', `reversi' or `amazons'\n"
+  "  --size=SIZE        board size (default 19, 8 and 10 respectively)\n"
+  "  --depth=DEPTH      perft depth for Reversi (default 9) and Amazons\n"
+  "                     (default 2)\n"
+  "  --playouts=NUMBER  number of Go playouts (default 2000)\n"
+  "  --help             display this help and exit\n";
+
+
+static void	run_benchmark (Game game, int size, int depth,
+			       int num_playouts);
+
+static void	set_up_initial_position (Board *board);
+
+static unsigned long
+		reversi_perft (Board *board, int color, int depth,
+			       int previous_player_passed);
+static unsigned long
+		amazons_perft (Board *board, int color, int depth);
+
+
+
+int
+main (int argc, char *argv[])
+{
+  /* GAME_DUMMY stands for all games. */
+  int game = GAME_DUMMY;
+  int size = 0;
+  int depth = 0;
+  int num_playouts = 2000;
+  int option;
+
+  utils_remember_program_name (argv[0]);
+
+  while ((option = getopt_long (argc, argv, "", bench_options, NULL))
+	 != -1) {
+    switch (option) {
+    case OPTION_GAME:
+      if (strcmp (optarg, "go") == 0)
+	game = GAME_GO;
+      else if (strcmp (optarg, "reversi") == 0)
+	game = GAME_REVERSI;
+      else if (strcmp (optarg, "amazons") == 0)
+	game = GAME_AMAZONS;
+      else {
+	fprintf (stderr, "%s: unsupported game `%s'\n",
+		 short_program_name, optarg);
+	return 255;
+      }
+
+      break;
+
+    case OPTION_SIZE:
+      size = atoi (optarg);
+      if (size < BOARD_MIN_WIDTH || size > BOARD_MAX_WIDTH) {
+	fprintf (stderr, "%s: board size must be between %d and %d\n",
+		 short_program_name, BOARD_MIN_WIDTH, BOARD_MAX_WIDTH);
+	return 255;
+      }
+
+      break;
+
+    case OPTION_DEPTH:
+      depth = atoi (optarg);
+      break;
+
+    case OPTION_PLAYOUTS:
+      num_playouts = atoi (optarg);
+      break;
+
+    case OPTION_HELP:
+      printf (usage_string, full_program_name);
+      return 0;
+
+    default:
+      fprintf (stderr, "Try `%s --help' for more information.\n",
+	       full_program_name);
+      return 255;
+    }
+  }
+
+  if (game == GAME_DUMMY || game == GAME_GO)
+    run_benchmark (GAME_GO, (size ? size : 19), 0, num_playouts);
+
+  if (game == GAME_DUMMY || game == GAME_REVERSI)
+    run_benchmark (GAME_REVERSI, (size ? size : 8), (depth ? depth : 9), 0);
+
+  if (game == GAME_DUMMY || game == GAME_AMAZONS)
+    run_benchmark (GAME_AMAZONS, (size ? size : 10), (depth ? depth : 2), 0);
+
+  utils_free_program_name_strings ();
+
+  return 0;
+}
+
+
+static void
+run_benchmark (Game game, int size, int depth, int num_playouts)
+{
+  Board *board = board_new (game, size, size);
+#if ENABLE_ALLOCATION_COUNTING
+  unsigned int num_allocations = utils_get_num_allocations ();
+#endif
+  unsigned long num_nodes = 0;
+  clock_t start_time;
+  double seconds;
+
+  set_up_initial_position (board);
+
+  start_time = clock ();
+
+  if (game == GAME_GO) {
+    int ownership[BOARD_GRID_SIZE];
+
+    board_fill_int_grid (board, ownership, 0);
+    num_nodes = go_estimate_ownership (board, num_playouts, 1, ownership);
+  }
+  else if (game == GAME_REVERSI) {
+    num_nodes = reversi_perft (board, game_info[game].color_to_play_first,
+			       depth, 0);
+  }
+  else
+    num_nodes = amazons_perft (board, game_info[game].color_to_play_first,
+			       depth);
+
+  seconds = (double) (clock () - start_time) / CLOCKS_PER_SEC;
+
+  printf ("game=%s size=%d ", game_info[game].name, size);
+  if (game == GAME_GO)
+    printf ("test=playouts playouts=%d ", num_playouts);
+  else
+    printf ("test=perft depth=%d ", depth);
+
+  printf ("nodes=%lu seconds=%.3f nodes_per_second=%.0f",
+	  num_nodes, seconds, (seconds > 0.0 ? num_nodes / seconds : 0.0));
+
+#if ENABLE_ALLOCATION_COUNTING
+  printf (" allocations=%u",
+	  utils_get_num_allocations () - num_allocations);
+#endif
+
+  printf ("\n");
+
+  board_delete (board);
+}
+
+
+static void
+set_up_initial_position (Board *board)
+{
+  BoardPositionList *black_stones;
+  BoardPositionList *white_stones;
+
+  if (game_get_default_setup (board->game, board->width, board->height,
+			      &black_stones, &white_stones)) {
+    const BoardPositionList *change_lists[NUM_ON_GRID_VALUES];
+
+    change_lists[EMPTY]		       = NULL;
+    change_lists[BLACK]		       = black_stones;
+    change_lists[WHITE]		       = white_stones;
+    change_lists[SPECIAL_ON_GRID_VALUE] = NULL;
+
+    board_apply_changes (board, change_lists);
+
+    if (black_stones)
+      board_position_list_delete (black_stones);
+    if (white_stones)
+      board_position_list_delete (white_stones);
+  }
+}
+
+
+
+/* Count leaf nodes of Reversi game tree of given depth.  A player
+ * without legal moves passes, which counts as a move.  A position
+ * where neither player can move is a leaf regardless of depth.
+ */
+static unsigned long
+reversi_perft (Board *board, int color, int depth, int previous_player_passed)
+{
+  char legal_grid[BOARD_GRID_SIZE];
+  unsigned long num_nodes = 0;
+  int x;
+  int y;
+
+  if (depth == 0)
+    return 1;
+
+  if (!board_get_legal_moves (board, REVERSI_RULE_SET_DEFAULT, color,
+			      legal_grid))
+    return (previous_player_passed
+	    ? 1 : reversi_perft (board, OTHER_COLOR (color), depth - 1, 1));
+
+  for (y = 0; y < board->height; y++) {
+    for (x = 0; x < board->width; x++) {
+      if (legal_grid[POSITION (x, y)]) {
+	board_play_move (board, color, x, y);
+	num_nodes += reversi_perft (board, OTHER_COLOR (color), depth - 1, 0);
+	board_undo (board, 1);
+      }
+    }
+  }
+
+  return num_nodes;
+}
+
+
+/* Count leaf nodes of Amazons game tree of given depth.  A player
+ * without legal moves loses, so such positions are leaves.
+ */
+static unsigned long
+amazons_perft (Board *board, int color, int depth)
+{
+  BoardAmazonsMove *moves;
+  unsigned long num_nodes = 0;
+  int num_moves;
+  int k;
+
+  if (depth == 0)
+    return 1;
+
+  moves = amazons_generate_moves (board, color, &num_moves);
+  if (!num_moves)
+    return 1;
+
+  for (k = 0; k < num_moves; k++) {
+    board_play_move (board, color, moves[k].to.x, moves[k].to.y,
+		     moves[k].move_data);
+    num_nodes += amazons_perft (board, OTHER_COLOR (color), depth - 1);
+    board_undo (board, 1);
+  }
+
+  utils_free (moves);
+
+  return num_nodes;
+}
+
+
+/*
+ * Local Variables:
+ * tab-width: 8
+ * c-basic-offset: 2
+ * End:
+ */
@@ -42,6 +42,20 @@
 #define BOARD_VALIDATION_LEVEL	0
 
 
+/* Some tables shared by all boards (Zobrist keys, Amazons ray masks)
+ * are computed on first use.  Boards can be created in several
+ * threads at once (parser jobs, playouts), so the initialization is
+ * guarded when POSIX threads are available.  Otherwise, the first
+ * board of each kind must be created before any other thread does
+ * the same.
+ */
+#define BOARD_USE_PTHREADS	(HAVE_PTHREAD_H && HAVE_PTHREAD_ONCE)
+
+#if BOARD_USE_PTHREADS
+#include <pthread.h>
+#endif
+
+
 #define SOUTH(pos)		((pos) + (1 + BOARD_MAX_WIDTH))
 #define WEST(pos)		((pos) - 1)
 #define NORTH(pos)		((pos) - (1 + BOARD_MAX_WIDTH))
@@ -50,6 +64,20 @@
 #define ON_GRID(grid, pos)	((grid) [pos] != OFF_GRID)
 
 
+/* Zobrist keys are indexed by on-grid value and position.  Keys for
+ * `EMPTY' are all zero, so changing a position from any value to any
+ * other is a matter of two XORs.
+ */
+#define ZOBRIST_KEY(value, pos)		(zobrist_keys[(int) (value)][pos])
+
+#define CHANGE_HASH_KEY(board, pos, old_contents, new_contents)	\
+  ((board)->hash_key ^= (ZOBRIST_KEY ((old_contents), (pos))		\
+			 ^ ZOBRIST_KEY ((new_contents), (pos))))
+
+#define SITUATIONAL_HASH_KEY(hash_key, color_to_play)			\
+  ((hash_key) ^ zobrist_color_to_play_keys[COLOR_INDEX (color_to_play)])
+
+
 /* Cast expressions are not allowed as lvalues by ISO C and may be
  * frowned upon by strict compilers, hence the tricks below.  Must be
  * optimized away in any case.
@@ -69,6 +97,23 @@
     = (MoveStackEntryType *) (board)->move_stack_pointer - 1))
 
 
+/* Bit tricks on 64-bit words, used by bitboard code. */
+#if (defined __GNUC__						\
+     && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4)))
+
+#define BOARD_COUNT_BITS(bits)		__builtin_popcountll (bits)
+#define BOARD_FIRST_BIT_INDEX(bits)	__builtin_ctzll (bits)
+#define BOARD_LAST_BIT_INDEX(bits)	(63 - __builtin_clzll (bits))
+
+#else
+
+#define BOARD_COUNT_BITS(bits)		board_count_bits (bits)
+#define BOARD_FIRST_BIT_INDEX(bits)	board_first_bit_index (bits)
+#define BOARD_LAST_BIT_INDEX(bits)	board_last_bit_index (bits)
+
+#endif
+
+
 typedef struct _BoardStackEntry		BoardStackEntry;
 
 struct _BoardStackEntry {
@@ -80,6 +125,13 @@ struct _BoardStackEntry {
 #endif
 
   int		move_number;
+
+  /* Position before the stack entry was pushed and the color that
+   * played the move (or `EMPTY' for setup changes and dummy entries).
+   * Maintained by `board.c', game-specific code needn't care.
+   */
+  BoardHashKey	hash_key;
+  int		color;
 };
 
 
@@ -95,9 +147,28 @@ int		determine_position_delta (int delta_x, int delta_y);
 
 void		board_increase_move_stack_size (Board *board);
 
+int		board_count_bits (unsigned long long bits);
+int		board_first_bit_index (unsigned long long bits);
+int		board_last_bit_index (unsigned long long bits);
+
+
+void		board_hash_key_set_init (BoardHashKeySet *set);
+void		board_hash_key_set_dispose (BoardHashKeySet *set);
+void		board_hash_key_set_empty (BoardHashKeySet *set);
+
+void		board_hash_key_set_add (BoardHashKeySet *set,
+					BoardHashKey hash_key);
+void		board_hash_key_set_remove (BoardHashKeySet *set,
+					   BoardHashKey hash_key);
+int		board_hash_key_set_contains (const BoardHashKeySet *set,
+					     BoardHashKey hash_key);
+
 
 extern const int	delta[8];
 
+extern BoardHashKey	zobrist_keys[NUM_ON_GRID_VALUES][BOARD_GRID_SIZE];
+extern BoardHashKey	zobrist_color_to_play_keys[NUM_COLORS];
+
 
 #endif /* QUARRY_BOARD_INTERNALS_H */
 
@@ -50,6 +50,10 @@
 #define BOARD_FULL_GRID_SIZE	(POSITION (BOARD_MAX_WIDTH,		\
 					   BOARD_MAX_HEIGHT) + 1)
 
+/* Grid size needed for a board of given size, including border. */
+#define BOARD_SIZED_GRID_SIZE(width, height)				\
+  (POSITION ((width), (height)) + 1)
+
 #define ON_SIZED_GRID(width, height, x, y)				\
   ((unsigned int) (x) < (unsigned int) (width)				\
    && (unsigned int) (y) < (unsigned int) (height))
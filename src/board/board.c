@@ -24,6 +24,7 @@
 
 #include "board-internals.h"
 #include "game-info.h"
+#include "go.h"
 #include "utils.h"
 
 #include <assert.h>
@@ -36,11 +37,32 @@
 
 #define CHANGE_STACK_SIZE_INCREMENT	BOARD_MAX_POSITIONS
 
+#define MIN_HASH_KEY_SET_SIZE		64
 
+#define HASH_KEY_SET_SLOT(set, hash_key)			\
+  ((int) ((unsigned int) (hash_key) & ((set)->num_slots - 1)))
+
+#define TOP_STACK_ENTRY(board)						\
+  ((BoardStackEntry *)							\
+   ((char *) (board)->move_stack_pointer				\
+    - game_info[(board)->game].stack_entry_size))
+
+
+static void	initialize_zobrist_keys (void);
+
+static void	allocate_board_arrays (Board *board);
 static void	clear_board_grid (Board *board);
 
+static void	push_position_to_history (Board *board,
+					  BoardHashKey hash_key, int color);
+static BoardHashKey  pop_position_from_history (Board *board);
+
 static void	ensure_change_stack_space (Board *board, int num_entries);
 
+static void	resize_hash_key_set (BoardHashKeySet *set, int num_slots);
+static void	copy_hash_key_set_keys (const BoardHashKeySet *set,
+					BoardHashKey *keys);
+
 
 const int delta[8] = {
   SOUTH (0),
@@ -54,6 +76,16 @@ const int delta[8] = {
 };
 
 
+BoardHashKey  zobrist_keys[NUM_ON_GRID_VALUES][BOARD_GRID_SIZE];
+BoardHashKey  zobrist_color_to_play_keys[NUM_COLORS];
+
+#if BOARD_USE_PTHREADS
+static pthread_once_t  zobrist_keys_once = PTHREAD_ONCE_INIT;
+#else
+static int	       zobrist_keys_initialized = 0;
+#endif
+
+
 /* Dynamically allocate a Board structure for specified game and with
  * specified dimensions.  The board is cleared.
  */
@@ -69,6 +101,13 @@ board_new (Game game, int width, int height)
   assert (BOARD_MIN_WIDTH <= width && width <= BOARD_MAX_WIDTH);
   assert (BOARD_MIN_HEIGHT <= height && height <= BOARD_MAX_HEIGHT);
 
+#if BOARD_USE_PTHREADS
+  pthread_once (&zobrist_keys_once, initialize_zobrist_keys);
+#else
+  if (!zobrist_keys_initialized)
+    initialize_zobrist_keys ();
+#endif
+
   board->game   = game;
   board->width  = width;
   board->height = height;
@@ -77,6 +116,9 @@ board_new (Game game, int width, int height)
   board->play_move     = game_info[game].play_move;
   board->undo	       = game_info[game].undo;
 
+  board->grid = NULL;
+  allocate_board_arrays (board);
+
   clear_board_grid (board);
   if (game_info[game].reset_game_data)
     game_info[game].reset_game_data (board, 1);
@@ -92,6 +134,9 @@ board_new (Game game, int width, int height)
   board->change_stack_pointer = board->change_stack;
   board->change_stack_end = (board->change_stack + width * height);
 
+  board_hash_key_set_init (&board->positional_history);
+  board_hash_key_set_init (&board->situational_history);
+
   return board;
 }
 
@@ -102,6 +147,10 @@ board_delete (Board *board)
 {
   assert (board);
 
+  board_hash_key_set_dispose (&board->positional_history);
+  board_hash_key_set_dispose (&board->situational_history);
+
+  utils_free (board->grid);
   utils_free (board->move_stack);
   utils_free (board->change_stack);
   utils_free (board);
@@ -124,6 +173,7 @@ board_duplicate_without_stacks (const Board *board)
   board_copy = board_new (board->game, board->width, board->height);
 
   board_copy->move_number = board->move_number;
+  board_copy->hash_key	  = board->hash_key;
 
   for (y = 0, pos = POSITION (0, 0); y < board->height; y++) {
     for (x = 0; x < board->width; x++, pos++)
@@ -131,13 +181,164 @@ board_duplicate_without_stacks (const Board *board)
     pos += BOARD_MAX_WIDTH + 1 - board->width;
   }
 
-  if (board->game == GAME_GO)
-    memcpy (&board_copy->data.go, &board->data.go, sizeof (GoBoardData));
+  if (board->game == GAME_GO) {
+    const GoBoardData *data = &board->data.go;
+    GoBoardData *data_copy = &board_copy->data.go;
+
+    /* Copy only the parts of the arrays used for this board size.
+     * Marks are left cleared by board_new(); they are only meaningful
+     * during a single operation anyway.
+     */
+    data_copy->ko_master		= data->ko_master;
+    data_copy->ko_position		= data->ko_position;
+    data_copy->prisoners[BLACK_INDEX]	= data->prisoners[BLACK_INDEX];
+    data_copy->prisoners[WHITE_INDEX]	= data->prisoners[WHITE_INDEX];
+    data_copy->last_string_number	= data->last_string_number;
+
+    for (y = 0, pos = POSITION (0, 0); y < board->height; y++) {
+      memcpy (data_copy->string_number + pos, data->string_number + pos,
+	      board->width * sizeof data->string_number[0]);
+      pos += BOARD_MAX_WIDTH + 1;
+    }
+
+    memcpy (data_copy->liberties, data->liberties,
+	    data->string_ring_size * sizeof data->liberties[0]);
+  }
+  else if (board->game == GAME_REVERSI) {
+    memcpy (&board_copy->data.reversi, &board->data.reversi,
+	    sizeof (ReversiBoardData));
+  }
+  else if (board->game == GAME_AMAZONS) {
+    memcpy (&board_copy->data.amazons, &board->data.amazons,
+	    sizeof (AmazonsBoardData));
+  }
 
   return board_copy;
 }
 
 
+/* Take a snapshot of board position.  Snapshots are much smaller than
+ * boards and can be restored with board_restore_snapshot().  Free it
+ * with board_snapshot_delete().
+ */
+BoardSnapshot *
+board_snapshot_new (const Board *board)
+{
+  BoardSnapshot *snapshot;
+  int x;
+  int y;
+  int k;
+
+  assert (board);
+
+  snapshot = utils_malloc (sizeof (BoardSnapshot)
+			   - (BOARD_MAX_POSITIONS
+			      - board->width * board->height));
+
+  snapshot->game	= board->game;
+  snapshot->width	= board->width;
+  snapshot->height	= board->height;
+  snapshot->move_number = board->move_number;
+  snapshot->hash_key	= board->hash_key;
+
+  for (y = 0, k = 0; y < board->height; y++) {
+    for (x = 0; x < board->width; x++)
+      snapshot->grid[k++] = board->grid[POSITION (x, y)];
+  }
+
+  if (board->game == GAME_GO) {
+    const BoardHashKeySet *positional_history = &board->positional_history;
+    const BoardHashKeySet *situational_history = &board->situational_history;
+
+    snapshot->ko_master		       = board->data.go.ko_master;
+    snapshot->ko_position	       = board->data.go.ko_position;
+    snapshot->prisoners[BLACK_INDEX] = board->data.go.prisoners[BLACK_INDEX];
+    snapshot->prisoners[WHITE_INDEX] = board->data.go.prisoners[WHITE_INDEX];
+
+    snapshot->num_positional_keys  = positional_history->num_keys;
+    snapshot->num_situational_keys = situational_history->num_keys;
+    snapshot->num_zero_keys[0]	   = positional_history->num_zero_keys;
+    snapshot->num_zero_keys[1]	   = situational_history->num_zero_keys;
+
+    snapshot->history_keys
+      = utils_malloc ((positional_history->num_keys
+		       + situational_history->num_keys)
+		      * sizeof (BoardHashKey));
+
+    copy_hash_key_set_keys (positional_history, snapshot->history_keys);
+    copy_hash_key_set_keys (situational_history,
+			    (snapshot->history_keys
+			     + positional_history->num_keys));
+  }
+  else {
+    snapshot->history_keys	   = NULL;
+    snapshot->num_positional_keys  = 0;
+    snapshot->num_situational_keys = 0;
+    snapshot->num_zero_keys[0]	   = 0;
+    snapshot->num_zero_keys[1]	   = 0;
+  }
+
+  return snapshot;
+}
+
+
+/* Set the board to position stored in `snapshot'.  Board stacks will
+ * be empty afterwards, so moves before the snapshot cannot be undone.
+ * For Go, position history used for superko checks is restored.
+ */
+void
+board_restore_snapshot (Board *board, const BoardSnapshot *snapshot)
+{
+  int x;
+  int y;
+  int k;
+
+  assert (board);
+  assert (snapshot);
+
+  board_set_parameters (board, snapshot->game,
+			snapshot->width, snapshot->height);
+
+  board->move_number = snapshot->move_number;
+  board->hash_key    = snapshot->hash_key;
+
+  for (y = 0, k = 0; y < board->height; y++) {
+    for (x = 0; x < board->width; x++)
+      board->grid[POSITION (x, y)] = snapshot->grid[k++];
+  }
+
+  /* Recompute whatever game-specific data depends on the grid. */
+  if (board->game == GAME_GO) {
+    board->data.go.ko_master		   = snapshot->ko_master;
+    board->data.go.ko_position		   = snapshot->ko_position;
+    board->data.go.prisoners[BLACK_INDEX] = snapshot->prisoners[BLACK_INDEX];
+    board->data.go.prisoners[WHITE_INDEX] = snapshot->prisoners[WHITE_INDEX];
+
+    for (k = 0; k < snapshot->num_positional_keys; k++) {
+      board_hash_key_set_add (&board->positional_history,
+			      snapshot->history_keys[k]);
+    }
+
+    for (; k < (snapshot->num_positional_keys
+		+ snapshot->num_situational_keys); k++) {
+      board_hash_key_set_add (&board->situational_history,
+			      snapshot->history_keys[k]);
+    }
+
+    board->positional_history.num_zero_keys  = snapshot->num_zero_keys[0];
+    board->situational_history.num_zero_keys = snapshot->num_zero_keys[1];
+
+    go_rebuild_strings (board);
+  }
+  else
+    game_info[board->game].reset_game_data (board, 0);
+
+#if BOARD_VALIDATION_LEVEL > 0
+  board_validate (board);
+#endif
+}
+
+
 /* Set board dimensions to specified values and clear the board as
  * needed.  This may include clearing board's grid, resetting
  * game-specific data (e.g. ko state for Go) and reallocating board
@@ -157,18 +358,25 @@ board_set_parameters (Board *board, Game game, int width, int height)
   assert (BOARD_MIN_WIDTH <= width && width <= BOARD_MAX_WIDTH);
   assert (BOARD_MIN_HEIGHT <= height && height <= BOARD_MAX_HEIGHT);
 
+  /* Boards restored from snapshots have empty stacks but non-empty
+   * grids.  Since hash key of an empty grid is zero, check it too.
+   */
   if (board->width != width || board->height != height
-      || board->move_stack_pointer != board->move_stack) {
-    board->width  = width;
-    board->height = height;
-    clear_board_grid (board);
-  }
-  else if (board->game != game) {
+      || board->game != game) {
     board->game = game;
     board->is_legal_move = game_info[game].is_legal_move;
     board->play_move     = game_info[game].play_move;
     board->undo		 = game_info[game].undo;
+
+    board->width  = width;
+    board->height = height;
+
+    allocate_board_arrays (board);
+    clear_board_grid (board);
   }
+  else if (board->move_stack_pointer != board->move_stack
+	   || board->hash_key != 0)
+    clear_board_grid (board);
   else
     need_full_reset = 0;
 
@@ -193,6 +401,80 @@ board_set_parameters (Board *board, Game game, int width, int height)
   }
 
   board->change_stack_pointer = board->change_stack;
+
+  board_hash_key_set_empty (&board->positional_history);
+  board_hash_key_set_empty (&board->situational_history);
+}
+
+
+/* Fill Zobrist key tables with pseudo-random numbers.  We use our own
+ * fixed-seed generator (xorshift) so that keys are the same on every
+ * run and can be stored externally.
+ */
+static void
+initialize_zobrist_keys (void)
+{
+  BoardHashKey state = 0x9e3779b97f4a7c15ULL;
+  int value;
+  int pos;
+  int k;
+
+  for (value = 0; value < NUM_ON_GRID_VALUES; value++) {
+    for (pos = 0; pos < BOARD_GRID_SIZE; pos++) {
+      if (value != EMPTY) {
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	zobrist_keys[value][pos] = state;
+      }
+      else
+	zobrist_keys[value][pos] = 0;
+    }
+  }
+
+  for (k = 0; k < NUM_COLORS; k++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    zobrist_color_to_play_keys[k] = state;
+  }
+
+#if !BOARD_USE_PTHREADS
+  zobrist_keys_initialized = 1;
+#endif
+}
+
+
+/* (Re)allocate board grid and, for Go, per-point and per-string
+ * arrays for the current game and board size.  All arrays share one
+ * block starting with the grid, so that a small board doesn't touch
+ * memory sized for the largest one.
+ */
+static void
+allocate_board_arrays (Board *board)
+{
+  int grid_size = BOARD_SIZED_GRID_SIZE (board->width, board->height);
+  int aligned_grid_size = ((grid_size + sizeof (unsigned int) - 1)
+			   & ~(sizeof (unsigned int) - 1));
+
+  if (board->game == GAME_GO) {
+    GoBoardData *data = &board->data.go;
+    int ring_size = GO_STRING_RING_SIZE_FOR (board->width, board->height);
+
+    board->grid = utils_realloc (board->grid,
+				 (aligned_grid_size
+				  + ((grid_size + ring_size)
+				     * (sizeof (unsigned int)
+					+ sizeof (short)))));
+
+    data->marked_positions = ((unsigned int *)
+			      (board->grid + aligned_grid_size));
+    data->marked_strings   = data->marked_positions + grid_size;
+    data->string_number	   = (short *) (data->marked_strings + ring_size);
+    data->liberties	   = data->string_number + grid_size;
+  }
+  else
+    board->grid = utils_realloc (board->grid, grid_size);
 }
 
 
@@ -222,6 +504,8 @@ clear_board_grid (Board *board)
   pos += BOARD_MAX_WIDTH - 1 - board->width;
   for (x = -1; x <= board->width; x++)
     grid[pos++] = OFF_GRID;
+
+  board->hash_key = 0;
 }
 
 
@@ -299,11 +583,32 @@ board_is_legal_move (const Board *board, BoardRuleSet rule_set, int color, ...)
 }
 
 
+/* Mark all legal moves of `color' in `legal_grid' with 1 and all
+ * other points with 0.  This is much faster than calling
+ * board_is_legal_move() for each point.  Passes are not considered.
+ * For Amazons, the points marked are those of amazons that can move.
+ * Returns the number of points marked.
+ */
+int
+board_get_legal_moves (const Board *board, BoardRuleSet rule_set, int color,
+		       char legal_grid[BOARD_GRID_SIZE])
+{
+  assert (board);
+  assert (rule_set >= FIRST_RULE_SET);
+  assert (IS_STONE (color));
+  assert (legal_grid);
+
+  return game_info[board->game].get_legal_moves (board, rule_set, color,
+						 legal_grid);
+}
+
+
 /* Play the specified move on the given board. */
 inline void
 board_play_move (Board *board, int color, ...)
 {
   va_list move;
+  BoardHashKey hash_key;
 
   assert (board);
   assert (IS_STONE (color));
@@ -316,10 +621,14 @@ board_play_move (Board *board, int color, ...)
 	  board->grid, BOARD_GRID_SIZE * sizeof (char));
 #endif
 
+  hash_key = board->hash_key;
+
   va_start (move, color);
   board->play_move (board, color, move);
   va_end (move);
 
+  push_position_to_history (board, hash_key, color);
+
 #if BOARD_VALIDATION_LEVEL > 0
   board_validate (board);
 #endif
@@ -336,6 +645,7 @@ board_apply_changes
 {
   int color;
   int num_changes;
+  BoardHashKey hash_key;
 
   assert (board);
   assert (!change_lists[SPECIAL_ON_GRID_VALUE] || board->game == GAME_AMAZONS);
@@ -358,6 +668,8 @@ board_apply_changes
 
   ensure_change_stack_space (board, num_changes);
 
+  hash_key = board->hash_key;
+
   for (color = 0; color < NUM_ON_GRID_VALUES; color++) {
     if (change_lists[color]) {
       int k;
@@ -369,12 +681,14 @@ board_apply_changes
 	board->change_stack_pointer->contents = board->grid[pos];
 	board->change_stack_pointer++;
 
+	CHANGE_HASH_KEY (board, pos, board->grid[pos], color);
 	board->grid[pos] = color;
       }
     }
   }
 
   game_info[board->game].apply_changes (board, num_changes);
+  push_position_to_history (board, hash_key, EMPTY);
 
 #if BOARD_VALIDATION_LEVEL > 0
   board_validate (board);
@@ -402,6 +716,7 @@ board_add_dummy_move_entry (Board *board)
 #endif
 
   game_info[board->game].add_dummy_move_entry (board);
+  push_position_to_history (board, board->hash_key, EMPTY);
 }
 
 
@@ -420,8 +735,15 @@ board_undo (Board *board, int num_undos)
 	   - (num_undos * game_info[board->game].stack_entry_size))
 	  >= (char *) board->move_stack);
 
-  for (k = 0; k < num_undos; k++)
+  for (k = 0; k < num_undos; k++) {
+    BoardHashKey hash_key = pop_position_from_history (board);
+
+    /* Game-specific undo functions don't care about hash key, it is
+     * simply restored from the stack.
+     */
     board->undo (board);
+    board->hash_key = hash_key;
+  }
 
 #if BOARD_VALIDATION_LEVEL > 0
   board_validate (board);
@@ -467,6 +789,55 @@ board_get_move_number (const Board *board, int num_moves_backward)
 }
 
 
+/* Get the number of moves that can be undone with board_undo(). */
+int
+board_get_num_undoable_moves (const Board *board)
+{
+  assert (board);
+
+  return (((char *) board->move_stack_pointer - (char *) board->move_stack)
+	  / game_info[board->game].stack_entry_size);
+}
+
+
+/* Compute hash key of the board position from scratch.  Normally,
+ * board_get_hash_key() should be used, since the key is maintained
+ * incrementally.
+ */
+BoardHashKey
+board_compute_hash_key (const Board *board)
+{
+  BoardHashKey hash_key = 0;
+  int x;
+  int y;
+  int pos;
+
+  assert (board);
+
+  for (y = 0, pos = POSITION (0, 0); y < board->height; y++) {
+    for (x = 0; x < board->width; x++, pos++)
+      hash_key ^= ZOBRIST_KEY (board->grid[pos], pos);
+
+    pos += BOARD_MAX_WIDTH + 1 - board->width;
+  }
+
+  return hash_key;
+}
+
+
+/* Determine if a position with given hash key occurred on the board
+ * before, i.e. is the position before any entry in the move stack.
+ * The current position itself is not considered.
+ */
+int
+board_position_occurred_before (const Board *board, BoardHashKey hash_key)
+{
+  assert (board);
+
+  return board_hash_key_set_contains (&board->positional_history, hash_key);
+}
+
+
 inline void
 board_undo_changes (Board *board, int num_changes)
 {
@@ -481,6 +852,45 @@ board_undo_changes (Board *board, int num_changes)
 
 
 
+/* Remember the position before the stack entry that has just been
+ * pushed.  Must be called after every push to the move stack.
+ */
+static void
+push_position_to_history (Board *board, BoardHashKey hash_key, int color)
+{
+  BoardStackEntry *stack_entry = TOP_STACK_ENTRY (board);
+
+  stack_entry->hash_key = hash_key;
+  stack_entry->color	= color;
+
+  board_hash_key_set_add (&board->positional_history, hash_key);
+  if (color != EMPTY) {
+    board_hash_key_set_add (&board->situational_history,
+			    SITUATIONAL_HASH_KEY (hash_key, color));
+  }
+}
+
+
+/* Forget the position before the topmost stack entry, which is about
+ * to be popped by undo.  Return the key of that position.
+ */
+static BoardHashKey
+pop_position_from_history (Board *board)
+{
+  const BoardStackEntry *stack_entry = TOP_STACK_ENTRY (board);
+
+  board_hash_key_set_remove (&board->positional_history,
+			     stack_entry->hash_key);
+  if (stack_entry->color != EMPTY) {
+    board_hash_key_set_remove (&board->situational_history,
+			       SITUATIONAL_HASH_KEY (stack_entry->hash_key,
+						     stack_entry->color));
+  }
+
+  return stack_entry->hash_key;
+}
+
+
 /* Allocate an entry on stack.  The duty of the function is to
  * reallocate the stack if there is no more space in it.  It also
  * saves boards' grid on heap if heavy board debugging is on.
@@ -503,6 +913,47 @@ board_increase_move_stack_size (Board *board)
 }
 
 
+/* Portable variants of GCC builtins (see `board-internals.h'.) */
+int
+board_count_bits (unsigned long long bits)
+{
+  int num_bits;
+
+  for (num_bits = 0; bits; num_bits++)
+    bits &= bits - 1;
+
+  return num_bits;
+}
+
+
+int
+board_first_bit_index (unsigned long long bits)
+{
+  int index;
+
+  assert (bits);
+
+  for (index = 0; !(bits & 1); index++)
+    bits >>= 1;
+
+  return index;
+}
+
+
+int
+board_last_bit_index (unsigned long long bits)
+{
+  int index;
+
+  assert (bits);
+
+  for (index = -1; bits; index++)
+    bits >>= 1;
+
+  return index;
+}
+
+
 static void
 ensure_change_stack_space (Board *board, int num_entries)
 {
@@ -566,11 +1017,188 @@ inline void
 board_validate (const Board *board)
 {
   assert (board);
+  assert (board->hash_key == board_compute_hash_key (board));
 
   game_info[board->game].validate_board (board);
 }
 
 
+
+void
+board_hash_key_set_init (BoardHashKeySet *set)
+{
+  assert (set);
+
+  set->keys	     = NULL;
+  set->num_slots     = 0;
+  set->num_keys	     = 0;
+  set->num_zero_keys = 0;
+}
+
+
+void
+board_hash_key_set_dispose (BoardHashKeySet *set)
+{
+  assert (set);
+
+  if (set->keys)
+    utils_free (set->keys);
+}
+
+
+void
+board_hash_key_set_empty (BoardHashKeySet *set)
+{
+  assert (set);
+
+  if (set->num_keys > 0)
+    memset (set->keys, 0, set->num_slots * sizeof (BoardHashKey));
+
+  set->num_keys	     = 0;
+  set->num_zero_keys = 0;
+}
+
+
+/* Add a key to the set.  The same key can be added several times, it
+ * then has to be removed as many times.
+ */
+void
+board_hash_key_set_add (BoardHashKeySet *set, BoardHashKey hash_key)
+{
+  int slot;
+
+  assert (set);
+
+  if (hash_key == 0) {
+    set->num_zero_keys++;
+    return;
+  }
+
+  /* Keep load factor at 50% at most, it is cheap with 8-byte keys. */
+  if (2 * (set->num_keys + 1) > set->num_slots) {
+    resize_hash_key_set (set, (set->num_slots
+			       ? 2 * set->num_slots : MIN_HASH_KEY_SET_SIZE));
+  }
+
+  for (slot = HASH_KEY_SET_SLOT (set, hash_key); set->keys[slot] != 0;
+       slot = (slot + 1) & (set->num_slots - 1))
+    ;
+
+  set->keys[slot] = hash_key;
+  set->num_keys++;
+}
+
+
+/* Remove one occurrence of a key from the set.  The key must be
+ * present.  Uses backward shift instead of tombstones, so the set
+ * never degrades.
+ */
+void
+board_hash_key_set_remove (BoardHashKeySet *set, BoardHashKey hash_key)
+{
+  int mask;
+  int slot;
+  int next_slot;
+
+  assert (set);
+
+  if (hash_key == 0) {
+    assert (set->num_zero_keys > 0);
+    set->num_zero_keys--;
+    return;
+  }
+
+  assert (set->num_keys > 0);
+
+  mask = set->num_slots - 1;
+  for (slot = HASH_KEY_SET_SLOT (set, hash_key); set->keys[slot] != hash_key;
+       slot = (slot + 1) & mask)
+    assert (set->keys[slot] != 0);
+
+  for (next_slot = (slot + 1) & mask; set->keys[next_slot] != 0;
+       next_slot = (next_slot + 1) & mask) {
+    int home_slot = HASH_KEY_SET_SLOT (set, set->keys[next_slot]);
+
+    /* Move the key into the hole unless its home slot lies cyclically
+     * in (slot, next_slot].
+     */
+    if (slot <= next_slot
+	? (home_slot <= slot || home_slot > next_slot)
+	: (home_slot <= slot && home_slot > next_slot)) {
+      set->keys[slot] = set->keys[next_slot];
+      slot = next_slot;
+    }
+  }
+
+  set->keys[slot] = 0;
+  set->num_keys--;
+}
+
+
+int
+board_hash_key_set_contains (const BoardHashKeySet *set, BoardHashKey hash_key)
+{
+  int slot;
+
+  assert (set);
+
+  if (hash_key == 0)
+    return set->num_zero_keys > 0;
+
+  if (set->num_keys == 0)
+    return 0;
+
+  for (slot = HASH_KEY_SET_SLOT (set, hash_key); set->keys[slot] != 0;
+       slot = (slot + 1) & (set->num_slots - 1)) {
+    if (set->keys[slot] == hash_key)
+      return 1;
+  }
+
+  return 0;
+}
+
+
+static void
+resize_hash_key_set (BoardHashKeySet *set, int num_slots)
+{
+  BoardHashKey *old_keys = set->keys;
+  int old_num_slots = set->num_slots;
+  int k;
+
+  set->keys	 = utils_malloc0 (num_slots * sizeof (BoardHashKey));
+  set->num_slots = num_slots;
+
+  for (k = 0; k < old_num_slots; k++) {
+    if (old_keys[k] != 0) {
+      int slot;
+
+      for (slot = HASH_KEY_SET_SLOT (set, old_keys[k]); set->keys[slot] != 0;
+	   slot = (slot + 1) & (num_slots - 1))
+	;
+
+      set->keys[slot] = old_keys[k];
+    }
+  }
+
+  utils_free (old_keys);
+}
+
+
+/* Store all non-zero keys of `set' in `keys' array, which must have
+ * room for `set->num_keys' elements.
+ */
+static void
+copy_hash_key_set_keys (const BoardHashKeySet *set, BoardHashKey *keys)
+{
+  int k;
+
+  for (k = 0; k < set->num_slots; k++) {
+    if (set->keys[k] != 0)
+      *keys++ = set->keys[k];
+  }
+}
+
+
 
 BoardPositionList *
 board_position_list_new (const int *positions, int num_positions)
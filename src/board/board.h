@@ -84,6 +84,18 @@ struct _BoardPoint {
 #define GO_STRING_RING_SIZE	(BOARD_MAX_POSITIONS			\
 				 + BOARD_MAX_WIDTH + BOARD_MAX_HEIGHT)
 
+/* Only this many ring slots are used for a board of given size, so
+ * that small boards don't cycle through (and thus cache) the arrays
+ * sized for the largest possible board.
+ */
+#define GO_STRING_RING_SIZE_FOR(width, height)				\
+  ((width) * (height) + (width) + (height))
+
+/* Number of random playouts go_guess_dead_stones() runs to estimate
+ * ownership of board points when no territory is given.
+ */
+#define GO_OWNERSHIP_NUM_PLAYOUTS	500
+
 #define PASS_X			NULL_X
 #define PASS_Y			NULL_Y
 #define PASS_MOVE		NULL_POSITION
@@ -92,36 +104,98 @@ struct _BoardPoint {
 
 typedef struct _GoBoardData	GoBoardData;
 
+/* String numbers and liberty counts never exceed GO_STRING_RING_SIZE,
+ * so `short' is enough and halves the memory touched by the engine.
+ * The arrays are allocated together with board grid and have
+ * `string_ring_size' or BOARD_SIZED_GRID_SIZE() elements.
+ */
 struct _GoBoardData{
   int		ko_master;
   int		ko_position;
   int		prisoners[NUM_COLORS];
 
+  int		string_ring_size;
   int		last_string_number;
-  int		string_number[BOARD_GRID_SIZE];
-  int		liberties[GO_STRING_RING_SIZE];
+  short	       *string_number;
+  short	       *liberties;
 
   unsigned int	position_mark;
   unsigned int	string_mark;
-  unsigned int	marked_positions[BOARD_GRID_SIZE];
-  unsigned int	marked_strings[GO_STRING_RING_SIZE];
+  unsigned int *marked_positions;
+  unsigned int *marked_strings;
 };
 
 
 
-/* Amazons-specific definition. */
+/* Reversi-specific definitions. */
+
+/* Boards that fit in 8x8 are additionally represented as a pair of
+ * bitboards, one bit per square (bit number is `x + 8 * y'.)
+ */
+#define REVERSI_BITBOARD_MAX_SIZE	8
+
+#define REVERSI_USES_BITBOARDS(board)					\
+  ((board)->width <= REVERSI_BITBOARD_MAX_SIZE				\
+   && (board)->height <= REVERSI_BITBOARD_MAX_SIZE)
+
+
+/* reversi_solve_endgame() refuses positions with more empty squares,
+ * since its running time grows exponentially.
+ */
+#define REVERSI_ENDGAME_SOLVER_MAX_EMPTIES	20
+
+
+typedef unsigned long long	ReversiBitboard;
+typedef struct _ReversiBoardData	ReversiBoardData;
+
+struct _ReversiBoardData {
+  ReversiBitboard	disks[NUM_COLORS];
+  ReversiBitboard	on_board;
+};
+
+
+
+/* Amazons-specific definitions. */
 
 #define ARROW			SPECIAL_ON_GRID_VALUE
 
+/* Amazons boards are also represented as multi-word bitboards.  Bit
+ * number of point (x, y) is `x + width * y', so only as many words as
+ * needed for the board size are used.
+ */
+#define AMAZONS_BITBOARD_NUM_WORDS	((BOARD_MAX_POSITIONS + 63) / 64)
+
 
 typedef struct _BoardAmazonsMoveData	BoardAmazonsMoveData;
+typedef struct _BoardAmazonsMove	BoardAmazonsMove;
 typedef union _BoardAbstractMoveData	BoardAbstractMoveData;
 
+typedef struct _AmazonsBitboard		AmazonsBitboard;
+typedef struct _AmazonsRayTable		AmazonsRayTable;
+typedef struct _AmazonsBoardData	AmazonsBoardData;
+
 struct _BoardAmazonsMoveData {
   BoardPoint		 from;
   BoardPoint		 shoot_arrow_to;
 };
 
+struct _BoardAmazonsMove {
+  BoardPoint		 to;
+  BoardAmazonsMoveData	 move_data;
+};
+
+struct _AmazonsBitboard {
+  unsigned long long	 words[AMAZONS_BITBOARD_NUM_WORDS];
+};
+
+struct _AmazonsBoardData {
+  /* Shared precomputed ray masks for the board dimensions. */
+  const AmazonsRayTable	*ray_table;
+
+  AmazonsBitboard	 amazons[NUM_COLORS];
+  AmazonsBitboard	 occupied;
+};
+
 union _BoardAbstractMoveData {
   BoardAmazonsMoveData	 amazons;
 };
@@ -135,6 +209,8 @@ typedef enum {
 
   GO_RULE_SET_SGF	   = RULE_SET_SGF,
   GO_RULE_SET_DEFAULT	   = RULE_SET_DEFAULT,
+  GO_RULE_SET_POSITIONAL_SUPERKO,
+  GO_RULE_SET_SITUATIONAL_SUPERKO,
   NUM_GO_RULE_SETS,
 
   REVERSI_RULE_SET_SGF	   = RULE_SET_SGF,
@@ -147,6 +223,29 @@ typedef enum {
 } BoardRuleSet;
 
 
+/* Zobrist hash key of a board position.  Keys of equal positions are
+ * always equal, keys of different positions differ with overwhelming
+ * probability.  A key only depends on grid contents, not on move
+ * history or color to play.
+ */
+typedef unsigned long long		BoardHashKey;
+
+typedef struct _BoardHashKeySet		BoardHashKeySet;
+
+/* A compact multiset of hash keys (open addressing with linear
+ * probing).  Used to remember all positions that occurred in the
+ * board's move stack.
+ */
+struct _BoardHashKeySet {
+  BoardHashKey	   *keys;
+  int		    num_slots;
+  int		    num_keys;
+
+  /* Zero marks empty slots, so zero keys are only counted. */
+  int		    num_zero_keys;
+};
+
+
 typedef struct _BoardChangeStackEntry	BoardChangeStackEntry;
 typedef struct _Board			Board;
 
@@ -164,7 +263,11 @@ struct _Board {
 
   unsigned int		     move_number;
 
-  char			     grid[BOARD_FULL_GRID_SIZE];
+  /* Only positions up to POSITION (width, height), i.e. the board
+   * with a one-cell border around it, are allocated.
+   */
+  char			    *grid;
+  BoardHashKey		     hash_key;
 
   void			    *move_stack;
   void			    *move_stack_pointer;
@@ -174,16 +277,57 @@ struct _Board {
   BoardChangeStackEntry	    *change_stack_pointer;
   BoardChangeStackEntry	    *change_stack_end;
 
+  /* Keys of all positions in the move stack.  The second set only
+   * has positions before moves (not setup changes) and keys there
+   * are combined with the key of the color that played the move.
+   */
+  BoardHashKeySet	     positional_history;
+  BoardHashKeySet	     situational_history;
+
   BoardIsLegalMoveFunction   is_legal_move;
   BoardPlayMoveFunction	     play_move;
   BoardUndoFunction	     undo;
 
   union {
     GoBoardData		     go;
+    ReversiBoardData	     reversi;
+    AmazonsBoardData	     amazons;
   } data;
 };
 
 
+/* Compact copy of a board position, without stacks.  Only the grid
+ * and data that cannot be recomputed from it are stored.
+ */
+typedef struct _BoardSnapshot		BoardSnapshot;
+
+struct _BoardSnapshot {
+  Game		game;
+  int		width;
+  int		height;
+
+  unsigned int	move_number;
+  BoardHashKey	hash_key;
+
+  /* Go only. */
+  int		ko_master;
+  int		ko_position;
+  int		prisoners[NUM_COLORS];
+
+  /* Go only: contents of `positional_history' and then
+   * `situational_history' sets, so that superko checks still work
+   * after restoring.  Allocated separately.
+   */
+  BoardHashKey *history_keys;
+  int		num_positional_keys;
+  int		num_situational_keys;
+  int		num_zero_keys[2];
+
+  /* `width * height' points, row by row. */
+  char		grid[BOARD_MAX_POSITIONS];
+};
+
+
 typedef struct _BoardPositionList	BoardPositionList;
 
 struct _BoardPositionList {
@@ -197,6 +341,24 @@ void		board_delete (Board *board);
 
 Board *		board_duplicate_without_stacks (const Board *board);
 
+BoardSnapshot *	board_snapshot_new (const Board *board);
+void		board_restore_snapshot (Board *board,
+					const BoardSnapshot *snapshot);
+
+#define board_snapshot_get_size(snapshot)				\
+  (sizeof (BoardSnapshot)						\
+   - (BOARD_MAX_POSITIONS - (snapshot)->width * (snapshot)->height)	\
+   + (((snapshot)->num_positional_keys					\
+       + (snapshot)->num_situational_keys)				\
+      * sizeof (BoardHashKey)))
+
+#define board_snapshot_delete(snapshot)					\
+  do {									\
+    assert (snapshot);							\
+    utils_free ((snapshot)->history_keys);				\
+    utils_free (snapshot);						\
+  } while (0)
+
 void		board_set_parameters (Board *board, Game game,
 				      int width, int height);
 #define board_clear(board)						\
@@ -210,6 +372,9 @@ int		board_is_game_over (const Board *board, BoardRuleSet rule_set,
 
 inline int	board_is_legal_move (const Board *board, BoardRuleSet rule_set,
 				     int color, ...);
+int		board_get_legal_moves (const Board *board,
+				       BoardRuleSet rule_set, int color,
+				       char legal_grid[BOARD_GRID_SIZE]);
 
 inline void	board_play_move (Board *board, int color, ...);
 void		board_apply_changes
@@ -222,6 +387,14 @@ inline int	board_undo (Board *board, int num_moves);
 
 int		board_get_move_number (const Board *board,
 				       int num_moves_backward);
+int		board_get_num_undoable_moves (const Board *board);
+
+#define board_get_hash_key(board)	((board)->hash_key)
+
+BoardHashKey	board_compute_hash_key (const Board *board);
+
+int		board_position_occurred_before (const Board *board,
+						BoardHashKey hash_key);
 
 
 inline void	board_dump (const Board *board);
@@ -381,12 +554,36 @@ void		     go_guess_dead_stones
 			const BoardPositionList *black_territory,
 			const BoardPositionList *white_territory);
 
+unsigned long	     go_estimate_ownership
+		       (Board *board, int num_playouts,
+			unsigned int random_seed,
+			int ownership[BOARD_GRID_SIZE]);
+void		     go_mark_dead_stones_by_ownership
+		       (Board *board, char *dead_stones,
+			const int ownership[BOARD_GRID_SIZE],
+			int num_playouts);
+
 
 
-/* Reversi-specific function. */
+/* Reversi-specific functions. */
 void		     reversi_count_disks (const Board *board,
 					  int *num_black_disks,
 					  int *num_white_disks);
+int		     reversi_solve_endgame (const Board *board, int color,
+					    int *best_x, int *best_y,
+					    int *disk_difference);
+
+
+
+/* Amazons-specific functions. */
+int		     amazons_count_moves (const Board *board, int color);
+BoardAmazonsMove *   amazons_generate_moves (const Board *board, int color,
+					     int *num_moves);
+int		     amazons_mark_territory_on_grid (const Board *board,
+						     char *grid,
+						     int use_king_distance,
+						     char black_territory_mark,
+						     char white_territory_mark);
 
 
 #endif /* QUARRY_BOARD_H */
@@ -59,6 +59,8 @@ struct _GameInfo {
   void (* reset_game_data)	(Board *board, int forced_reset);
 
   BoardIsLegalMoveFunction	 is_legal_move;
+  int (* get_legal_moves)	(const Board *board, BoardRuleSet rule_set,
+				 int color, char legal_grid[BOARD_GRID_SIZE]);
   BoardPlayMoveFunction		 play_move;
   BoardUndoFunction		 undo;
 
@@ -70,9 +70,19 @@ enum {
 
 
 static int	is_suicide (const Board *board, int color, int pos);
+static int	is_superko_violation (const Board *board,
+				      BoardRuleSet rule_set,
+				      int color, int pos);
+static BoardHashKey
+		get_hash_key_after_move (const Board *board,
+					 int color, int pos,
+					 const BoardHashKey *capture_keys);
+static int	is_repeated_position (const Board *board,
+				      BoardRuleSet rule_set,
+				      int color_to_play,
+				      BoardHashKey hash_key);
 
 
-static void	rebuild_strings (Board *board);
 
 static void	do_play_move (Board *board, int color, int pos);
 static void	do_play_over_own_stone (Board *board, int pos);
@@ -86,6 +96,18 @@ static int	change_string_number (Board *board, int pos,
 static void	reconstruct_string (Board *board, int color, int pos,
 				    int single_liberty);
 
+static void	mark_dead_stones_in_territory
+		  (Board *board, char *dead_stones,
+		   const BoardPositionList *black_territory,
+		   const BoardPositionList *white_territory);
+static inline unsigned int
+		get_playout_random_state (unsigned int seed,
+					  unsigned int index);
+static int	play_random_game (Board *board, int color,
+				  const int *positions, int num_positions,
+				  unsigned int *random_state,
+				  int ownership[BOARD_GRID_SIZE]);
+
 
 static int	allocate_string (Board *board);
 
@@ -97,11 +119,13 @@ go_reset_game_data (Board *board, int forced_reset)
   board->data.go.prisoners[BLACK_INDEX] = 0;
   board->data.go.prisoners[WHITE_INDEX] = 0;
 
+  board->data.go.string_ring_size
+    = GO_STRING_RING_SIZE_FOR (board->width, board->height);
   board->data.go.last_string_number = -1;
   if (forced_reset) {
     int k;
 
-    for (k = 0; k < GO_STRING_RING_SIZE; k++)
+    for (k = 0; k < board->data.go.string_ring_size; k++)
       board->data.go.liberties[k] = -1;
   }
 
@@ -122,7 +146,8 @@ go_reset_game_data (Board *board, int forced_reset)
   if (forced_reset || board->data.go.string_mark != 0) {
     board->data.go.string_mark = 0;
     memset (board->data.go.marked_strings, 0,
-	    sizeof board->data.go.marked_strings);
+	    (board->data.go.string_ring_size
+	     * sizeof board->data.go.marked_strings[0]));
   }
 }
 
@@ -206,16 +231,193 @@ go_is_legal_move (const Board *board, BoardRuleSet rule_set,
     /* Determine if a move is legal in terms of default rule set.
      * It is illegal to violate the ko rule or play suicides.
      */
-    return (board->grid[pos] == EMPTY
-	    && (color != OTHER_COLOR (board->data.go.ko_master)
-		|| pos != board->data.go.ko_position)
-	    && !is_suicide (board, color, pos));
+    if (board->grid[pos] != EMPTY
+	|| (color == OTHER_COLOR (board->data.go.ko_master)
+	    && pos == board->data.go.ko_position)
+	|| is_suicide (board, color, pos))
+      return 0;
+
+    /* Superko rule sets additionally forbid repeating any earlier
+     * position.
+     */
+    return (rule_set == GO_RULE_SET_DEFAULT
+	    || !is_superko_violation (board, rule_set, color, pos));
   }
 
   return 1;
 }
 
 
+/* Mark all legal moves of `color' in `legal_grid'.  Suicide checks
+ * reuse string liberty counts and, for superko rule sets, hash keys of
+ * strings in atari are computed once for all points.
+ */
+int
+go_get_legal_moves (const Board *board, BoardRuleSet rule_set, int color,
+		    char legal_grid[BOARD_GRID_SIZE])
+{
+  const char *grid = board->grid;
+  int other = OTHER_COLOR (color);
+  int ko_position = (color == OTHER_COLOR (board->data.go.ko_master)
+		     ? board->data.go.ko_position : NULL_POSITION);
+  int check_superko = (rule_set != GO_RULE_SET_DEFAULT);
+  BoardHashKey capture_keys[GO_STRING_RING_SIZE];
+  int num_legal_moves = 0;
+  int x;
+  int y;
+  int pos;
+
+  assert (rule_set < NUM_GO_RULE_SETS);
+
+  if (rule_set == GO_RULE_SET_SGF) {
+    grid_fill (legal_grid, board->width, board->height, 1);
+    return board->width * board->height;
+  }
+
+  if (check_superko) {
+    /* Hash key contribution of each opponent string in atari, i.e. of
+     * each string that can be captured with one move.
+     */
+    for (y = 0, pos = POSITION (0, 0); y < board->height; y++) {
+      for (x = 0; x < board->width; x++, pos++) {
+	if (grid[pos] == other && LIBERTIES (board, pos) == 1)
+	  capture_keys[STRING_NUMBER (board, pos)] = 0;
+      }
+
+      pos += BOARD_MAX_WIDTH + 1 - board->width;
+    }
+
+    for (y = 0, pos = POSITION (0, 0); y < board->height; y++) {
+      for (x = 0; x < board->width; x++, pos++) {
+	if (grid[pos] == other && LIBERTIES (board, pos) == 1) {
+	  capture_keys[STRING_NUMBER (board, pos)]
+	    ^= ZOBRIST_KEY (other, pos);
+	}
+      }
+
+      pos += BOARD_MAX_WIDTH + 1 - board->width;
+    }
+  }
+
+  for (y = 0, pos = POSITION (0, 0); y < board->height; y++) {
+    for (x = 0; x < board->width; x++, pos++) {
+      int is_legal = (grid[pos] == EMPTY && pos != ko_position
+		      && !is_suicide (board, color, pos));
+
+      if (is_legal && check_superko) {
+	is_legal = !is_repeated_position (board, rule_set, other,
+					  get_hash_key_after_move
+					    (board, color, pos, capture_keys));
+      }
+
+      legal_grid[pos] = is_legal;
+      num_legal_moves += is_legal;
+    }
+
+    pos += BOARD_MAX_WIDTH + 1 - board->width;
+  }
+
+  return num_legal_moves;
+}
+
+
+/* Determine if a (non-suicide) move at empty `pos' would recreate a
+ * position that occurred before.  For situational superko, only
+ * positions with the same color to play count.
+ */
+static int
+is_superko_violation (const Board *board, BoardRuleSet rule_set,
+		      int color, int pos)
+{
+  return is_repeated_position (board, rule_set, OTHER_COLOR (color),
+			       get_hash_key_after_move (board, color, pos,
+							NULL));
+}
+
+
+/* Compute hash key of the position after a (non-suicide) move of
+ * `color' at empty `pos', including captures.  If `capture_keys' is
+ * not NULL, it must hold hash key contribution of each opponent string
+ * in atari, indexed by string number.  Otherwise, stones of captured
+ * strings are found by scanning the board.
+ */
+static BoardHashKey
+get_hash_key_after_move (const Board *board, int color, int pos,
+			 const BoardHashKey *capture_keys)
+{
+  const char *grid = board->grid;
+  int other = OTHER_COLOR (color);
+  BoardHashKey hash_key = board->hash_key ^ ZOBRIST_KEY (color, pos);
+  int captured_strings[4];
+  int num_captured_strings = 0;
+  int k;
+
+  for (k = 0; k < 4; k++) {
+    int neighbor = pos + delta[k];
+
+    if (grid[neighbor] == other && LIBERTIES (board, neighbor) == 1) {
+      int string_number = STRING_NUMBER (board, neighbor);
+      int i;
+
+      for (i = 0; i < num_captured_strings; i++) {
+	if (captured_strings[i] == string_number)
+	  break;
+      }
+
+      if (i == num_captured_strings) {
+	captured_strings[num_captured_strings++] = string_number;
+	if (capture_keys)
+	  hash_key ^= capture_keys[string_number];
+      }
+    }
+  }
+
+  if (num_captured_strings > 0 && !capture_keys) {
+    /* Captures are rare enough that a full scan is cheaper than
+     * having a stone list for each string.
+     */
+    int x;
+    int y;
+    int pos2;
+
+    for (y = 0, pos2 = POSITION (0, 0); y < board->height; y++) {
+      for (x = 0; x < board->width; x++, pos2++) {
+	if (grid[pos2] == other) {
+	  for (k = 0; k < num_captured_strings; k++) {
+	    if (STRING_NUMBER (board, pos2) == captured_strings[k]) {
+	      hash_key ^= ZOBRIST_KEY (other, pos2);
+	      break;
+	    }
+	  }
+	}
+      }
+
+      pos2 += BOARD_MAX_WIDTH + 1 - board->width;
+    }
+  }
+
+  return hash_key;
+}
+
+
+/* Determine if position with `hash_key' and `color_to_play' occurred
+ * before, as far as given superko rule set is concerned.
+ */
+static int
+is_repeated_position (const Board *board, BoardRuleSet rule_set,
+		      int color_to_play, BoardHashKey hash_key)
+{
+  if (rule_set == GO_RULE_SET_POSITIONAL_SUPERKO)
+    return board_hash_key_set_contains (&board->positional_history, hash_key);
+
+  assert (rule_set == GO_RULE_SET_SITUATIONAL_SUPERKO);
+
+  return board_hash_key_set_contains
+	   (&board->situational_history,
+	    SITUATIONAL_HASH_KEY (hash_key, color_to_play));
+}
+
+
 void
 go_play_move (Board *board, int color, va_list move)
 {
@@ -261,7 +463,7 @@ go_apply_changes (Board *board, int num_changes)
 
   board->data.go.ko_master = EMPTY;
 
-  rebuild_strings (board);
+  go_rebuild_strings (board);
 }
 
 
@@ -284,8 +486,8 @@ go_add_dummy_move_entry (Board *board)
 /* Rebuild all board strings from scratch.  Used after complex
  * position changes that are not handled incrementally.
  */
-static void
-rebuild_strings (Board *board)
+void
+go_rebuild_strings (Board *board)
 {
   int pos;
   int string_number = 0;
@@ -310,7 +512,7 @@ rebuild_strings (Board *board)
   }
 
   board->data.go.last_string_number = string_number - 1;
-  while (string_number < GO_STRING_RING_SIZE)
+  while (string_number < board->data.go.string_ring_size)
     board->data.go.liberties[string_number++] = -1;
 
 #if BOARD_VALIDATION_LEVEL > 0
@@ -469,6 +671,7 @@ do_play_over_enemy_stone (Board *board, int pos)
   int k;
   int string_number = STRING_NUMBER (board, pos);
 
+  CHANGE_HASH_KEY (board, pos, other, EMPTY);
   grid[pos] = EMPTY;
   board->data.go.string_mark++;
 
@@ -557,6 +760,7 @@ join_strings (Board *board, int color, int pos, int new_liberties,
     }
   }
 
+  CHANGE_HASH_KEY (board, pos, grid[pos], color);
   grid[pos] = color;
   STRING_NUMBER (board, pos) = string_number;
   board->data.go.liberties[string_number] = new_liberties;
@@ -579,6 +783,7 @@ remove_string (Board *board, int pos)
   int queue_start = 0;
   int queue_end = 1;
 
+  board->hash_key ^= ZOBRIST_KEY (color, pos);
   grid[pos] = EMPTY;
   queue[0] = pos;
 
@@ -597,6 +802,7 @@ remove_string (Board *board, int pos)
 	}
       }
       else if (grid[neighbor] == color) {
+	board->hash_key ^= ZOBRIST_KEY (color, neighbor);
 	grid[neighbor] = EMPTY;
 	queue[queue_end++] = neighbor;
       }
@@ -770,7 +976,7 @@ go_undo (Board *board)
   }
   else if (stack_entry->type == POSITION_CHANGE) {
     board_undo_changes (board, stack_entry->num.changes);
-    rebuild_strings (board);
+    go_rebuild_strings (board);
   }
 
   board->data.go.ko_master   = stack_entry->ko_master;
@@ -832,7 +1038,7 @@ allocate_string (Board *board)
   int string_number = board->data.go.last_string_number;
 
   do {
-    if (string_number < GO_STRING_RING_SIZE - 1)
+    if (string_number < board->data.go.string_ring_size - 1)
       string_number++;
     else
       string_number = 0;
@@ -930,7 +1136,7 @@ go_validate_board (const Board *board)
     }
   }
 
-  for (k = 0; k < GO_STRING_RING_SIZE; k++) {
+  for (k = 0; k < board->data.go.string_ring_size; k++) {
     if (present_strings[k])
       assert (board->data.go.liberties[k] == liberties[k]);
     else
@@ -1571,19 +1777,172 @@ go_mark_territory_on_grid (Board *board, char *grid, const char *dead_stones,
 }
 
 
+/* Guess which stones on the board are dead.  If territory lists are
+ * given (e.g. from `TB' and `TW' properties of an SGF node), opponent
+ * stones in them are dead.  Otherwise ownership of board points is
+ * estimated with random playouts.  Grid `dead_stones' must be cleared
+ * by the caller.
+ */
 void
 go_guess_dead_stones (Board *board, char *dead_stones,
 		      const BoardPositionList *black_territory,
 		      const BoardPositionList *white_territory)
+{
+  assert (board);
+  assert (board->game == GAME_GO);
+  assert (dead_stones);
+
+  if (black_territory || white_territory) {
+    mark_dead_stones_in_territory (board, dead_stones,
+				   black_territory, white_territory);
+  }
+  else {
+    int ownership[BOARD_GRID_SIZE];
+
+    board_fill_int_grid (board, ownership, 0);
+
+    /* Seed with the position key, so that results are reproducible. */
+    go_estimate_ownership (board, GO_OWNERSHIP_NUM_PLAYOUTS,
+			   (unsigned int) board->hash_key, ownership);
+    go_mark_dead_stones_by_ownership (board, dead_stones, ownership,
+				      GO_OWNERSHIP_NUM_PLAYOUTS);
+  }
+}
+
+
+/* Estimate ownership of board points by playing `num_playouts' light
+ * random games from the current position.  In each playout, every
+ * point that ends up black (a stone or an empty point surrounded by
+ * black stones only) adds one to its `ownership' element and every
+ * white point subtracts one.  The grid is not cleared, so results of
+ * several calls (e.g. in different threads, each working on its own
+ * copy of the board) can be summed up.
+ *
+ * Playouts start with black and white to play in turn.  Each one
+ * seeds its random generator from `random_seed' and playout index, so
+ * callers splitting work only need to pass different seeds.  The
+ * board is restored before returning.
+ *
+ * Return the total number of moves played in all playouts.
+ */
+unsigned long
+go_estimate_ownership (Board *board, int num_playouts,
+		       unsigned int random_seed,
+		       int ownership[BOARD_GRID_SIZE])
+{
+  int positions[BOARD_MAX_POSITIONS];
+  int num_positions = 0;
+  unsigned long num_moves = 0;
+  int x;
+  int y;
+  int pos;
+  int k;
+
+  assert (board);
+  assert (board->game == GAME_GO);
+  assert (num_playouts >= 0);
+  assert (ownership);
+
+  for (y = 0, pos = POSITION (0, 0); y < board->height; y++) {
+    for (x = 0; x < board->width; x++, pos++)
+      positions[num_positions++] = pos;
+
+    pos += BOARD_MAX_WIDTH + 1 - board->width;
+  }
+
+  for (k = 0; k < num_playouts; k++) {
+    unsigned int random_state = get_playout_random_state (random_seed, k);
+
+    num_moves += play_random_game (board, (k & 1 ? WHITE : BLACK),
+				   positions, num_positions, &random_state,
+				   ownership);
+  }
+
+  return num_moves;
+}
+
+
+/* Mark strings which are owned by the opponent in most playouts as
+ * dead.  `ownership' should be computed by go_estimate_ownership()
+ * with `num_playouts' playouts in total.
+ */
+void
+go_mark_dead_stones_by_ownership (Board *board, char *dead_stones,
+				  const int ownership[BOARD_GRID_SIZE],
+				  int num_playouts)
 {
   const char *grid = board->grid;
   int queue[BOARD_MAX_POSITIONS];
-  int queue_start = 0;
-  int queue_end   = 0;
-  int k;
+  int x;
+  int y;
+  int pos;
 
   assert (board);
+  assert (board->game == GAME_GO);
   assert (dead_stones);
+  assert (ownership);
+
+  board->data.go.position_mark++;
+
+  for (y = 0, pos = POSITION (0, 0); y < board->height; y++) {
+    for (x = 0; x < board->width; x++, pos++) {
+      if (IS_STONE (grid[pos]) && UNMARKED_POSITION (board, pos)) {
+	int color = grid[pos];
+	int queue_start = 0;
+	int queue_end = 1;
+	int string_ownership = 0;
+
+	queue[0] = pos;
+	MARK_POSITION (board, pos);
+
+	do {
+	  int k;
+	  int stone = queue[queue_start++];
+
+	  string_ownership += ownership[stone];
+
+	  for (k = 0; k < 4; k++) {
+	    int neighbor = stone + delta[k];
+
+	    if (grid[neighbor] == color
+		&& UNMARKED_POSITION (board, neighbor)) {
+	      queue[queue_end++] = neighbor;
+	      MARK_POSITION (board, neighbor);
+	    }
+	  }
+	} while (queue_start < queue_end);
+
+	if (color == WHITE)
+	  string_ownership = - string_ownership;
+
+	/* The string is dead if the opponent owns its stones at least
+	 * two thirds of the time on average.
+	 */
+	if (3 * string_ownership <= - num_playouts * queue_end) {
+	  for (queue_start = 0; queue_start < queue_end; queue_start++)
+	    dead_stones[queue[queue_start]] = 1;
+	}
+      }
+    }
+
+    pos += BOARD_MAX_WIDTH + 1 - board->width;
+  }
+}
+
+
+/* Mark all stones in opponent's territory as dead, together with
+ * strings they belong to.
+ */
+static void
+mark_dead_stones_in_territory (Board *board, char *dead_stones,
+			       const BoardPositionList *black_territory,
+			       const BoardPositionList *white_territory)
+{
+  const char *grid = board->grid;
+  int queue[BOARD_MAX_POSITIONS];
+  int queue_start = 0;
+  int queue_end   = 0;
+  int k;
 
   board->data.go.position_mark++;
 
@@ -1627,6 +1986,142 @@ go_guess_dead_stones (Board *board, char *dead_stones,
 }
 
 
+
+
+/* Linear congruential generator.  It is poor, but good enough for
+ * playouts and keeps its whole state in caller's variable, so it can
+ * be used from several threads at once.
+ */
+static inline unsigned int
+next_random (unsigned int *random_state)
+{
+  *random_state = *random_state * 1103515245 + 12345;
+  return *random_state >> 16;
+}
+
+
+/* Derive generator state for playout number `index' from `seed'.  The
+ * bits are mixed thoroughly (as in MurmurHash3 finalizer), so that
+ * close seeds or indices don't give correlated playouts.
+ */
+static inline unsigned int
+get_playout_random_state (unsigned int seed, unsigned int index)
+{
+  unsigned int state = seed ^ (index * 0x9e3779b9u);
+
+  state ^= state >> 16;
+  state *= 0x85ebca6bu;
+  state ^= state >> 13;
+  state *= 0xc2b2ae35u;
+  state ^= state >> 16;
+
+  return state;
+}
+
+
+/* Determine if playing at `pos' would fill an eye of `color'.  All
+ * orthogonal neighbors must be stones of that color and the opponent
+ * may have at most one diagonal point (none on the edge.)
+ */
+static int
+is_own_eye (const char *grid, int color, int pos)
+{
+  int num_bad_diagonals = 0;
+  int max_bad_diagonals = 1;
+  int k;
+
+  for (k = 0; k < 4; k++) {
+    if (grid[pos + delta[k]] != color && ON_GRID (grid, pos + delta[k]))
+      return 0;
+  }
+
+  for (k = 4; k < 8; k++) {
+    if (!ON_GRID (grid, pos + delta[k]))
+      max_bad_diagonals = 0;
+    else if (grid[pos + delta[k]] == OTHER_COLOR (color))
+      num_bad_diagonals++;
+  }
+
+  return num_bad_diagonals <= max_bad_diagonals;
+}
+
+
+/* Play one light playout.  Each move is the first legal move that
+ * doesn't fill own eye, looking from a random point on.  The playout
+ * ends after two passes in a row (or when it gets too long), then
+ * final ownership is added to `ownership' and all moves are undone.
+ * Return the number of moves played.
+ */
+static int
+play_random_game (Board *board, int color,
+		  const int *positions, int num_positions,
+		  unsigned int *random_state, int ownership[BOARD_GRID_SIZE])
+{
+  const char *grid = board->grid;
+  int max_moves = 3 * num_positions;
+  int num_moves = 0;
+  int num_passes_in_row = 0;
+  int k;
+
+  while (num_passes_in_row < 2 && num_moves < max_moves) {
+    int index = next_random (random_state) % num_positions;
+    int ko_position = (color == OTHER_COLOR (board->data.go.ko_master)
+		       ? board->data.go.ko_position : NULL_POSITION);
+
+    for (k = 0; k < num_positions; k++) {
+      int pos = positions[index];
+
+      if (grid[pos] == EMPTY
+	  && pos != ko_position
+	  && !is_own_eye (grid, color, pos)
+	  && !is_suicide (board, color, pos)) {
+	board_play_move (board, color, POSITION_X (pos), POSITION_Y (pos));
+	break;
+      }
+
+      if (++index == num_positions)
+	index = 0;
+    }
+
+    if (k < num_positions) {
+      num_moves++;
+      num_passes_in_row = 0;
+    }
+    else
+      num_passes_in_row++;
+
+    color = OTHER_COLOR (color);
+  }
+
+  for (k = 0; k < num_positions; k++) {
+    int pos = positions[k];
+
+    if (grid[pos] == EMPTY) {
+      int i;
+      char neighbors = 0;
+
+      for (i = 0; i < 4; i++) {
+	if (IS_STONE (grid[pos + delta[i]]))
+	  neighbors |= grid[pos + delta[i]];
+      }
+
+      if (neighbors == BLACK)
+	ownership[pos]++;
+      else if (neighbors == WHITE)
+	ownership[pos]--;
+    }
+    else if (grid[pos] == BLACK)
+      ownership[pos]++;
+    else
+      ownership[pos]--;
+  }
+
+  board_undo (board, num_moves);
+
+  return num_moves;
+}
+
+
 /*
  * Local Variables:
  * tab-width: 8
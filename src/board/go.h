@@ -67,6 +67,9 @@ int		go_is_game_over (const Board *board, BoardRuleSet rule_set,
 
 int		go_is_legal_move (const Board *board, BoardRuleSet rule_set,
 				  int color, va_list move);
+int		go_get_legal_moves (const Board *board, BoardRuleSet rule_set,
+				    int color,
+				    char legal_grid[BOARD_GRID_SIZE]);
 
 void		go_play_move (Board *board, int color, va_list move);
 void		go_undo (Board *board);
@@ -81,6 +84,8 @@ int		go_parse_move (int board_width, int board_height,
 			       int *x, int *y,
 			       BoardAbstractMoveData *move_data);
 
+void		go_rebuild_strings (Board *board);
+
 void		go_validate_board (const Board *board);
 void		go_dump_board (const Board *board);
 
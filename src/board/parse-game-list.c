@@ -84,6 +84,7 @@ game_list_parse_game2 (StringBuffer *c_file_arrays,
   const char *get_default_setup_function;
   const char *reset_game_data_function;
   const char *is_legal_move_function;
+  const char *get_legal_moves_function;
   const char *play_move_function;
   const char *undo_function;
   const char *apply_changes_function;
@@ -179,6 +180,8 @@ game_list_parse_game2 (StringBuffer *c_file_arrays,
   PARSE_IDENTIFIER (reset_game_data_function, line,
 		    "reset_game_data function");
   PARSE_IDENTIFIER (is_legal_move_function, line, "is_legal_move function");
+  PARSE_IDENTIFIER (get_legal_moves_function, line,
+		    "get_legal_moves function");
   PARSE_IDENTIFIER (play_move_function, line, "play_move function");
   PARSE_IDENTIFIER (undo_function, line, "undo function");
   PARSE_IDENTIFIER (apply_changes_function, line, "apply_changes function");
@@ -196,8 +199,9 @@ game_list_parse_game2 (StringBuffer *c_file_arrays,
   string_buffer_cprintf (c_file_arrays,
 			 (CAPITALIZATION_HINT
 			  "  { N_(%s), %s, %s, %s, %s,\n    %s,\n"
-			  "    \"%s\", %d,\n    %s, %s,\n    %s, %s, %s,\n"
+			  "    \"%s\", %d,\n    %s, %s,\n"
 			  "    %s, %s,\n    %s, %s,\n    %s, %s,\n"
+			  "    %s, %s,\n    %s, %s,\n"
 			  "    sizeof (%s), %s }"),
 			 game_full_name, default_board_size,
 			 standard_board_sizes.string, color_to_play_first,
@@ -205,7 +209,8 @@ game_list_parse_game2 (StringBuffer *c_file_arrays,
 			 horizontal_coordinates,
 			 reversed_vertical_coordinates_flag,
 			 get_default_setup_function, reset_game_data_function,
-			 is_legal_move_function, play_move_function,
+			 is_legal_move_function, get_legal_moves_function,
+			 play_move_function,
 			 undo_function,
 			 apply_changes_function, add_dummy_move_entry_function,
 			 format_move_function, parse_move_function,
@@ -31,9 +31,111 @@
 #endif
 
 
+/* Bitboard helpers.  Bit `x + 8 * y' corresponds to point (x, y). */
+
+#define BIT_INDEX_POSITION(index)					\
+  POSITION ((index) % REVERSI_BITBOARD_MAX_SIZE,			\
+	    (index) / REVERSI_BITBOARD_MAX_SIZE)
+
+#define POSITION_BIT(pos)						\
+  ((ReversiBitboard) 1							\
+   << (POSITION_X (pos) + REVERSI_BITBOARD_MAX_SIZE * POSITION_Y (pos)))
+
+#define NOT_FIRST_COLUMN	0xfefefefefefefefeULL
+#define NOT_LAST_COLUMN		0x7f7f7f7f7f7f7f7fULL
+
+#define SHIFT_BITBOARD(bits, direction)					\
+  ((((bits) << left_shifts[direction]) >> right_shifts[direction])	\
+   & shift_masks[direction])
+
+
 static inline int  is_legal_move (const char grid[BOARD_FULL_GRID_SIZE],
 				  BoardRuleSet rule_set, int color, int pos);
 
+static void	   rebuild_bitboards (Board *board);
+
+static ReversiBitboard	get_legal_moves_bitboard (ReversiBitboard player,
+						  ReversiBitboard opponent,
+						  ReversiBitboard empty);
+static ReversiBitboard	get_flips_bitboard (ReversiBitboard player,
+					    ReversiBitboard opponent,
+					    ReversiBitboard move);
+static inline ReversiBitboard
+			get_flips_in_direction (ReversiBitboard player,
+						ReversiBitboard opponent,
+						ReversiBitboard move,
+						int direction);
+
+
+/* Endgame solver settings.  Positions with few empty squares are
+ * solved without transposition table and move sorting, because near
+ * the end of the game they cost more than they save.
+ */
+#define SOLVER_TABLE_BITS		18
+#define SOLVER_TABLE_SIZE		(1 << SOLVER_TABLE_BITS)
+#define SOLVER_MAX_SHALLOW_EMPTIES	6
+
+#define SOLVER_MAX_SCORE		(REVERSI_BITBOARD_MAX_SIZE	\
+					 * REVERSI_BITBOARD_MAX_SIZE)
+
+
+typedef struct _ReversiSolverEntry	ReversiSolverEntry;
+typedef struct _ReversiSolver		ReversiSolver;
+
+struct _ReversiSolverEntry {
+  ReversiBitboard	 player;
+  ReversiBitboard	 opponent;
+
+  /* Score bounds (from `player's point of view) and best move. */
+  signed char		 lower_bound;
+  signed char		 upper_bound;
+  signed char		 best_move;
+};
+
+struct _ReversiSolver {
+  ReversiBitboard	 on_board;
+  ReversiBitboard	 corners;
+  ReversiSolverEntry	*table;
+};
+
+
+static int		solve_position (ReversiSolver *solver,
+					ReversiBitboard player,
+					ReversiBitboard opponent,
+					int alpha, int beta, int *best_move);
+static inline int	solve_child (ReversiSolver *solver,
+				     ReversiBitboard player,
+				     ReversiBitboard opponent,
+				     int num_empties, int alpha, int beta);
+static int		solve_shallow_position (ReversiBitboard player,
+						ReversiBitboard opponent,
+						ReversiBitboard empty,
+						int alpha, int beta,
+						int opponent_passed);
+static int		get_final_score (ReversiBitboard player,
+					 ReversiBitboard opponent,
+					 ReversiBitboard empty);
+
+
+/* Bitboard shifts in the same order as `delta' array.  The masks
+ * clear bits that would wrap around to the opposite edge.
+ */
+static const int	      left_shifts[8]  = { 8, 0, 0, 1, 7, 0, 0, 9 };
+static const int	      right_shifts[8] = { 0, 1, 8, 0, 0, 9, 7, 0 };
+static const ReversiBitboard  shift_masks[8] = {
+  ~0ULL, NOT_LAST_COLUMN, ~0ULL, NOT_FIRST_COLUMN,
+  NOT_LAST_COLUMN, NOT_LAST_COLUMN, NOT_FIRST_COLUMN, NOT_FIRST_COLUMN
+};
+
+
+void
+reversi_reset_game_data (Board *board, int forced_reset)
+{
+  UNUSED (forced_reset);
+
+  rebuild_bitboards (board);
+}
+
 
 int
 reversi_adjust_color_to_play (const Board *board, BoardRuleSet rule_set,
@@ -47,6 +149,22 @@ reversi_adjust_color_to_play (const Board *board, BoardRuleSet rule_set,
 
   assert (rule_set < NUM_REVERSI_RULE_SETS);
 
+  if (REVERSI_USES_BITBOARDS (board)) {
+    ReversiBitboard player   = board->data.reversi.disks[COLOR_INDEX (color)];
+    ReversiBitboard opponent
+      = board->data.reversi.disks[COLOR_INDEX (OTHER_COLOR (color))];
+    ReversiBitboard empty    = (board->data.reversi.on_board
+				& ~(player | opponent));
+
+    if (get_legal_moves_bitboard (player, opponent, empty))
+      return color;
+
+    if (get_legal_moves_bitboard (opponent, player, empty))
+      return OTHER_COLOR (color);
+
+    return EMPTY;
+  }
+
   do {
     for (pos = POSITION (0, 0); ON_GRID (board->grid, pos);
 	 pos += (BOARD_MAX_WIDTH + 1) - board->width) {
@@ -105,8 +223,18 @@ reversi_is_legal_move (const Board *board, BoardRuleSet rule_set,
   assert (ON_BOARD (board, x, y));
 
   if (rule_set != REVERSI_RULE_SET_SGF) {
-    if (board->grid[pos] == EMPTY)
+    if (board->grid[pos] == EMPTY) {
+      if (REVERSI_USES_BITBOARDS (board)) {
+	const ReversiBitboard *disks = board->data.reversi.disks;
+
+	return (get_flips_bitboard (disks[COLOR_INDEX (color)],
+				    disks[COLOR_INDEX (OTHER_COLOR (color))],
+				    POSITION_BIT (pos))
+		!= 0);
+      }
+
       return is_legal_move (board->grid, rule_set, color, pos);
+    }
 
     return 0;
   }
@@ -115,6 +243,76 @@ reversi_is_legal_move (const Board *board, BoardRuleSet rule_set,
 }
 
 
+/* Mark all legal moves of `color' in `legal_grid'.  Without bitboards,
+ * beams are traced from `color' disks, so each run of opponent disks
+ * is walked once per direction instead of once per empty point.
+ */
+int
+reversi_get_legal_moves (const Board *board, BoardRuleSet rule_set,
+			 int color, char legal_grid[BOARD_GRID_SIZE])
+{
+  const char *grid = board->grid;
+  int other = OTHER_COLOR (color);
+  int num_legal_moves = 0;
+  int x;
+  int y;
+  int pos;
+
+  assert (rule_set < NUM_REVERSI_RULE_SETS);
+
+  if (rule_set == REVERSI_RULE_SET_SGF) {
+    grid_fill (legal_grid, board->width, board->height, 1);
+    return board->width * board->height;
+  }
+
+  grid_fill (legal_grid, board->width, board->height, 0);
+
+  if (REVERSI_USES_BITBOARDS (board)) {
+    const ReversiBoardData *data = &board->data.reversi;
+    ReversiBitboard moves
+      = get_legal_moves_bitboard (data->disks[COLOR_INDEX (color)],
+				  data->disks[COLOR_INDEX (other)],
+				  (data->on_board
+				   & ~(data->disks[BLACK_INDEX]
+				       | data->disks[WHITE_INDEX])));
+
+    for (; moves; moves &= moves - 1) {
+      legal_grid[BIT_INDEX_POSITION (BOARD_FIRST_BIT_INDEX (moves))] = 1;
+      num_legal_moves++;
+    }
+
+    return num_legal_moves;
+  }
+
+  for (y = 0, pos = POSITION (0, 0); y < board->height; y++) {
+    for (x = 0; x < board->width; x++, pos++) {
+      if (grid[pos] == color) {
+	int k;
+
+	for (k = 0; k < 8; k++) {
+	  int beam = pos + delta[k];
+
+	  if (grid[beam] == other) {
+	    do
+	      beam += delta[k];
+	    while (grid[beam] == other);
+
+	    if (grid[beam] == EMPTY && !legal_grid[beam]) {
+	      legal_grid[beam] = 1;
+	      num_legal_moves++;
+	    }
+	  }
+	}
+      }
+    }
+
+    pos += BOARD_MAX_WIDTH + 1 - board->width;
+  }
+
+  return num_legal_moves;
+}
+
+
 static inline int
 is_legal_move (const char grid[BOARD_FULL_GRID_SIZE], BoardRuleSet rule_set,
 	       int color, int pos)
@@ -157,22 +355,45 @@ reversi_play_move (Board *board, int color, va_list move)
 
   memset (stack_entry->num.flips, 0, sizeof stack_entry->num.flips);
 
-  for (k = 0; k < 8; k++) {
-    int beam = pos + delta[k];
+  if (REVERSI_USES_BITBOARDS (board)) {
+    ReversiBoardData *data = &board->data.reversi;
+    ReversiBitboard move_bit = POSITION_BIT (pos);
+    ReversiBitboard flips
+      = get_flips_bitboard (data->disks[COLOR_INDEX (color)],
+			    data->disks[COLOR_INDEX (other)], move_bit);
+    ReversiBitboard bits;
 
-    if (grid[beam] == other) {
-      do
-	beam += delta[k];
-      while (grid[beam] == other);
+    stack_entry->flipped_disks = flips;
+
+    data->disks[COLOR_INDEX (color)] |= flips | move_bit;
+    data->disks[COLOR_INDEX (other)] &= ~(flips | move_bit);
+
+    for (bits = flips; bits; bits &= bits - 1) {
+      int beam = BIT_INDEX_POSITION (BOARD_FIRST_BIT_INDEX (bits));
 
-      if (grid[beam] == color) {
-	beam -= delta[k];
+      CHANGE_HASH_KEY (board, beam, other, color);
+      grid[beam] = color;
+    }
+  }
+  else {
+    for (k = 0; k < 8; k++) {
+      int beam = pos + delta[k];
 
-	do {
-	  grid[beam] = color;
-	  stack_entry->num.flips[k]++;
+      if (grid[beam] == other) {
+	do
+	  beam += delta[k];
+	while (grid[beam] == other);
+
+	if (grid[beam] == color) {
 	  beam -= delta[k];
-	} while (beam != pos);
+
+	  do {
+	    CHANGE_HASH_KEY (board, beam, other, color);
+	    grid[beam] = color;
+	    stack_entry->num.flips[k]++;
+	    beam -= delta[k];
+	  } while (beam != pos);
+	}
       }
     }
   }
@@ -181,6 +402,7 @@ reversi_play_move (Board *board, int color, va_list move)
   stack_entry->contents		  = grid[pos];
   stack_entry->common.move_number = board->move_number++;
 
+  CHANGE_HASH_KEY (board, pos, grid[pos], color);
   grid[pos] = color;
 }
 
@@ -195,22 +417,40 @@ reversi_undo (Board *board)
     int pos = stack_entry->position;
     int other = OTHER_COLOR (board->grid[pos]);
 
-    for (k = 0; k < 8; k++) {
-      if (stack_entry->num.flips[k]) {
-	int flips = 0;
-	int beam = pos;
+    if (REVERSI_USES_BITBOARDS (board)) {
+      ReversiBoardData *data = &board->data.reversi;
+      ReversiBitboard move = POSITION_BIT (pos);
+      ReversiBitboard flips = stack_entry->flipped_disks;
+      ReversiBitboard bits;
 
-	do {
-	  beam += delta[k];
-	  board->grid[beam] = other;
-	} while (++flips < stack_entry->num.flips[k]);
+      data->disks[COLOR_INDEX (other)] |= flips;
+      data->disks[COLOR_INDEX (OTHER_COLOR (other))] &= ~(flips | move);
+      if (IS_STONE (stack_entry->contents))
+	data->disks[COLOR_INDEX (stack_entry->contents)] |= move;
+
+      for (bits = flips; bits; bits &= bits - 1)
+	board->grid[BIT_INDEX_POSITION (BOARD_FIRST_BIT_INDEX (bits))] = other;
+    }
+    else {
+      for (k = 0; k < 8; k++) {
+	if (stack_entry->num.flips[k]) {
+	  int flips = 0;
+	  int beam = pos;
+
+	  do {
+	    beam += delta[k];
+	    board->grid[beam] = other;
+	  } while (++flips < stack_entry->num.flips[k]);
+	}
       }
     }
 
     board->grid[pos] = stack_entry->contents;
   }
-  else if (stack_entry->num.changes > 0)
+  else if (stack_entry->num.changes > 0) {
     board_undo_changes (board, stack_entry->num.changes);
+    rebuild_bitboards (board);
+  }
 
   board->move_number = stack_entry->common.move_number;
 }
@@ -225,6 +465,105 @@ reversi_apply_changes (Board *board, int num_changes)
   stack_entry->position		  = NULL_POSITION;
   stack_entry->num.changes	  = num_changes;
   stack_entry->common.move_number = board->move_number;
+
+  if (num_changes > 0)
+    rebuild_bitboards (board);
+}
+
+
+/* Recompute bitboards from grid contents.  Does nothing on boards
+ * that don't fit in a bitboard.
+ */
+static void
+rebuild_bitboards (Board *board)
+{
+  ReversiBoardData *data = &board->data.reversi;
+  int x;
+  int y;
+
+  if (!REVERSI_USES_BITBOARDS (board))
+    return;
+
+  data->disks[BLACK_INDEX] = 0;
+  data->disks[WHITE_INDEX] = 0;
+  data->on_board	   = 0;
+
+  for (y = 0; y < board->height; y++) {
+    for (x = 0; x < board->width; x++) {
+      ReversiBitboard bit = ((ReversiBitboard) 1
+			     << (x + REVERSI_BITBOARD_MAX_SIZE * y));
+      int contents = board->grid[POSITION (x, y)];
+
+      data->on_board |= bit;
+      if (IS_STONE (contents))
+	data->disks[COLOR_INDEX (contents)] |= bit;
+    }
+  }
+}
+
+
+/* Find all legal moves for `player' at once: for each direction,
+ * propagate runs of opponent's disks starting next to player's disks
+ * (at most six steps on an 8x8 board) and see which of them end at an
+ * empty square.
+ */
+static ReversiBitboard
+get_legal_moves_bitboard (ReversiBitboard player, ReversiBitboard opponent,
+			  ReversiBitboard empty)
+{
+  ReversiBitboard moves = 0;
+  int k;
+
+  for (k = 0; k < 8; k++) {
+    ReversiBitboard run = SHIFT_BITBOARD (player, k) & opponent;
+
+    run |= SHIFT_BITBOARD (run, k) & opponent;
+    run |= SHIFT_BITBOARD (run, k) & opponent;
+    run |= SHIFT_BITBOARD (run, k) & opponent;
+    run |= SHIFT_BITBOARD (run, k) & opponent;
+    run |= SHIFT_BITBOARD (run, k) & opponent;
+
+    moves |= SHIFT_BITBOARD (run, k) & empty;
+  }
+
+  return moves;
+}
+
+
+/* Determine which disks of `opponent' are flipped if `player' plays
+ * at (single bit) `move'.
+ */
+static ReversiBitboard
+get_flips_bitboard (ReversiBitboard player, ReversiBitboard opponent,
+		    ReversiBitboard move)
+{
+  /* Directions are spelled out, so that the shifts are constant.
+   * This function is the bottleneck of the endgame solver.
+   */
+  return (get_flips_in_direction (player, opponent, move, 0)
+	  | get_flips_in_direction (player, opponent, move, 1)
+	  | get_flips_in_direction (player, opponent, move, 2)
+	  | get_flips_in_direction (player, opponent, move, 3)
+	  | get_flips_in_direction (player, opponent, move, 4)
+	  | get_flips_in_direction (player, opponent, move, 5)
+	  | get_flips_in_direction (player, opponent, move, 6)
+	  | get_flips_in_direction (player, opponent, move, 7));
+}
+
+
+static inline ReversiBitboard
+get_flips_in_direction (ReversiBitboard player, ReversiBitboard opponent,
+			ReversiBitboard move, int direction)
+{
+  ReversiBitboard run = 0;
+  ReversiBitboard beam = SHIFT_BITBOARD (move, direction);
+
+  while (beam & opponent) {
+    run |= beam;
+    beam = SHIFT_BITBOARD (beam, direction);
+  }
+
+  return (beam & player ? run : 0);
 }
 
 
@@ -290,7 +629,7 @@ reversi_dump_board (const Board *board)
 
 
 
-/* Reversi-specific function. */
+/* Reversi-specific functions. */
 
 void
 reversi_count_disks (const Board *board,
@@ -317,6 +656,282 @@ reversi_count_disks (const Board *board,
 }
 
 
+/* Find the result of perfect play from the current position, with
+ * `color' to play.  On success, nonzero is returned, `best_x' and
+ * `best_y' are set to the best move (or to NULL_X and NULL_Y if
+ * `color' has to pass or the game is over) and `disk_difference' to
+ * the final disk difference from `color's point of view.  Empty
+ * squares left at the end of the game are given to the winner.
+ *
+ * Only positions of boards represented with bitboards and with at
+ * most REVERSI_ENDGAME_SOLVER_MAX_EMPTIES empty squares are solved,
+ * zero is returned for any other position.
+ */
+int
+reversi_solve_endgame (const Board *board, int color,
+		       int *best_x, int *best_y, int *disk_difference)
+{
+  const ReversiBoardData *data = &board->data.reversi;
+  ReversiSolver solver;
+  int best_move;
+
+  assert (board);
+  assert (board->game == GAME_REVERSI);
+  assert (IS_STONE (color));
+  assert (best_x && best_y && disk_difference);
+
+  if (!REVERSI_USES_BITBOARDS (board)
+      || (BOARD_COUNT_BITS (data->on_board
+			    & ~(data->disks[BLACK_INDEX]
+				| data->disks[WHITE_INDEX])))
+	  > REVERSI_ENDGAME_SOLVER_MAX_EMPTIES)
+    return 0;
+
+  solver.on_board = data->on_board;
+  solver.corners  = (POSITION_BIT (POSITION (0, 0))
+		     | POSITION_BIT (POSITION (board->width - 1, 0))
+		     | POSITION_BIT (POSITION (0, board->height - 1))
+		     | POSITION_BIT (POSITION (board->width - 1,
+					       board->height - 1)));
+  solver.table	  = utils_malloc0 (SOLVER_TABLE_SIZE
+				   * sizeof (ReversiSolverEntry));
+
+  *disk_difference
+    = solve_position (&solver,
+		      data->disks[COLOR_INDEX (color)],
+		      data->disks[COLOR_INDEX (OTHER_COLOR (color))],
+		      -SOLVER_MAX_SCORE - 1, SOLVER_MAX_SCORE + 1, &best_move);
+
+  utils_free (solver.table);
+
+  if (best_move >= 0) {
+    *best_x = best_move % REVERSI_BITBOARD_MAX_SIZE;
+    *best_y = best_move / REVERSI_BITBOARD_MAX_SIZE;
+  }
+  else {
+    *best_x = NULL_X;
+    *best_y = NULL_Y;
+  }
+
+  return 1;
+}
+
+
+/* Fail-soft alpha-beta search to the end of the game.  Returns the
+ * score from `player's point of view and stores the best move bit
+ * index in `best_move' (-1 if `player' has no moves.)  All moves but
+ * the first (presumably best) are searched with a null window first.
+ */
+static int
+solve_position (ReversiSolver *solver,
+		ReversiBitboard player, ReversiBitboard opponent,
+		int alpha, int beta, int *best_move)
+{
+  ReversiBitboard empty = solver->on_board & ~(player | opponent);
+  ReversiBitboard moves = get_legal_moves_bitboard (player, opponent, empty);
+  ReversiBitboard bits;
+  ReversiSolverEntry *entry = NULL;
+  int move_list[REVERSI_ENDGAME_SOLVER_MAX_EMPTIES];
+  int move_keys[REVERSI_ENDGAME_SOLVER_MAX_EMPTIES];
+  ReversiBitboard move_flips[REVERSI_ENDGAME_SOLVER_MAX_EMPTIES];
+  int num_moves = 0;
+  int num_empties;
+  int original_alpha = alpha;
+  int table_move = -1;
+  int best_score = -SOLVER_MAX_SCORE - 1;
+  int k;
+
+  *best_move = -1;
+
+  if (!moves) {
+    int dummy_move;
+
+    if (!get_legal_moves_bitboard (opponent, player, empty))
+      return get_final_score (player, opponent, empty);
+
+    return - solve_position (solver, opponent, player, -beta, -alpha,
+			     &dummy_move);
+  }
+
+  num_empties = BOARD_COUNT_BITS (empty);
+
+  if (num_empties > SOLVER_MAX_SHALLOW_EMPTIES) {
+    entry = (solver->table
+	     + (((player * 0x9e3779b97f4a7c15ULL)
+		 ^ (opponent * 0xc2b2ae3d27d4eb4fULL))
+		>> (64 - SOLVER_TABLE_BITS)));
+
+    if (entry->player == player && entry->opponent == opponent) {
+      if (entry->lower_bound >= beta
+	  || entry->lower_bound == entry->upper_bound) {
+	*best_move = entry->best_move;
+	return entry->lower_bound;
+      }
+
+      if (entry->upper_bound <= alpha) {
+	*best_move = entry->best_move;
+	return entry->upper_bound;
+      }
+
+      table_move = entry->best_move;
+    }
+  }
+
+  /* Order moves: the move from the transposition table first, then
+   * corners, then by opponent's mobility (fewest replies first.)
+   */
+  for (bits = moves; bits; bits &= bits - 1) {
+    int index = BOARD_FIRST_BIT_INDEX (bits);
+    ReversiBitboard move_bit = (ReversiBitboard) 1 << index;
+    ReversiBitboard flips = get_flips_bitboard (player, opponent, move_bit);
+    int key = 0;
+
+    if (index == table_move)
+      key = -2 * SOLVER_MAX_SCORE;
+    else if (num_empties > SOLVER_MAX_SHALLOW_EMPTIES) {
+      key = BOARD_COUNT_BITS (get_legal_moves_bitboard
+			      (opponent & ~flips, player | flips | move_bit,
+			       empty & ~move_bit));
+      if (move_bit & solver->corners)
+	key -= SOLVER_MAX_SCORE;
+    }
+
+    for (k = num_moves; k > 0 && move_keys[k - 1] > key; k--) {
+      move_list[k]  = move_list[k - 1];
+      move_keys[k]  = move_keys[k - 1];
+      move_flips[k] = move_flips[k - 1];
+    }
+
+    move_list[k]  = index;
+    move_keys[k]  = key;
+    move_flips[k] = flips;
+    num_moves++;
+  }
+
+  for (k = 0; k < num_moves; k++) {
+    ReversiBitboard move_bit = (ReversiBitboard) 1 << move_list[k];
+    ReversiBitboard flips = move_flips[k];
+    ReversiBitboard new_player = opponent & ~flips;
+    ReversiBitboard new_opponent = player | flips | move_bit;
+    int score;
+
+    if (k > 0) {
+      score = - solve_child (solver, new_player, new_opponent,
+			     num_empties - 1, -alpha - 1, -alpha);
+      if (score > alpha && score < beta) {
+	score = - solve_child (solver, new_player, new_opponent,
+			       num_empties - 1, -beta, -score);
+      }
+    }
+    else {
+      score = - solve_child (solver, new_player, new_opponent,
+			     num_empties - 1, -beta, -alpha);
+    }
+
+    if (score > best_score) {
+      best_score = score;
+      *best_move = move_list[k];
+
+      if (score > alpha) {
+	alpha = score;
+	if (alpha >= beta)
+	  break;
+      }
+    }
+  }
+
+  if (entry) {
+    entry->player      = player;
+    entry->opponent    = opponent;
+    entry->lower_bound = (best_score > original_alpha
+			  ? best_score : -SOLVER_MAX_SCORE);
+    entry->upper_bound = (best_score < beta ? best_score : SOLVER_MAX_SCORE);
+    entry->best_move   = *best_move;
+  }
+
+  return best_score;
+}
+
+
+static inline int
+solve_child (ReversiSolver *solver,
+	     ReversiBitboard player, ReversiBitboard opponent,
+	     int num_empties, int alpha, int beta)
+{
+  int dummy_move;
+
+  if (num_empties <= SOLVER_MAX_SHALLOW_EMPTIES) {
+    return solve_shallow_position (player, opponent,
+				   solver->on_board & ~(player | opponent),
+				   alpha, beta, 0);
+  }
+
+  return solve_position (solver, player, opponent, alpha, beta,
+			 &dummy_move);
+}
+
+
+/* Same as solve_position(), but cheaper with few empty squares: moves
+ * are found by trying to flip from each empty square and no move
+ * ordering or transposition table is used.
+ */
+static int
+solve_shallow_position (ReversiBitboard player, ReversiBitboard opponent,
+			ReversiBitboard empty, int alpha, int beta,
+			int opponent_passed)
+{
+  ReversiBitboard bits;
+  int best_score = -SOLVER_MAX_SCORE - 1;
+
+  for (bits = empty; bits; bits &= bits - 1) {
+    ReversiBitboard move_bit = bits & -bits;
+    ReversiBitboard flips = get_flips_bitboard (player, opponent, move_bit);
+
+    if (flips) {
+      int score = - solve_shallow_position (opponent & ~flips,
+					    player | flips | move_bit,
+					    empty & ~move_bit,
+					    -beta, -alpha, 0);
+
+      if (score > best_score) {
+	best_score = score;
+
+	if (score > alpha) {
+	  alpha = score;
+	  if (alpha >= beta)
+	    break;
+	}
+      }
+    }
+  }
+
+  if (best_score == -SOLVER_MAX_SCORE - 1) {
+    if (opponent_passed)
+      return get_final_score (player, opponent, empty);
+
+    return - solve_shallow_position (opponent, player, empty,
+				     -beta, -alpha, 1);
+  }
+
+  return best_score;
+}
+
+
+static int
+get_final_score (ReversiBitboard player, ReversiBitboard opponent,
+		 ReversiBitboard empty)
+{
+  int score = BOARD_COUNT_BITS (player) - BOARD_COUNT_BITS (opponent);
+
+  if (score > 0)
+    return score + BOARD_COUNT_BITS (empty);
+  if (score < 0)
+    return score - BOARD_COUNT_BITS (empty);
+
+  return 0;
+}
+
+
 /*
  * Local Variables:
  * tab-width: 8
@@ -50,9 +50,14 @@ struct _ReversiMoveStackEntry {
     char	   flips[8];
     int		   changes;
   } num;
+
+  /* Used instead of `num.flips' on boards with bitboards. */
+  ReversiBitboard  flipped_disks;
 };
 
 
+void		reversi_reset_game_data (Board *board, int forced_reset);
+
 int		reversi_adjust_color_to_play (const Board *board,
 					      BoardRuleSet rule_set,
 					      int color);
@@ -67,6 +72,9 @@ int		reversi_get_default_setup (int width, int height,
 int		reversi_is_legal_move (const Board *board,
 				       BoardRuleSet rule_set,
 				       int color, va_list move);
+int		reversi_get_legal_moves (const Board *board,
+					 BoardRuleSet rule_set, int color,
+					 char legal_grid[BOARD_GRID_SIZE]);
 
 void		reversi_play_move (Board *board, int color, va_list move);
 void		reversi_undo (Board *board);
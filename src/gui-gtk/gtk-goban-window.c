@@ -57,6 +57,7 @@
 #include "gtk-resume-game-dialog.h"
 #include "gtk-sgf-tree-signal-proxy.h"
 #include "gtk-sgf-tree-view.h"
+#include "gtk-thread-interface.h"
 #include "gtk-utils.h"
 #include "quarry-find-dialog.h"
 #include "quarry-marshal.h"
@@ -82,6 +83,11 @@
 
 #define NAVIGATE_FAST_NUM_MOVES	10
 
+/* Errors found when a lazily parsed game tree is entered are shown,
+ * but only this many of them.
+ */
+#define MAX_GAME_TREE_ERRORS_TO_SHOW	10
+
 #define IS_DISPLAYING_GAME_NODE(goban_window)				\
   ((goban_window)->game_position.board_state				\
    == &(goban_window)->sgf_board_state)
@@ -170,6 +176,42 @@ struct _SgfCopyData {
 };
 
 
+#if THREADS_SUPPORTED
+
+/* Ownership playouts for scoring mode are split between this many
+ * tasks, each playing on its own copy of the board.  The tasks of all
+ * windows run on one shared thread pool.
+ */
+#define NUM_OWNERSHIP_TASKS		4
+
+typedef struct _OwnershipTask			OwnershipTask;
+
+struct _OwnershipTask {
+  OwnershipJob		     *job;
+  Board			     *board;
+  int			      num_playouts;
+  unsigned int		      random_seed;
+  int			      ownership[BOARD_GRID_SIZE];
+};
+
+/* The window is referenced until the last task of the job finishes
+ * and the job is passed back to the main thread.  Results are only
+ * applied if the window still points to the job, i.e. scoring mode
+ * has not been left and no stones have been toggled by the user.
+ */
+struct _OwnershipJob {
+  GtkGobanWindow	     *goban_window;
+  BoardHashKey		      hash_key;
+  gint			      num_pending_tasks;
+  OwnershipTask		      tasks[NUM_OWNERSHIP_TASKS];
+};
+
+
+static GThreadPool	     *ownership_thread_pool = NULL;
+
+#endif
+
+
 static void	 gtk_goban_window_class_init (GtkGobanWindowClass *class);
 static void	 gtk_goban_window_init (GtkGobanWindow *goban_window);
 
@@ -224,6 +266,8 @@ static void	 show_or_hide_navigation_toolbar
 		   (GtkGobanWindow *goban_window);
 static void	 show_or_hide_game_action_buttons
 		   (GtkGobanWindow *goban_window);
+static void	 show_or_hide_amazons_territory
+		   (GtkGobanWindow *goban_window);
 static void	 show_or_hide_sgf_tree_view (GtkGobanWindow *goban_window,
 					     guint callback_action);
 static void	 recenter_sgf_tree_view (GtkGobanWindow *goban_window);
@@ -259,6 +303,14 @@ static void	 cancel_scoring (GtkProgressDialog *progress_dialog,
 				 GtkGobanWindow *goban_window);
 static void	 enter_scoring_mode (GtkGobanWindow *goban_window);
 
+static void	 guess_dead_stones (GtkGobanWindow *goban_window,
+				    const BoardPositionList *black_territory,
+				    const BoardPositionList *white_territory);
+#if THREADS_SUPPORTED
+static void	 run_ownership_task (OwnershipTask *task, gpointer user_data);
+static void	 apply_ownership_job (void *result);
+#endif
+
 static void	 go_scoring_mode_done (GtkGobanWindow *goban_window);
 static void	 go_scoring_mode_cancel (GtkGobanWindow *goban_window);
 static void	 handle_go_scoring_results (GtkGobanWindow *goban_window);
@@ -273,6 +325,8 @@ static void	 do_resign_game (GtkGobanWindow *goban_window);
 
 static void	 set_current_tree (GtkGobanWindow *goban_window,
 				   SgfGameTree *sgf_tree);
+static void	 show_game_tree_errors (GtkGobanWindow *goban_window,
+					SgfErrorList *error_list);
 static void	 set_time_controls (GtkGobanWindow *goban_window,
 				    TimeControl *time_control);
 static void	 reenter_current_node (GtkGobanWindow *goban_window);
@@ -804,6 +858,11 @@ gtk_goban_window_init (GtkGobanWindow *goban_window)
       "<CheckItem>" },
     { N_("/View/"), NULL, NULL, 0, "<Separator>" },
 
+    { N_("/View/Amazons _Territory"),	NULL,
+      show_or_hide_amazons_territory,	0,
+      "<CheckItem>" },
+    { N_("/View/"), NULL, NULL, 0, "<Separator>" },
+
     { N_("/View/Game _Tree"),		NULL,
       show_or_hide_sgf_tree_view,	GTK_GOBAN_WINDOW_TOGGLE_CHILD,
       "<CheckItem>" },
@@ -1311,6 +1370,10 @@ gtk_goban_window_init (GtkGobanWindow *goban_window)
 					NULL);
   }
 
+  /* Only makes sense for Amazons, see set_current_tree(). */
+  gtk_utils_set_menu_items_sensitive (goban_window->item_factory, FALSE,
+				      "/View/Amazons Territory", NULL);
+
   /* Look up here when the classes are certainly loaded. */
   clicked_signal_id	   = g_signal_lookup ("clicked", GTK_TYPE_BUTTON);
   pointer_moved_signal_id  = g_signal_lookup ("pointer-moved", GTK_TYPE_GOBAN);
@@ -1362,6 +1425,9 @@ gtk_goban_window_init (GtkGobanWindow *goban_window)
   goban_window->text_to_find		     = NULL;
 
   goban_window->game_info_dialog	     = NULL;
+
+  goban_window->show_amazons_territory	     = FALSE;
+  goban_window->ownership_job		     = NULL;
 }
 
 
@@ -1406,6 +1472,9 @@ gtk_goban_window_destroy (GtkObject *object)
 {
   GtkGobanWindow *goban_window = GTK_GOBAN_WINDOW (object);
 
+  /* Any pending dead stones guess will be discarded. */
+  goban_window->ownership_job = NULL;
+
   if (goban_window->game_info_dialog)
     gtk_widget_destroy (GTK_WIDGET (goban_window->game_info_dialog));
 
@@ -2356,6 +2425,21 @@ show_or_hide_game_action_buttons (GtkGobanWindow *goban_window)
 }
 
 
+static void
+show_or_hide_amazons_territory (GtkGobanWindow *goban_window)
+{
+  GtkWidget *menu_item
+    = gtk_item_factory_get_widget (goban_window->item_factory,
+				   "/View/Amazons Territory");
+
+  goban_window->show_amazons_territory
+    = !goban_window->show_amazons_territory;
+  gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (menu_item),
+				  goban_window->show_amazons_territory);
+  update_children_for_new_node (goban_window, TRUE, FALSE);
+}
+
+
 static void
 show_or_hide_sgf_tree_view (GtkGobanWindow *goban_window,
 			    guint callback_action)
@@ -2679,6 +2763,129 @@ free_handicap_mode_done (GtkGobanWindow *goban_window)
 }
 
 
+/* Fill `dead_stones' grid of the window.  Without territory on the
+ * current node, ownership playouts are run on a thread pool, if
+ * threads are available.  In that case this function returns at once
+ * and the grid is filled later from the main loop.
+ */
+static void
+guess_dead_stones (GtkGobanWindow *goban_window,
+		   const BoardPositionList *black_territory,
+		   const BoardPositionList *white_territory)
+{
+  Board *board = goban_window->board;
+
+#if THREADS_SUPPORTED
+
+  if (!black_territory && !white_territory) {
+    if (!ownership_thread_pool) {
+      ownership_thread_pool
+	= g_thread_pool_new ((GFunc) run_ownership_task, NULL,
+			     NUM_OWNERSHIP_TASKS, FALSE, NULL);
+    }
+
+    if (ownership_thread_pool) {
+      OwnershipJob *job = g_malloc (sizeof (OwnershipJob));
+      int k;
+
+      job->goban_window	     = goban_window;
+      job->hash_key	     = board->hash_key;
+      job->num_pending_tasks = NUM_OWNERSHIP_TASKS;
+
+      g_object_ref (goban_window);
+      goban_window->ownership_job = job;
+
+      for (k = 0; k < NUM_OWNERSHIP_TASKS; k++) {
+	OwnershipTask *task = &job->tasks[k];
+
+	task->job	   = job;
+	task->board	   = board_duplicate_without_stacks (board);
+	task->num_playouts = ((GO_OWNERSHIP_NUM_PLAYOUTS + k)
+			      / NUM_OWNERSHIP_TASKS);
+
+	/* go_estimate_ownership() mixes the seed with playout index,
+	 * so it is enough to make seeds of the tasks differ.
+	 */
+	task->random_seed  = ((unsigned int) board->hash_key
+			      + k * GO_OWNERSHIP_NUM_PLAYOUTS);
+	board_fill_int_grid (board, task->ownership, 0);
+
+	g_thread_pool_push (ownership_thread_pool, task, NULL);
+      }
+
+      return;
+    }
+  }
+
+#endif
+
+  go_guess_dead_stones (board, goban_window->dead_stones,
+			black_territory, white_territory);
+}
+
+
+#if THREADS_SUPPORTED
+
+/* Runs in a worker thread.  The last task of a job to finish passes it
+ * to the main thread, see apply_ownership_job().
+ */
+static void
+run_ownership_task (OwnershipTask *task, gpointer user_data)
+{
+  UNUSED (user_data);
+
+  go_estimate_ownership (task->board, task->num_playouts, task->random_seed,
+			 task->ownership);
+
+  if (g_atomic_int_dec_and_test (&task->job->num_pending_tasks))
+    thread_events_post (apply_ownership_job, task->job);
+}
+
+
+static void
+apply_ownership_job (void *result)
+{
+  OwnershipJob *job = (OwnershipJob *) result;
+  GtkGobanWindow *goban_window = job->goban_window;
+  int k;
+
+  if (goban_window->ownership_job == job) {
+    Board *board = goban_window->board;
+
+    goban_window->ownership_job = NULL;
+
+    if (goban_window->dead_stones && board->hash_key == job->hash_key) {
+      int ownership[BOARD_GRID_SIZE];
+      int x;
+      int y;
+      int pos;
+
+      board_fill_int_grid (board, ownership, 0);
+      for (k = 0; k < NUM_OWNERSHIP_TASKS; k++) {
+	for (y = 0; y < board->height; y++) {
+	  for (x = 0; x < board->width; x++) {
+	    pos = POSITION (x, y);
+	    ownership[pos] += job->tasks[k].ownership[pos];
+	  }
+	}
+      }
+
+      go_mark_dead_stones_by_ownership (board, goban_window->dead_stones,
+					ownership, GO_OWNERSHIP_NUM_PLAYOUTS);
+      update_territory_markup (goban_window);
+    }
+  }
+
+  for (k = 0; k < NUM_OWNERSHIP_TASKS; k++)
+    board_delete (job->tasks[k].board);
+
+  g_object_unref (goban_window);
+  g_free (job);
+}
+
+#endif
+
+
 static void
 go_scoring_mode_done (GtkGobanWindow *goban_window)
 {
@@ -2759,13 +2966,16 @@ handle_go_scoring_results (GtkGobanWindow *goban_window)
   sgf_utils_end_action (current_tree);
 
   g_free (goban_window->dead_stones);
-  goban_window->dead_stones = NULL;
+  goban_window->dead_stones   = NULL;
+  goban_window->ownership_job = NULL;
 }
 
 
 static void
 set_current_tree (GtkGobanWindow *goban_window, SgfGameTree *sgf_tree)
 {
+  SgfErrorList *error_list;
+
   if (!goban_window->board && GAME_IS_SUPPORTED (sgf_tree->game)) {
     GtkLabel **game_specific_info = goban_window->game_specific_info;
 
@@ -2778,6 +2988,9 @@ set_current_tree (GtkGobanWindow *goban_window, SgfGameTree *sgf_tree)
 				   game_specific_info[WHITE_INDEX], NULL);
     gtk_utils_set_widgets_visible (goban_window->board->game == GAME_GO,
 				   goban_window->pass_button, NULL);
+    gtk_utils_set_menu_items_sensitive
+      (goban_window->item_factory, goban_window->board->game == GAME_AMAZONS,
+       "/View/Amazons Territory", NULL);
   }
 
   /* Won't work from update_children_for_new_node() below, because the
@@ -2790,6 +3003,15 @@ set_current_tree (GtkGobanWindow *goban_window, SgfGameTree *sgf_tree)
 
   gtk_sgf_tree_signal_proxy_attach (sgf_tree);
 
+  /* Trees of large collections are only parsed completely now (see
+   * `gtk-parser-interface.c'), so there can be more errors to show.
+   */
+  error_list = sgf_parse_remaining_nodes (sgf_tree);
+  if (error_list) {
+    show_game_tree_errors (goban_window, error_list);
+    string_list_delete (error_list);
+  }
+
   goban_window->current_tree = sgf_tree;
   sgf_utils_enter_tree (sgf_tree, goban_window->board,
 			&goban_window->sgf_board_state);
@@ -2824,6 +3046,40 @@ set_current_tree (GtkGobanWindow *goban_window, SgfGameTree *sgf_tree)
 }
 
 
+static void
+show_game_tree_errors (GtkGobanWindow *goban_window, SgfErrorList *error_list)
+{
+  const SgfErrorListItem *item;
+  StringBuffer errors;
+  GtkWidget *warning_dialog;
+  int num_errors = 0;
+
+  string_buffer_init (&errors, 0x400, 0x400);
+
+  for (item = error_list->first; item; item = item->next) {
+    if (++num_errors <= MAX_GAME_TREE_ERRORS_TO_SHOW) {
+      string_buffer_printf (&errors, _("Line %d, column %d: %s\n"),
+			    item->line, item->column, item->text);
+    }
+  }
+
+  if (num_errors > MAX_GAME_TREE_ERRORS_TO_SHOW) {
+    string_buffer_printf (&errors, _("(%d more errors not shown)"),
+			  num_errors - MAX_GAME_TREE_ERRORS_TO_SHOW);
+  }
+
+  warning_dialog
+    = quarry_message_dialog_new (GTK_WINDOW (goban_window),
+				 GTK_BUTTONS_OK, GTK_STOCK_DIALOG_WARNING,
+				 errors.string,
+				 _("Errors found in the game record "
+				   "have been corrected"));
+  gtk_utils_show_and_forget_dialog (GTK_DIALOG (warning_dialog));
+
+  string_buffer_dispose (&errors);
+}
+
+
 static void
 set_time_controls (GtkGobanWindow *goban_window, TimeControl *time_control)
 {
@@ -3035,9 +3291,18 @@ playing_mode_pointer_moved (GtkGobanWindow *goban_window,
 	if (color_to_play == EMPTY)
 	  break;
 
+	if (goban_window->legal_moves_color != color_to_play
+	    || (goban_window->legal_moves_hash_key
+		!= board_get_hash_key (goban_window->board))) {
+	  board_get_legal_moves (goban_window->board, RULE_SET_DEFAULT,
+				 color_to_play, goban_window->legal_moves);
+	  goban_window->legal_moves_color    = color_to_play;
+	  goban_window->legal_moves_hash_key
+	    = board_get_hash_key (goban_window->board);
+	}
+
 	if (goban_window->board->game != GAME_AMAZONS) {
-	  if (board_is_legal_move (goban_window->board, RULE_SET_DEFAULT,
-				   color_to_play, data->x, data->y))
+	  if (goban_window->legal_moves[POSITION (data->x, data->y)])
 	    return GOBAN_FEEDBACK_MOVE + COLOR_INDEX (color_to_play);
 	}
 	else {
@@ -3054,11 +3319,14 @@ playing_mode_pointer_moved (GtkGobanWindow *goban_window,
 	    goban_window->amazons_move.shoot_arrow_to.y = data->y;
 	  }
 
-	  if (board_is_legal_move (goban_window->board, RULE_SET_DEFAULT,
-				   color_to_play,
-				   goban_window->amazons_to_x,
-				   goban_window->amazons_to_y,
-				   goban_window->amazons_move)) {
+	  /* For Amazons, the map only marks amazons that can be moved. */
+	  if (goban_window->amazons_move_stage == SELECTING_QUEEN
+	      ? goban_window->legal_moves[POSITION (data->x, data->y)]
+	      : board_is_legal_move (goban_window->board, RULE_SET_DEFAULT,
+				     color_to_play,
+				     goban_window->amazons_to_x,
+				     goban_window->amazons_to_y,
+				     goban_window->amazons_move)) {
 	    if (goban_window->amazons_move_stage == SELECTING_QUEEN)
 	      return GOBAN_FEEDBACK_MOVE + COLOR_INDEX (color_to_play);
 	    else if (goban_window->amazons_move_stage == MOVING_QUEEN)
@@ -3697,6 +3965,9 @@ go_scoring_mode_goban_clicked (GtkGobanWindow *goban_window,
     if (stones) {
       int pos = POSITION (data->x, data->y);
 
+      /* Don't let a pending guess override user's choice. */
+      goban_window->ownership_job = NULL;
+
       board_position_list_mark_on_grid (stones, goban_window->dead_stones,
 					!goban_window->dead_stones[pos]);
       board_position_list_delete (stones);
@@ -3875,6 +4146,7 @@ update_children_for_new_node (GtkGobanWindow *goban_window, gboolean forced,
   }
 
   reset_amazons_move_data (goban_window);
+  goban_window->legal_moves_color = EMPTY;
 
   /* FIXME: Probably not the right place for it. */
   utils_free (goban_window->next_sgf_label);
@@ -3894,6 +4166,15 @@ update_children_for_new_node (GtkGobanWindow *goban_window, gboolean forced,
 				     BLACK_50_TRANSPARENT,
 				     WHITE_50_TRANSPARENT,
 				     MIXED_50_TRANSPARENT);
+
+  /* Territory estimation is fast enough to be redone on every node. */
+  if (goban_window->board->game == GAME_AMAZONS
+      && goban_window->show_amazons_territory) {
+    amazons_mark_territory_on_grid (goban_window->board, goban_markup, 0,
+				    BLACK_OPAQUE | GOBAN_MARKUP_GHOSTIFY,
+				    WHITE_OPAQUE | GOBAN_MARKUP_GHOSTIFY);
+  }
+
   sgf_utils_mark_territory_on_grid (current_tree, goban_markup,
 				    (BLACK_OPAQUE
 				     | GOBAN_MARKUP_GHOSTIFY),
@@ -5929,8 +6210,7 @@ activate_scoring_tool (GtkGobanWindow *goban_window, guint callback_action,
       goban_window->dead_stones = g_malloc (BOARD_GRID_SIZE * sizeof (char));
       board_fill_grid (goban_window->board, goban_window->dead_stones, 0);
 
-      go_guess_dead_stones (goban_window->board, goban_window->dead_stones,
-			    black_territory, white_territory);
+      guess_dead_stones (goban_window, black_territory, white_territory);
     }
 
     enter_special_mode (goban_window,
@@ -5951,7 +6231,8 @@ activate_scoring_tool (GtkGobanWindow *goban_window, guint callback_action,
      * in that case we actually leave scoring mode, not cancel it.
      */
     g_free (goban_window->dead_stones);
-    goban_window->dead_stones = NULL;
+    goban_window->dead_stones	= NULL;
+    goban_window->ownership_job = NULL;
 
     leave_special_mode (goban_window);
   }
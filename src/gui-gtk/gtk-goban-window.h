@@ -68,6 +68,9 @@ enum {
 typedef struct _GtkGobanWindow		GtkGobanWindow;
 typedef struct _GtkGobanWindowClass	GtkGobanWindowClass;
 
+/* Private to `gtk-goban-window.c'. */
+typedef struct _OwnershipJob		OwnershipJob;
+
 struct _GtkGobanWindow {
   GtkWindow		   window;
 
@@ -110,11 +113,23 @@ struct _GtkGobanWindow {
   gboolean		   player_initialization_step[NUM_COLORS];
   TimeControl		  *time_controls[NUM_COLORS];
 
+  /* Legal moves of `legal_moves_color' at current node, computed on
+   * demand for pointer feedback.  EMPTY color means not computed.
+   * Board hash key at the time lets stale maps be detected after
+   * board edits or undoing that don't change current node.
+   */
+  char			   legal_moves[BOARD_GRID_SIZE];
+  int			   legal_moves_color;
+  BoardHashKey		   legal_moves_hash_key;
+
   int			   amazons_move_stage;
   int			   amazons_to_x;
   int			   amazons_to_y;
   BoardAmazonsMoveData     amazons_move;
 
+  /* Whether to mark estimated Amazons territory on the board. */
+  gboolean		   show_amazons_territory;
+
   BoardPositionList	  *drawn_position_list;
   int			   drawing_mode;
 
@@ -130,6 +145,9 @@ struct _GtkGobanWindow {
 
   char			  *dead_stones;
   BoardPositionList	  *dead_stones_list;
+
+  /* Pending dead stones guess, if any.  See `gtk-goban-window.c'. */
+  OwnershipJob		  *ownership_job;
   int			   scoring_engine_player;
   gboolean		   engine_scoring_cancelled;
 
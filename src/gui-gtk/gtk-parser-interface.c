@@ -28,6 +28,10 @@
  * dialog during parsing of huge files, thus providing feedback and a
  * way to cancel parsing.  And you can actually do anything with
  * Quarry while it parses a file in another thread.
+ *
+ * Large files are cached as snapshots (see `sgf-snapshot.c') stored
+ * in hidden files next to them.  Next time such a file is opened, the
+ * snapshot is loaded instead of parsing, unless the file has changed.
  */
 
 
@@ -44,6 +48,11 @@
 
 #include <gtk/gtk.h>
 
+#if HAVE_SYS_STAT_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
 /* For chdir() function. */
 #if HAVE_UNISTD_H
 #include <unistd.h>
@@ -55,6 +64,20 @@
 #endif
 
 
+/* Files smaller than this are parsed quickly enough and are not
+ * cached.
+ */
+#define MIN_SNAPSHOT_FILE_SIZE		(1024 * 1024)
+
+/* Only game trees of collections at least this large are parsed
+ * lazily, i.e. when first entered.
+ */
+#define MIN_LAZY_PARSING_FILE_SIZE	(4 * 1024 * 1024)
+
+#define SNAPSHOT_FILENAME_PREFIX	"."
+#define SNAPSHOT_FILENAME_SUFFIX	".quarry-snapshot"
+
+
 static const gchar *reading_error = N_("Error reading file `%s'");
 static const gchar *not_sgf_file_error =
   N_("File `%s' doesn't appear to be a valid SGF file");
@@ -77,6 +100,14 @@ static void	 open_game_record (SgfCollection *sgf_collection,
 				   SgfErrorList *sgf_error_list,
 				   const gchar *filename);
 
+static int	 parse_sgf_file_or_snapshot
+		   (const gchar *filename, SgfCollection **sgf_collection,
+		    SgfErrorList **error_list,
+		    const SgfParserParameters *parameters,
+		    off_t *file_size, off_t *bytes_parsed,
+		    const int *cancellation_flag);
+static gboolean	 is_large_file (const gchar *filename);
+
 
 /* For hooking up as a callback. */
 void
@@ -142,13 +173,95 @@ open_game_record (SgfCollection *sgf_collection, SgfErrorList *sgf_error_list,
 }
 
 
+/* Load the file's snapshot if it is up to date or else parse the
+ * file.  After parsing a large file, write its snapshot.  Errors are
+ * only reported when the file is actually parsed.  Game trees are
+ * only parsed lazily if `parameters' ask for that and the file is
+ * large.
+ */
+static int
+parse_sgf_file_or_snapshot (const gchar *filename,
+			    SgfCollection **sgf_collection,
+			    SgfErrorList **error_list,
+			    const SgfParserParameters *parameters,
+			    off_t *file_size, off_t *bytes_parsed,
+			    const int *cancellation_flag)
+{
+  gchar *directory = g_path_get_dirname (filename);
+  gchar *basename = g_path_get_basename (filename);
+  gchar *snapshot_basename = g_strconcat (SNAPSHOT_FILENAME_PREFIX, basename,
+					  SNAPSHOT_FILENAME_SUFFIX, NULL);
+  gchar *snapshot_filename = g_build_filename (directory, snapshot_basename,
+					       NULL);
+  SgfParserParameters file_parameters = *parameters;
+  int result;
+
+  g_free (directory);
+  g_free (basename);
+  g_free (snapshot_basename);
+
+  if (sgf_load_snapshot (snapshot_filename, filename, sgf_collection,
+			 parameters)
+      == SGF_PARSED) {
+    *error_list = NULL;
+    result	= SGF_PARSED;
+  }
+  else {
+    if (file_parameters.lazy_game_trees && !is_large_file (filename))
+      file_parameters.lazy_game_trees = 0;
+
+    result = sgf_parse_file (filename, sgf_collection, error_list,
+			     &file_parameters, file_size, bytes_parsed,
+			     cancellation_flag);
+
+    if (result == SGF_PARSED && *file_size >= MIN_SNAPSHOT_FILE_SIZE) {
+      /* Not being able to write the snapshot is not a problem. */
+      utils_free (sgf_write_snapshot (snapshot_filename, *sgf_collection,
+				      filename));
+    }
+  }
+
+  g_free (snapshot_filename);
+
+  return result;
+}
+
+
+static gboolean
+is_large_file (const gchar *filename)
+{
+#if HAVE_SYS_STAT_H
+
+  struct stat file_statistics;
+
+  return (stat (filename, &file_statistics) == 0
+	  && file_statistics.st_size >= MIN_LAZY_PARSING_FILE_SIZE);
+
+#else
+
+  UNUSED (filename);
+  return FALSE;
+
+#endif
+}
+
+
 #if THREADS_SUPPORTED
 
 
 #include "gtk-progress-dialog.h"
 
 
+/* Maximal number of threads used to parse parts of large collections
+ * concurrently.
+ */
+#define NUM_PARSING_THREADS	4
+
+
 static gpointer	 thread_wrapped_sgf_parse_file (ParsingThreadData *data);
+static void	 run_parsing_jobs (SgfParsingJob job, void **job_data,
+				   int num_jobs, void *runner_data);
+static void	 run_parsing_job (gpointer job_data, gpointer job);
 
 static gboolean	 update_progress_bar (GtkProgressDialog *progress_dialog,
 				      ParsingThreadData *data);
@@ -210,25 +323,60 @@ gtk_parse_sgf_file (const char *filename, GtkWindow *parent,
 static gpointer
 thread_wrapped_sgf_parse_file (ParsingThreadData *data)
 {
-  ThreadEventData *event_data;
+  SgfParserParameters parameters = sgf_parser_defaults;
 
-  data->result = sgf_parse_file (data->filename,
-				 &data->sgf_collection, &data->error_list,
-				 &sgf_parser_defaults,
-				 &data->file_size, &data->bytes_parsed,
-				 &data->cancellation_flag);
+  parameters.lazy_game_trees = 1;
+  parameters.run_jobs	     = run_parsing_jobs;
 
-  event_data = g_malloc (sizeof (ThreadEventData));
-  event_data->callback = analyze_parsed_data;
-  event_data->result   = data;
+  data->result = parse_sgf_file_or_snapshot (data->filename,
+					     &data->sgf_collection,
+					     &data->error_list, &parameters,
+					     &data->file_size,
+					     &data->bytes_parsed,
+					     &data->cancellation_flag);
 
-  g_async_queue_push (thread_events_queue, event_data);
-  g_main_context_wakeup (NULL);
+  thread_events_post (analyze_parsed_data, data);
 
   return NULL;
 }
 
 
+/* Run parser jobs on a pool of threads and wait till all of them
+ * complete.  If the pool cannot be created, run the jobs in the
+ * current thread.
+ */
+static void
+run_parsing_jobs (SgfParsingJob job, void **job_data, int num_jobs,
+		  void *runner_data)
+{
+  GThreadPool *thread_pool;
+  int k;
+
+  UNUSED (runner_data);
+
+  thread_pool = g_thread_pool_new (run_parsing_job, &job,
+				   MIN (num_jobs, NUM_PARSING_THREADS),
+				   FALSE, NULL);
+
+  for (k = 0; k < num_jobs; k++) {
+    if (thread_pool)
+      g_thread_pool_push (thread_pool, job_data[k], NULL);
+    else
+      job (job_data[k]);
+  }
+
+  if (thread_pool)
+    g_thread_pool_free (thread_pool, FALSE, TRUE);
+}
+
+
+static void
+run_parsing_job (gpointer job_data, gpointer job)
+{
+  (* (SgfParsingJob *) job) (job_data);
+}
+
+
 static gboolean
 update_progress_bar (GtkProgressDialog *progress_dialog,
 		     ParsingThreadData *data)
@@ -337,8 +485,12 @@ gtk_parse_sgf_file (const char *filename, GtkWindow *parent,
   gchar *absolute_filename;
   SgfCollection *sgf_collection;
   SgfErrorList *error_list;
+  SgfParserParameters parameters = sgf_parser_defaults;
+  off_t file_size;
   int result;
 
+  parameters.lazy_game_trees = 1;
+
   if (g_path_is_absolute (filename))
     absolute_filename = g_strdup (filename);
   else {
@@ -348,8 +500,9 @@ gtk_parse_sgf_file (const char *filename, GtkWindow *parent,
     g_free (current_directory);
   }
 
-  result = sgf_parse_file (absolute_filename, &sgf_collection, &error_list,
-			   &sgf_parser_defaults, NULL, NULL, NULL);
+  result = parse_sgf_file_or_snapshot (absolute_filename,
+				       &sgf_collection, &error_list,
+				       &parameters, &file_size, NULL, NULL);
 
   if (result == SGF_PARSED) {
     if (parent) {
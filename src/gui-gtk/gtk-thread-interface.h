@@ -59,8 +59,8 @@ struct _ParsingThreadData {
   SgfCollection	       *sgf_collection;
   SgfErrorList	       *error_list;
 
-  int			file_size;
-  int			bytes_parsed;
+  off_t			file_size;
+  off_t			bytes_parsed;
   int			cancellation_flag;
 
   int			result;
@@ -75,6 +75,19 @@ struct _ParsingThreadData {
 extern GAsyncQueue     *thread_events_queue;
 
 
+/* Game trees keep their nodes in memory pools and property values in
+ * reference counted arenas, and may reference a snapshot.  None of
+ * these is locked, reference counts included.  Therefore, once a
+ * worker thread posts its result, everything reachable from it
+ * (e.g. whole game trees with their pools and arenas) belongs to the
+ * main thread and the worker must not touch it anymore.  For the same
+ * reason, a worker must never share an arena or a snapshot with trees
+ * of other threads.
+ */
+void		thread_events_post (ThreadEventCallback callback,
+				    void *result);
+
+
 #endif /* THREADS_SUPPORTED */
 
 
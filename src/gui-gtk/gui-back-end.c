@@ -220,6 +220,23 @@ thread_events_dispatch (GSource *source, GSourceFunc callback,
 }
 
 
+/* Pass `result' of a worker thread to the main thread, where
+ * `callback' will be invoked with it.  See `gtk-thread-interface.h'
+ * for what the worker must not touch afterwards.
+ */
+void
+thread_events_post (ThreadEventCallback callback, void *result)
+{
+  ThreadEventData *event_data = g_malloc (sizeof (ThreadEventData));
+
+  event_data->callback = callback;
+  event_data->result   = result;
+
+  g_async_queue_push (thread_events_queue, event_data);
+  g_main_context_wakeup (NULL);
+}
+
+
 #endif /* THREADS_SUPPORTED */
 
 
@@ -65,6 +65,42 @@
 #include <memory.h>
 #endif
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#if HAVE_MMAP && HAVE_SYS_MMAN_H
+#include <sys/types.h>
+#include <sys/mman.h>
+#define USE_MMAP	1
+#else
+#define USE_MMAP	0
+#endif
+
+/* Files may be bigger than `long' can represent. */
+#if HAVE_FSEEKO
+#define FSEEK		fseeko
+#define FTELL		ftello
+#else
+#define FSEEK		fseek
+#define FTELL		ftell
+#endif
+
+/* Collections are parsed in parts only if POSIX threads are there to
+ * guard board tables (see `board-internals.h') and parsing progress.
+ */
+#if HAVE_PTHREAD_H && HAVE_PTHREAD_ONCE
+#include <pthread.h>
+#define USE_PTHREADS	1
+#else
+#define USE_PTHREADS	0
+#endif
+
 
 #define SGF_END			0
 
@@ -77,13 +113,91 @@
 #define ESCAPED_BRACKET		'\r'
 
 
+/* Collections are split into parts of at least this size for parsing
+ * with `run_jobs' (see SgfParserParameters), but never into more than
+ * MAX_COLLECTION_PARTS parts.
+ */
+#define MIN_COLLECTION_PART_SIZE	(256 * 1024)
+#define MAX_COLLECTION_PARTS		64
+
+/* Parts add their progress to the total in portions of at least this
+ * many bytes, to not contend for the lock too often.
+ */
+#define PART_PROGRESS_STEP		(64 * 1024)
+
+/* Longer texts are unlikely to repeat, so there is no point in
+ * interning them.
+ */
+#define MAX_INTERNED_TEXT_LENGTH	64
+
+
 typedef struct _BufferPositionStorage	BufferPositionStorage;
+typedef struct _SgfPartsProgress	SgfPartsProgress;
 
 struct _BufferPositionStorage {
   char		token;
   int		line;
-  int		column;
-  int		pending_column;
+  ptrdiff_t	line_start;
+  int		column_adjustment;
+  int		line_break_column;
+};
+
+
+/* Progress of parsing all parts of a collection, which are parsed
+ * concurrently.
+ */
+struct _SgfPartsProgress {
+  off_t			      *bytes_parsed;
+
+#if USE_PTHREADS
+  pthread_mutex_t	       lock;
+#endif
+};
+
+/* A part of buffer containing one or more complete game trees.  Parts
+ * always start at the beginning of a line.
+ */
+struct _SgfCollectionPart {
+  char			      *buffer;
+  size_t		       size;
+  int			       first_line;
+
+  const SgfParserParameters   *parameters;
+  const int		      *cancellation_flag;
+
+  SgfPartsProgress	      *progress;
+  off_t			       bytes_parsed;
+  off_t			       bytes_reported;
+
+  SgfSourceText		      *source_text;
+
+  SgfCollection		      *collection;
+  SgfErrorList		      *error_list;
+  int			       result;
+};
+
+/* Unchanged copy of the whole input, which lazily parsed game trees
+ * (see `lazy_game_trees' parser parameter) point into.  Parser
+ * overwrites its buffer, so this is a heap copy.  It is never a
+ * mapping of the file, since the file may be rewritten or truncated
+ * while the trees are alive.  Trees of all collection parts share it,
+ * hence the lock.
+ */
+struct _SgfSourceText {
+  int			       reference_count;
+
+#if USE_PTHREADS
+  pthread_mutex_t	       lock;
+#endif
+
+  char			      *text;
+  size_t		       size;
+
+  /* The beginning of parser buffer the text is a copy of. */
+  const char		      *buffer;
+
+  /* Parameters to parse remaining nodes of the trees with. */
+  SgfParserParameters	       parameters;
 };
 
 
@@ -92,25 +206,26 @@ struct _BufferPositionStorage {
     (data)->stored_buffer_pointers[index] = (data)->buffer_pointer;	\
     (storage).token			  = (data)->token;		\
     (storage).line			  = (data)->line;		\
-    (storage).column			  = (data)->column;		\
-    (storage).pending_column		  = (data)->pending_column;	\
+    (storage).line_start		  = (data)->line_start;		\
+    (storage).column_adjustment		  = (data)->column_adjustment;	\
+    (storage).line_break_column		  = (data)->line_break_column;	\
   } while (0)
 
 #define RESTORE_BUFFER_POSITION(data, index, storage)			\
   do {									\
-    (data)->buffer_pointer = (data)->stored_buffer_pointers[index];	\
-    (data)->token	   = (storage).token;				\
-    (data)->line	   = (storage).line;				\
-    (data)->column	   = (storage).column;				\
-    (data)->pending_column = (storage).pending_column;			\
+    (data)->buffer_pointer    = (data)->stored_buffer_pointers[index];	\
+    (data)->token	      = (storage).token;			\
+    (data)->line	      = (storage).line;				\
+    (data)->line_start	      = (storage).line_start;			\
+    (data)->column_adjustment = (storage).column_adjustment;		\
+    (data)->line_break_column = (storage).line_break_column;		\
   } while (0)
 
 
 #define STORE_ERROR_POSITION(data, storage)				\
   do {									\
-    (storage).line   = (data)->line;					\
-    (storage).column = (data)->column;					\
-    (storage).notch  = (data)->error_list->last;			\
+    get_position ((data), &(storage).line, &(storage).column);		\
+    (storage).notch = (data)->error_list->last;				\
   } while (0)
 
 
@@ -118,8 +233,52 @@ static int	    parse_buffer (SgfParsingData *data,
 				  SgfCollection **collection,
 				  SgfErrorList **error_list,
 				  const SgfParserParameters *parameters,
-				  int *bytes_parsed,
+				  off_t *bytes_parsed,
 				  const int *cancellation_flag);
+static int	    parse_buffer_in_parts (SgfParsingData *data,
+					   SgfCollectionPart *parts,
+					   int num_parts,
+					   SgfCollection **collection,
+					   SgfErrorList **error_list,
+					   off_t *bytes_parsed);
+static void	    parse_collection_part (void *part_data);
+static int	    split_collection (char *buffer, const char *buffer_end,
+				      const SgfParserParameters *parameters,
+				      const int *cancellation_flag,
+				      SgfCollectionPart *parts);
+static int	    do_parse_buffer (SgfParsingData *data,
+				     SgfCollection **collection,
+				     SgfErrorList **error_list,
+				     const SgfParserParameters *parameters,
+				     off_t *bytes_parsed,
+				     const int *cancellation_flag);
+static int	    load_file (SgfParsingData *data, const char *filename,
+			       const SgfParserParameters *parameters,
+			       off_t *file_size);
+static void	    unload_file (SgfParsingData *data);
+
+static int	    read_buffer (SgfParsingData *data,
+				 const SgfReaderCallbacks *callbacks,
+				 void *user_data, off_t *bytes_parsed,
+				 const int *cancellation_flag);
+static void	    read_property (SgfParsingData *data,
+				   const SgfReaderCallbacks *callbacks,
+				   void *user_data);
+
+static void	    validate_node_sequence (SgfParsingData *data,
+					    SgfNode *node);
+
+static SgfSourceText *
+		    create_source_text (SgfParsingData *data,
+					const SgfParserParameters *parameters);
+static SgfSourceText *
+		    new_source_text (char *text, size_t size,
+				     const SgfParserParameters *parameters);
+static void	    find_game_tree_end (SgfParsingData *data,
+					const char *tree_start,
+					int tree_start_line,
+					int tree_start_column);
+static void	    skip_to_game_tree_end (SgfParsingData *data);
 static int	    parse_root (SgfParsingData *data);
 static SgfNode *    parse_node_tree (SgfParsingData *data, SgfNode *parent);
 static void	    parse_node_sequence (SgfParsingData *data, SgfNode *node);
@@ -127,6 +286,11 @@ static void	    parse_property (SgfParsingData *data);
 
 static void	    refresh_buffer (SgfParsingData *data);
 static void	    expand_buffer (SgfParsingData *data);
+static ssize_t	    read_file_data (SgfParsingData *data,
+				    char *buffer, size_t size);
+inline static off_t get_bytes_parsed (const SgfParsingData *data);
+inline static void  update_bytes_parsed (SgfParsingData *data);
+static void	    report_part_progress (SgfCollectionPart *part);
 
 static int	    complete_node_and_update_board (SgfParsingData *data,
 						    int is_leaf_node);
@@ -148,9 +312,19 @@ inline static int   do_parse_color (SgfParsingData *data);
 
 static char *	    do_parse_simple_text (SgfParsingData *data,
 					  char extra_stop_character);
+static int	    read_simple_text (SgfParsingData *data,
+				      char extra_stop_character);
 static char *	    do_parse_text (SgfParsingData *data, char *existing_text);
+inline static void  copy_plain_text (SgfParsingData *data,
+				     char extra_stop_character);
+inline static int   scan_plain_text (const char *pointer, const char *end,
+				     char extra_stop_character);
+inline static int   text_needs_conversion (const SgfParsingData *data);
+inline static int   is_plain_ascii (const char *pointer, const char *end);
+static int	    char_set_extends_ascii (iconv_t char_set_to_utf8);
 static char *	    convert_text_to_utf8 (SgfParsingData *data,
 					  char *existing_text);
+static char *	    store_text_value (SgfParsingData *data, int intern);
 
 static int	    do_parse_point (SgfParsingData *data, BoardPoint *point);
 
@@ -200,34 +374,113 @@ inline static void  next_token (SgfParsingData *data);
 static void	    next_token_in_value (SgfParsingData *data);
 static void	    next_character (SgfParsingData *data);
 
+inline static void  get_position (const SgfParsingData *data,
+				  int *line, int *column);
+
 
 const SgfParserParameters sgf_parser_defaults = {
   4 * 1024 * 1024, 64 * 1024, 1024 * 1024,
-  0
+  0, 0, 0,
+  NULL, NULL
 };
 
 
 
-/* Read an SGF file and parse all game trees it contains.  If the
- * maximum buffer size specified in `parameters' is not enough to keep
- * the whole file in memory, this function sets up data required for
- * refreshing the buffer.
+/* Read an SGF file and parse all game trees it contains.  See
+ * load_file() for how the file is read.
  */
 int
 sgf_parse_file (const char *filename, SgfCollection **collection,
 		SgfErrorList **error_list,
 		const SgfParserParameters *parameters,
-		int *file_size, int *bytes_parsed,
+		off_t *file_size, off_t *bytes_parsed,
 		const int *cancellation_flag)
 {
+  SgfParsingData parsing_data;
   int result;
-  FILE *file;
 
   assert (filename);
   assert (collection);
   assert (error_list);
   assert (parameters);
 
+  *collection = NULL;
+  *error_list = NULL;
+
+  result = load_file (&parsing_data, filename, parameters, file_size);
+  if (result == SGF_PARSED) {
+    result = parse_buffer (&parsing_data, collection, error_list,
+			   parameters, bytes_parsed, cancellation_flag);
+    unload_file (&parsing_data);
+
+    if (*collection) {
+      (*collection)->source_file_size  = parsing_data.file_size;
+      (*collection)->source_file_mtime = parsing_data.file_modification_time;
+    }
+  }
+
+  return result;
+}
+
+
+/* Read an SGF file without building game trees, reporting its
+ * structure through `callbacks' instead.  The file is read the same
+ * way as by sgf_parse_file(), so memory usage doesn't depend on its
+ * size if it cannot be memory-mapped.
+ */
+int
+sgf_read_file (const char *filename,
+	       const SgfReaderCallbacks *callbacks, void *user_data,
+	       const SgfParserParameters *parameters,
+	       off_t *file_size, off_t *bytes_parsed,
+	       const int *cancellation_flag)
+{
+  SgfParsingData parsing_data;
+  int result;
+
+  assert (filename);
+  assert (callbacks);
+  assert (parameters);
+
+  result = load_file (&parsing_data, filename, parameters, file_size);
+  if (result == SGF_PARSED) {
+    result = read_buffer (&parsing_data, callbacks, user_data,
+			  bytes_parsed, cancellation_flag);
+    unload_file (&parsing_data);
+  }
+
+  return result;
+}
+
+
+/* Set up parsing data for reading given file.  Where possible, the
+ * file is memory-mapped and parsed in place.  Otherwise, if the
+ * maximum buffer size specified in `parameters' is not enough to keep
+ * the whole file in memory, this function sets up data required for
+ * refreshing the buffer.  Returns SGF_PARSED on success.
+ *
+ * Files compressed with gzip, xz or zstd are recognized by their
+ * first bytes and decompressed as they are read.  Since decompressed
+ * size is not known in advance, such files are always read into a
+ * buffer of the maximum size.  `file_size' is set to the compressed
+ * size then.
+ *
+ * Size and modification time of the file are taken from the opened
+ * file, so that they describe exactly what is parsed even if the
+ * file is replaced meanwhile.
+ */
+static int
+load_file (SgfParsingData *data, const char *filename,
+	   const SgfParserParameters *parameters, off_t *file_size)
+{
+  size_t max_buffer_size = ROUND_UP (parameters->max_buffer_size, 4 * 1024);
+  off_t local_file_size;
+  size_t buffer_size;
+  ssize_t bytes_read;
+  char *buffer;
+  char magic[COMPRESSION_MAGIC_LENGTH];
+  CompressionFormat compression;
+
   /* Buffer size parameters should be sane. */
   assert (parameters->max_buffer_size >= 512 * 1024);
   assert (parameters->buffer_size_increment >= 256 * 1024);
@@ -235,68 +488,162 @@ sgf_parse_file (const char *filename, SgfCollection **collection,
   assert (8 * parameters->buffer_refresh_margin
 	  <= parameters->max_buffer_size);
 
-  *collection = NULL;
-  *error_list = NULL;
-  result = SGF_ERROR_READING_FILE;
+  data->file = fopen (filename, "rb");
+  if (!data->file)
+    return SGF_ERROR_READING_FILE;
 
-  file = fopen (filename, "rb");
-  if (file) {
-    if (fseek (file, 0, SEEK_END) != -1) {
-      SgfParsingData parsing_data;
-      int max_buffer_size = ROUND_UP (parameters->max_buffer_size, 4 * 1024);
-      int local_file_size;
-      int buffer_size;
-      char *buffer;
-
-      local_file_size = ftell (file);
-      if (local_file_size == 0) {
-	fclose (file);
-	return SGF_INVALID_FILE;
-      }
+  if (FSEEK (data->file, 0, SEEK_END) == -1) {
+    fclose (data->file);
+    return SGF_ERROR_READING_FILE;
+  }
 
-      if (file_size)
-	*file_size = local_file_size;
+  local_file_size = FTELL (data->file);
+  if (local_file_size == -1) {
+    fclose (data->file);
+    return SGF_ERROR_READING_FILE;
+  }
 
-      rewind (file);
+  if (local_file_size == 0) {
+    fclose (data->file);
+    return SGF_INVALID_FILE;
+  }
 
-      if (local_file_size <= max_buffer_size)
-	buffer_size = local_file_size;
-      else
-	buffer_size = max_buffer_size;
+  if (file_size)
+    *file_size = local_file_size;
 
-      buffer = utils_malloc (buffer_size);
+  data->file_size	       = 0;
+  data->file_modification_time = 0;
 
-      if (fread (buffer, buffer_size, 1, file) == 1) {
-	parsing_data.buffer	 = buffer;
-	parsing_data.buffer_end	 = buffer + buffer_size;
-	parsing_data.buffer_size = buffer_size;
+#if HAVE_SYS_STAT_H
+  {
+    struct stat file_statistics;
 
-	parsing_data.file_bytes_remaining = local_file_size - buffer_size;
+    if (fstat (fileno (data->file), &file_statistics) == 0) {
+      data->file_size		   = file_statistics.st_size;
+      data->file_modification_time = file_statistics.st_mtime;
+    }
+  }
+#endif
 
-	if (local_file_size <= max_buffer_size)
-	  parsing_data.buffer_refresh_point = parsing_data.buffer_end;
-	else {
-	  parsing_data.buffer_size_increment
-	    = ROUND_UP (parameters->buffer_size_increment, 4 * 1024);
-	  parsing_data.buffer_refresh_margin
-	    = ROUND_UP (parameters->buffer_refresh_margin, 1024);
-	  parsing_data.buffer_refresh_point
-	    = parsing_data.buffer_end - parsing_data.buffer_refresh_margin;
-
-	  parsing_data.file = file;
-	}
+  rewind (data->file);
+  compression = compression_format_from_magic (magic,
+					       fread (magic, 1, sizeof magic,
+						      data->file));
+  rewind (data->file);
 
-	result = parse_buffer (&parsing_data, collection, error_list,
-			       parameters, bytes_parsed, cancellation_flag);
-      }
+  data->compressed_file = NULL;
 
-      utils_free (parsing_data.buffer);
+  if (compression != COMPRESSION_NONE) {
+    data->compressed_file = compressed_file_open_for_reading (data->file,
+							      compression);
+    if (!data->compressed_file) {
+      fclose (data->file);
+      return SGF_ERROR_READING_FILE;
     }
 
-    fclose (file);
+    data->compressed_bytes_read = 0;
   }
 
-  return result;
+#if USE_MMAP
+
+  /* The parser overwrites parts of the buffer (mostly near its
+   * beginning), so the mapping is private: only pages written to get
+   * copied.  Mapping fails for special files, which are then read as
+   * usually.  So are files that don't fit in address space at all.
+   */
+  if (compression == COMPRESSION_NONE
+      && (off_t) (size_t) local_file_size == local_file_size)
+    buffer = mmap (NULL, local_file_size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE, fileno (data->file), 0);
+  else
+    buffer = MAP_FAILED;
+
+  if (buffer != MAP_FAILED) {
+#if HAVE_MADVISE
+    madvise (buffer, local_file_size, MADV_SEQUENTIAL);
+#endif
+
+    data->buffer	       = buffer;
+    data->buffer_size	       = local_file_size;
+    data->buffer_is_mapped     = 1;
+    data->buffer_end	       = buffer + local_file_size;
+    data->buffer_refresh_point = data->buffer_end;
+    data->file_bytes_remaining = 0;
+
+    return SGF_PARSED;
+  }
+
+#endif /* USE_MMAP */
+
+  if (local_file_size <= (off_t) max_buffer_size
+      && compression == COMPRESSION_NONE)
+    buffer_size = local_file_size;
+  else
+    buffer_size = max_buffer_size;
+
+  buffer = utils_malloc (buffer_size);
+
+  bytes_read = read_file_data (data, buffer, buffer_size);
+  if (bytes_read <= 0) {
+    utils_free (buffer);
+    if (data->compressed_file)
+      compressed_file_close (data->compressed_file);
+
+    fclose (data->file);
+
+    return bytes_read == 0 ? SGF_INVALID_FILE : SGF_ERROR_READING_FILE;
+  }
+
+  if (compression == COMPRESSION_NONE)
+    data->file_bytes_remaining = local_file_size - (off_t) buffer_size;
+  else if ((size_t) bytes_read < buffer_size) {
+    /* The whole file is decompressed, don't waste memory. */
+    buffer		       = utils_realloc (buffer, bytes_read);
+    buffer_size		       = bytes_read;
+    data->file_bytes_remaining = 0;
+  }
+  else
+    data->file_bytes_remaining = OFF_T_MAX;
+
+  data->buffer		 = buffer;
+  data->buffer_size	 = buffer_size;
+  data->buffer_is_mapped = 0;
+  data->buffer_end	 = buffer + buffer_size;
+
+  if (data->file_bytes_remaining == 0)
+    data->buffer_refresh_point = data->buffer_end;
+  else {
+    data->buffer_size_increment
+      = ROUND_UP (parameters->buffer_size_increment, 4 * 1024);
+    data->buffer_refresh_margin
+      = ROUND_UP (parameters->buffer_refresh_margin, 1024);
+    data->buffer_refresh_point
+      = data->buffer_end - data->buffer_refresh_margin;
+  }
+
+  return SGF_PARSED;
+}
+
+
+/* Free the buffer set up by load_file() and close the file.  Note
+ * that the buffer might have been reallocated by expand_buffer().
+ */
+static void
+unload_file (SgfParsingData *data)
+{
+#if USE_MMAP
+  if (data->buffer_is_mapped)
+    munmap (data->buffer, data->buffer_size);
+  else
+    utils_free (data->buffer);
+#else
+  utils_free (data->buffer);
+#endif
+
+  if (data->compressed_file)
+    compressed_file_close (data->compressed_file);
+
+  fclose (data->file);
 }
 
 
@@ -307,132 +654,1049 @@ sgf_parse_file (const char *filename, SgfCollection **collection,
  * partially.
  */
 int
-sgf_parse_buffer (char *buffer, int size,
+sgf_parse_buffer (char *buffer, size_t size,
 		  SgfCollection **collection, SgfErrorList **error_list,
 		  const SgfParserParameters *parameters,
-		  int *bytes_parsed, const int *cancellation_flag)
+		  off_t *bytes_parsed, const int *cancellation_flag)
 {
   SgfParsingData parsing_data;
 
   assert (buffer);
-  assert (size >= 0);
   assert (collection);
   assert (error_list);
   assert (parameters);
 
   parsing_data.buffer = buffer;
+  parsing_data.buffer_is_mapped = 0;
   parsing_data.buffer_refresh_point = buffer + size;
   parsing_data.buffer_end = buffer + size;
 
   parsing_data.file_bytes_remaining = 0;
+  parsing_data.compressed_file	    = NULL;
 
   return parse_buffer (&parsing_data, collection, error_list, parameters,
 		       bytes_parsed, cancellation_flag);
 }
 
 
-
+/* Replay moves and setup of a tree on a board, checking for problems
+ * that the parser only finds if `skip_board_replay' parameter is not
+ * set.  Unlike the parser, this function doesn't change the tree, so
+ * it can be run in a separate thread as long as nothing else modifies
+ * the tree.  Returns list of the problems found or NULL if there are
+ * none.  Since positions in file are not known at this point, line
+ * and column of all errors are zero.
+ */
+SgfErrorList *
+sgf_game_tree_validate (SgfGameTree *tree)
+{
+  SgfParsingData parsing_data;
+
+  assert (tree);
+
+  if (!tree->root
+      || !GAME_IS_SUPPORTED (tree->game)
+      || tree->board_width < BOARD_MIN_WIDTH
+      || tree->board_width > BOARD_MAX_WIDTH
+      || tree->board_height < BOARD_MIN_HEIGHT
+      || tree->board_height > BOARD_MAX_HEIGHT)
+    return NULL;
+
+  parsing_data.tree	    = tree;
+  parsing_data.game	    = tree->game;
+  parsing_data.board_width  = tree->board_width;
+  parsing_data.board_height = tree->board_height;
+  parsing_data.board	    = board_new (tree->game, tree->board_width,
+					 tree->board_height);
+
+  /* There is no text, so all errors are reported at line 0, column
+   * 0 (see get_position().)
+   */
+  parsing_data.error_list	 = sgf_error_list_new ();
+  parsing_data.buffer		 = NULL;
+  parsing_data.buffer_pointer	 = NULL;
+  parsing_data.line		 = 1;
+  parsing_data.line_start	 = 0;
+  parsing_data.line_break_column = 0;
+  parsing_data.first_column	 = 0;
+  memset (parsing_data.times_error_reported, 0,
+	  sizeof parsing_data.times_error_reported);
+
+  validate_node_sequence (&parsing_data, tree->root);
+
+  board_delete (parsing_data.board);
+
+  if (string_list_is_empty (parsing_data.error_list)) {
+    string_list_delete (parsing_data.error_list);
+    return NULL;
+  }
+
+  return parsing_data.error_list;
+}
+
+
+/* Validate a sequence of nodes starting at `node' and, recursively,
+ * all its variations.  The board is restored before returning.
+ */
+static void
+validate_node_sequence (SgfParsingData *data, SgfNode *node)
+{
+  static const SgfType setup_property_types[NUM_ON_GRID_VALUES]
+    = { SGF_ADD_EMPTY, SGF_ADD_BLACK, SGF_ADD_WHITE, SGF_ADD_ARROWS };
+  int num_undos = 0;
+
+  for (; node; node = node->child) {
+    data->node = node;
+
+    if (node->move_color == SETUP_NODE) {
+      const BoardPositionList *position_lists[NUM_ON_GRID_VALUES];
+      int value;
+      int k;
+
+      for (value = 0; value < NUM_ON_GRID_VALUES; value++) {
+	data->property_type = setup_property_types[value];
+	position_lists[value]
+	  = sgf_node_get_list_of_point_property_value (node,
+						       data->property_type);
+	if (!position_lists[value])
+	  continue;
+
+	for (k = 0; k < position_lists[value]->num_positions; k++) {
+	  int pos = position_lists[value]->positions[k];
+
+	  if (data->board->grid[pos] == value) {
+	    add_error (data, SGF_WARNING_SETUP_HAS_NO_EFFECT,
+		       POSITION_X (pos), POSITION_Y (pos));
+	  }
+	}
+      }
+
+      board_apply_changes (data->board, position_lists);
+      num_undos++;
+    }
+    else if (IS_STONE (node->move_color)) {
+      if (data->game == GAME_AMAZONS
+	  && (data->board->grid[POINT_TO_POSITION (node->data.amazons.from)]
+	      != node->move_color)) {
+	add_error (data, SGF_ERROR_SENSELESS_MOVE,
+		   node->data.amazons.from.x, node->data.amazons.from.y);
+      }
+      else {
+	sgf_utils_play_node_move (node, data->board);
+	num_undos++;
+      }
+    }
+
+    if (node->child && node->child->next) {
+      SgfNode *variation;
+
+      for (variation = node->child; variation; variation = variation->next)
+	validate_node_sequence (data, variation);
+
+      break;
+    }
+  }
+
+  board_undo (data->board, num_undos);
+}
+
+
+/* Read SGF data in a buffer without building game trees, like
+ * sgf_read_file() does.  The data in buffer is overwritten.
+ */
+int
+sgf_read_buffer (char *buffer, size_t size,
+		 const SgfReaderCallbacks *callbacks, void *user_data,
+		 off_t *bytes_parsed, const int *cancellation_flag)
+{
+  SgfParsingData parsing_data;
+
+  assert (buffer);
+  assert (callbacks);
+
+  parsing_data.buffer		    = buffer;
+  parsing_data.buffer_refresh_point = buffer + size;
+  parsing_data.buffer_end	    = buffer + size;
+
+  parsing_data.file_bytes_remaining = 0;
+  parsing_data.compressed_file	    = NULL;
+
+  return read_buffer (&parsing_data, callbacks, user_data,
+		      bytes_parsed, cancellation_flag);
+}
+
+
+/* Parse all nodes of a game tree of which only the root has been
+ * parsed so far (see `lazy_game_trees' parser parameter), with the
+ * same parameters as the root.  The root node is parsed anew too, so
+ * its errors are reported again.  Trees loaded from snapshots are
+ * decoded the same way.  Return the list of errors found, with their
+ * positions in the original file, or NULL if there are none or the
+ * tree is parsed completely.
+ */
+SgfErrorList *
+sgf_parse_remaining_nodes (SgfGameTree *tree)
+{
+  SgfParsingData parsing_data;
+  SgfCollection *collection;
+  SgfErrorList *error_list;
+  char *buffer;
+
+  assert (tree);
+
+  if (tree->snapshot)
+    sgf_snapshot_decode_remaining_nodes (tree);
+
+  if (!tree->unparsed_text)
+    return NULL;
+
+  /* The source text is shared and the parser overwrites its buffer. */
+  buffer = utils_malloc (tree->unparsed_text_length);
+  memcpy (buffer, tree->unparsed_text, tree->unparsed_text_length);
+
+  parsing_data.buffer		    = buffer;
+  parsing_data.buffer_end	    = buffer + tree->unparsed_text_length;
+  parsing_data.buffer_refresh_point = parsing_data.buffer_end;
+  parsing_data.file_bytes_remaining = 0;
+  parsing_data.compressed_file	    = NULL;
+
+  parsing_data.collection_part	    = NULL;
+  parsing_data.source_text	    = NULL;
+
+  parsing_data.line		    = tree->unparsed_text_line;
+  parsing_data.column_adjustment    = tree->unparsed_text_column;
+
+  if (do_parse_buffer (&parsing_data, &collection, &error_list,
+		       &tree->source_text->parameters, NULL, NULL)
+      == SGF_PARSED) {
+    SgfGameTree *parsed_tree = collection->first_tree;
+
+    /* Text stored in a damaged snapshot might not match the tree.
+     * Then the tree is left with the root node only.
+     */
+    if (collection->num_trees == 1
+	&& parsed_tree->game == tree->game
+	&& parsed_tree->board_width == tree->board_width
+	&& parsed_tree->board_height == tree->board_height) {
+      collection->first_tree = NULL;
+      sgf_game_tree_replace_nodes (tree, parsed_tree);
+    }
+
+    sgf_collection_delete (collection);
+  }
+
+  utils_free (buffer);
+
+  sgf_source_text_unref (tree->source_text);
+  tree->source_text   = NULL;
+  tree->unparsed_text = NULL;
+
+  return error_list;
+}
+
+
+/* Set the tree's text to parse with sgf_parse_remaining_nodes().  The
+ * text is copied.  `line' and `column' are the position of the text
+ * in the file it comes from.
+ */
+void
+sgf_game_tree_set_unparsed_text (SgfGameTree *tree,
+				 const char *text, size_t length,
+				 int line, int column,
+				 const SgfParserParameters *parameters)
+{
+  char *copy = utils_malloc (length);
+
+  assert (tree);
+  assert (!tree->unparsed_text);
+
+  memcpy (copy, text, length);
+
+  tree->source_text	     = new_source_text (copy, length, parameters);
+  tree->unparsed_text	     = copy;
+  tree->unparsed_text_length = length;
+  tree->unparsed_text_line   = line;
+  tree->unparsed_text_column = column;
+}
+
+
+/* Drop a reference to the source text and free it if there are no
+ * references left.  May be called from any thread.
+ */
+void
+sgf_source_text_unref (SgfSourceText *source_text)
+{
+  int reference_count;
+
+  assert (source_text);
+
+#if USE_PTHREADS
+  pthread_mutex_lock (&source_text->lock);
+  reference_count = --source_text->reference_count;
+  pthread_mutex_unlock (&source_text->lock);
+#else
+  reference_count = --source_text->reference_count;
+#endif
+
+  assert (reference_count >= 0);
+  if (reference_count > 0)
+    return;
+
+#if USE_PTHREADS
+  pthread_mutex_destroy (&source_text->lock);
+#endif
+
+  utils_free (source_text->text);
+
+  utils_free (source_text);
+}
+
+
+
+/* Parse all game trees in the buffer.  If the whole input is in the
+ * buffer and the caller has provided a job runner, the buffer is split
+ * into parts parsed independently.
+ */
 static int
 parse_buffer (SgfParsingData *data,
 	      SgfCollection **collection, SgfErrorList **error_list,
 	      const SgfParserParameters *parameters,
-	      int *bytes_parsed, const int *cancellation_flag)
+	      off_t *bytes_parsed, const int *cancellation_flag)
 {
-  int dummy_bytes_parsed;
-  int dummy_cancellation_flag;
+  int num_parts = 0;
+  int result;
+
+  if (parameters->lazy_game_trees
+      && data->buffer_refresh_point == data->buffer_end)
+    data->source_text = create_source_text (data, parameters);
+  else
+    data->source_text = NULL;
+
+  if (USE_PTHREADS && parameters->run_jobs
+      && data->buffer_refresh_point == data->buffer_end) {
+    SgfCollectionPart parts[MAX_COLLECTION_PARTS];
+    int k;
+
+    num_parts = split_collection (data->buffer, data->buffer_end,
+				  parameters, cancellation_flag, parts);
+
+    if (num_parts > 1) {
+      for (k = 0; k < num_parts; k++)
+	parts[k].source_text = data->source_text;
+
+      result = parse_buffer_in_parts (data, parts, num_parts,
+				      collection, error_list, bytes_parsed);
+    }
+  }
+
+  if (num_parts <= 1) {
+    data->line		    = 1;
+    data->column_adjustment = 0;
+    data->collection_part   = NULL;
+
+    result = do_parse_buffer (data, collection, error_list, parameters,
+			      bytes_parsed, cancellation_flag);
+  }
+
+  /* Lazily parsed trees hold their own references. */
+  if (data->source_text)
+    sgf_source_text_unref (data->source_text);
+
+  return result;
+}
+
+
+/* Parse collection parts with the job runner and merge the results in
+ * order.  Error limits (MAX_TIMES_TO_REPORT_ERROR) are applied to
+ * each part separately.
+ */
+static int
+parse_buffer_in_parts (SgfParsingData *data,
+		       SgfCollectionPart *parts, int num_parts,
+		       SgfCollection **collection, SgfErrorList **error_list,
+		       off_t *bytes_parsed)
+{
+  const SgfParserParameters *parameters = parts[0].parameters;
+  void *job_data[MAX_COLLECTION_PARTS];
+  SgfPartsProgress progress;
+  off_t dummy_bytes_parsed;
+  int cancelled = 0;
+  int k;
+
+  progress.bytes_parsed = (bytes_parsed ? bytes_parsed : &dummy_bytes_parsed);
+  *progress.bytes_parsed = 0;
+
+#if USE_PTHREADS
+  pthread_mutex_init (&progress.lock, NULL);
+#endif
+
+  for (k = 0; k < num_parts; k++) {
+    parts[k].progress	    = &progress;
+    parts[k].bytes_reported = 0;
+    job_data[k]		    = parts + k;
+  }
+
+  parameters->run_jobs (parse_collection_part, job_data, num_parts,
+			parameters->run_jobs_data);
+
+#if USE_PTHREADS
+  pthread_mutex_destroy (&progress.lock);
+#endif
+
+  *collection = sgf_collection_new ();
+  *error_list = sgf_error_list_new ();
+
+  for (k = 0; k < num_parts; k++) {
+    SgfCollectionPart *part = parts + k;
+
+    if (part->result == SGF_PARSING_CANCELLED)
+      cancelled = 1;
+
+    if (part->collection) {
+      SgfGameTree *tree;
+
+      for (tree = part->collection->first_tree; tree;) {
+	SgfGameTree *next_tree = tree->next;
+
+	sgf_collection_add_game_tree (*collection, tree);
+	tree = next_tree;
+      }
+
+      part->collection->first_tree = NULL;
+      sgf_collection_delete (part->collection);
+    }
+
+    if (part->error_list) {
+      while (!string_list_is_empty (part->error_list)) {
+	string_list_add_ready_item
+	  (*error_list, string_list_steal_first_item (part->error_list));
+      }
+
+      string_list_delete (part->error_list);
+    }
+  }
+
+  *progress.bytes_parsed = data->buffer_end - data->buffer;
+
+  if (cancelled || (*collection)->num_trees == 0) {
+    string_list_delete (*error_list);
+    *error_list = NULL;
+
+    sgf_collection_delete (*collection);
+    *collection = NULL;
+
+    return cancelled ? SGF_PARSING_CANCELLED : SGF_INVALID_FILE;
+  }
+
+  if (string_list_is_empty (*error_list)) {
+    string_list_delete (*error_list);
+    *error_list = NULL;
+  }
+
+  return SGF_PARSED;
+}
+
+
+/* Parse one collection part.  This is the job given to job runner, so
+ * it may be run in any thread.
+ */
+static void
+parse_collection_part (void *part_data)
+{
+  SgfCollectionPart *part = (SgfCollectionPart *) part_data;
+  SgfParsingData parsing_data;
+
+  parsing_data.buffer		    = part->buffer;
+  parsing_data.buffer_end	    = part->buffer + part->size;
+  parsing_data.buffer_refresh_point = parsing_data.buffer_end;
+  parsing_data.file_bytes_remaining = 0;
+  parsing_data.compressed_file	    = NULL;
+
+  parsing_data.collection_part	    = part;
+  parsing_data.source_text	    = part->source_text;
+
+  /* Line numbers continue from the previous parts. */
+  parsing_data.line		    = part->first_line + 1;
+  parsing_data.column_adjustment    = 0;
+
+  part->result = do_parse_buffer (&parsing_data,
+				  &part->collection, &part->error_list,
+				  part->parameters, &part->bytes_parsed,
+				  part->cancellation_flag);
+  report_part_progress (part);
+}
+
+
+/* Split buffer into parts at line breaks between top-level game
+ * trees.  Return the number of parts, at most MAX_COLLECTION_PARTS.
+ * Lines are counted the same way next_character() does it, so that
+ * parts can report errors at proper positions.
+ */
+static int
+split_collection (char *buffer, const char *buffer_end,
+		  const SgfParserParameters *parameters,
+		  const int *cancellation_flag, SgfCollectionPart *parts)
+{
+  ptrdiff_t part_size = MAX ((buffer_end - buffer) / MAX_COLLECTION_PARTS,
+			     MIN_COLLECTION_PART_SIZE);
+  const char *pointer = buffer;
+  char *part_start = buffer;
+  int num_parts = 0;
+  int line = 0;
+  int part_first_line = 0;
+  int depth = 0;
+  int in_value = 0;
+  int k;
+
+  while (pointer < buffer_end) {
+    char character = *pointer++;
+
+    if (character == '\n' || character == '\r') {
+      if (pointer < buffer_end && character + *pointer == '\n' + '\r')
+	pointer++;
+
+      line++;
+
+      if (depth == 0 && !in_value
+	  && pointer - part_start >= part_size
+	  && num_parts < MAX_COLLECTION_PARTS - 1) {
+	parts[num_parts].buffer	    = part_start;
+	parts[num_parts].size	    = pointer - part_start;
+	parts[num_parts].first_line = part_first_line;
+	num_parts++;
+
+	part_start	= buffer + (pointer - buffer);
+	part_first_line = line;
+      }
+    }
+    else if (in_value) {
+      if (character == ']')
+	in_value = 0;
+      else if (character == '\\' && pointer < buffer_end
+	       && *pointer != '\n' && *pointer != '\r')
+	pointer++;
+    }
+    else if (character == '(')
+      depth++;
+    else if (depth > 0) {
+      if (character == ')')
+	depth--;
+      else if (character == '[')
+	in_value = 1;
+    }
+  }
+
+  if (part_start < buffer_end) {
+    parts[num_parts].buffer	= part_start;
+    parts[num_parts].size	= buffer_end - part_start;
+    parts[num_parts].first_line = part_first_line;
+    num_parts++;
+  }
+
+  for (k = 0; k < num_parts; k++) {
+    parts[k].parameters	       = parameters;
+    parts[k].cancellation_flag = cancellation_flag;
+  }
+
+  return num_parts;
+}
+
+
+static int
+do_parse_buffer (SgfParsingData *data,
+		 SgfCollection **collection, SgfErrorList **error_list,
+		 const SgfParserParameters *parameters,
+		 off_t *bytes_parsed, const int *cancellation_flag)
+{
+  off_t dummy_bytes_parsed;
+  int dummy_cancellation_flag;
+
+  assert (parameters->first_column == 0 || parameters->first_column == 1);
+
+  *collection = sgf_collection_new ();
+  *error_list = sgf_error_list_new ();
+
+  memset (data->times_error_reported, 0, sizeof data->times_error_reported);
+
+  data->buffer_pointer = data->buffer;
+
+  data->buffer_offset_in_file = 0;
+  if (bytes_parsed) {
+    *bytes_parsed = 0;
+    data->bytes_parsed = bytes_parsed;
+  }
+  else
+    data->bytes_parsed = &dummy_bytes_parsed;
+
+  data->file_error = 0;
+  data->cancelled  = 0;
+
+  if (cancellation_flag)
+    data->cancellation_flag = cancellation_flag;
+  else {
+    dummy_cancellation_flag = 0;
+    data->cancellation_flag = &dummy_cancellation_flag;
+  }
+
+  data->token = 0;
+
+  data->line_start			  = 0;
+  data->line_break_column		  = 0;
+  data->first_column			  = parameters->first_column;
+  data->ko_property_error_position.line	  = 0;
+  data->non_sgf_point_error_position.line = 0;
+  data->zero_byte_error_position.line	  = 0;
+
+  data->board = NULL;
+  data->error_list = *error_list;
+
+  data->game_tree_end = NULL;
+
+  data->skip_board_replay = parameters->skip_board_replay;
+
+  data->latin1_to_utf8 = iconv_open ("UTF-8", "ISO-8859-1");
+  assert (data->latin1_to_utf8 != (iconv_t) (-1));
+
+  data->value_arena = memory_arena_new ();
+
+  next_token (data);
+
+  do {
+    const char *tree_start;
+    int tree_start_line;
+    int tree_start_column;
+    int parse_result;
+
+    /* Skip any junk that might appear before game tree. */
+    if (data->token == '(') {
+      tree_start = data->buffer_pointer - 1;
+      get_position (data, &tree_start_line, &tree_start_column);
+      next_token (data);
+      if (data->token != ';')
+	continue;
+    }
+    else {
+      next_token (data);
+      continue;
+    }
+
+    /* Parse the tree. */
+    data->tree = sgf_game_tree_new ();
+    data->tree->value_arena = memory_arena_ref (data->value_arena);
+
+    if (data->source_text) {
+      find_game_tree_end (data, tree_start,
+			  tree_start_line, tree_start_column);
+    }
+
+    parse_result = parse_root (data);
+
+    if (data->game_tree_end) {
+      /* The tree consists of root node only, nothing to postpone. */
+      sgf_source_text_unref (data->tree->source_text);
+      data->tree->source_text	= NULL;
+      data->tree->unparsed_text = NULL;
+      data->game_tree_end	= NULL;
+    }
+
+    if (parse_result)
+      sgf_collection_add_game_tree (*collection, data->tree);
+    else
+      sgf_game_tree_delete (data->tree);
+
+    if (data->tree_char_set_to_utf8 != data->latin1_to_utf8
+	&& data->tree_char_set_to_utf8 != NULL)
+      iconv_close (data->tree_char_set_to_utf8);
+  } while (data->token != SGF_END);
+
+  if (data->board)
+    board_delete (data->board);
+
+  memory_arena_unref (data->value_arena);
+  iconv_close (data->latin1_to_utf8);
+
+  if (data->cancelled || (*collection)->num_trees == 0) {
+    string_list_delete (*error_list);
+    *error_list = NULL;
+
+    sgf_collection_delete (*collection);
+    *collection = NULL;
+
+    if (data->file_error)
+      return SGF_ERROR_READING_FILE;
+    else
+      return data->cancelled ? SGF_PARSING_CANCELLED : SGF_INVALID_FILE;
+  }
+
+  if (string_list_is_empty (*error_list)) {
+    string_list_delete (*error_list);
+    *error_list = NULL;
+  }
+
+  return SGF_PARSED;
+}
+
+
+/* Read all game trees in the buffer, calling `callbacks' for their
+ * elements.  Nothing is allocated, property values are written over
+ * the buffer.
+ */
+static int
+read_buffer (SgfParsingData *data,
+	     const SgfReaderCallbacks *callbacks, void *user_data,
+	     off_t *bytes_parsed, const int *cancellation_flag)
+{
+  SgfErrorList error_list = STATIC_SGF_ERROR_LIST;
+  off_t dummy_bytes_parsed;
+  int dummy_cancellation_flag;
+  int num_trees = 0;
+  int depth = 0;
+
+  data->buffer_pointer = data->buffer;
+
+  data->buffer_offset_in_file = 0;
+  if (bytes_parsed) {
+    *bytes_parsed = 0;
+    data->bytes_parsed = bytes_parsed;
+  }
+  else
+    data->bytes_parsed = &dummy_bytes_parsed;
+
+  data->collection_part = NULL;
+
+  data->file_error = 0;
+  data->cancelled  = 0;
+
+  if (cancellation_flag)
+    data->cancellation_flag = cancellation_flag;
+  else {
+    dummy_cancellation_flag = 0;
+    data->cancellation_flag = &dummy_cancellation_flag;
+  }
+
+  data->line			   = 1;
+  data->line_start		   = 0;
+  data->column_adjustment	   = 0;
+  data->line_break_column	   = 0;
+  data->zero_byte_error_position.line = 0;
+
+  /* Errors are not reported, but next_character() still needs a list
+   * to store error positions.
+   */
+  data->error_list = &error_list;
+
+  next_token (data);
+
+  while (data->token != SGF_END) {
+    if (data->token == '(') {
+      next_token (data);
+
+      /* Skip any junk that might appear before game tree. */
+      if (depth == 0 && data->token != ';')
+	continue;
+
+      if (depth++ == 0)
+	num_trees++;
+
+      if (callbacks->begin_game_tree)
+	callbacks->begin_game_tree (depth, user_data);
+    }
+    else if (depth == 0)
+      next_token (data);
+    else if (data->token == ')') {
+      if (callbacks->end_game_tree)
+	callbacks->end_game_tree (depth, user_data);
+
+      depth--;
+      next_token (data);
+    }
+    else if (data->token == ';') {
+      if (*data->cancellation_flag) {
+	data->cancelled = 1;
+	break;
+      }
+
+      update_bytes_parsed (data);
+
+      if (data->buffer_pointer > data->buffer_refresh_point)
+	refresh_buffer (data);
+
+      if (callbacks->begin_node)
+	callbacks->begin_node (user_data);
+
+      next_token (data);
+    }
+    else if (('A' <= data->token && data->token <= 'Z')
+	     || data->token == '[')
+      read_property (data, callbacks, user_data);
+    else
+      next_token (data);
+  }
+
+  update_bytes_parsed (data);
+
+  /* Close game trees cut by the end of file. */
+  for (; depth > 0 && !data->cancelled; depth--) {
+    if (callbacks->end_game_tree)
+      callbacks->end_game_tree (depth, user_data);
+  }
+
+  if (data->file_error)
+    return SGF_ERROR_READING_FILE;
+
+  if (data->cancelled)
+    return SGF_PARSING_CANCELLED;
+
+  return num_trees > 0 ? SGF_PARSED : SGF_INVALID_FILE;
+}
+
+
+/* Read a property identifier and all its values.  The identifier is
+ * written at the very beginning of the buffer followed by each value
+ * in turn.  Lower case letters in identifiers are ignored, like
+ * parse_property() does.  Values without an identifier are skipped.
+ */
+static void
+read_property (SgfParsingData *data,
+	       const SgfReaderCallbacks *callbacks, void *user_data)
+{
+  SgfType property_type = SGF_NUM_PROPERTIES;
+  int identifier_length;
+
+  data->temp_buffer = data->buffer;
+
+  while (data->token != '[') {
+    if ('A' <= data->token && data->token <= 'Z') {
+      if (property_type >= SGF_NUM_PROPERTIES) {
+	property_type = (property_tree[property_type - SGF_NUM_PROPERTIES]
+			 [1 + (data->token - 'A')]);
+      }
+      else
+	property_type = SGF_UNKNOWN;
+
+      *data->temp_buffer++ = data->token;
+      next_character (data);
+    }
+    else if ('a' <= data->token && data->token <= 'z')
+      next_character (data);
+    else if (data->token == ';' || data->token == '(' || data->token == ')'
+	     || data->token == SGF_END)
+      return;
+    else {
+      /* Junk or whitespace, start the identifier anew. */
+      property_type	= SGF_NUM_PROPERTIES;
+      data->temp_buffer = data->buffer;
+      next_token (data);
+    }
+  }
+
+  if (property_type >= SGF_NUM_PROPERTIES)
+    property_type = property_tree[property_type - SGF_NUM_PROPERTIES][0];
+
+  *data->temp_buffer++ = 0;
+  identifier_length = data->temp_buffer - data->buffer;
+
+  while (data->token == '[') {
+    next_character (data);
+
+    while (data->token != ']' && data->token != SGF_END) {
+      if (data->token != '\\') {
+	*data->temp_buffer++ = data->token;
+	copy_plain_text (data, SGF_END);
+      }
+      else {
+	next_character (data);
+	if (data->token != '\n')
+	  *data->temp_buffer++ = data->token;
+      }
+
+      next_character (data);
+    }
+
+    *data->temp_buffer = 0;
+
+    /* The buffer might have been reallocated by expand_buffer(). */
+    if (callbacks->property_value && identifier_length > 1) {
+      callbacks->property_value (property_type, data->buffer,
+				 data->buffer + identifier_length, user_data);
+    }
+
+    data->temp_buffer = data->buffer + identifier_length;
+    next_token (data);
+  }
+}
 
-  assert (parameters->first_column == 0 || parameters->first_column == 1);
 
-  *collection = sgf_collection_new ();
-  *error_list = sgf_error_list_new ();
+/* Create source text for lazily parsed game trees.  The whole input
+ * must be in the buffer and not yet overwritten.
+ */
+static SgfSourceText *
+create_source_text (SgfParsingData *data,
+		    const SgfParserParameters *parameters)
+{
+  size_t size = data->buffer_end - data->buffer;
+  SgfSourceText *source_text;
+  char *text = utils_malloc (size);
 
-  memset (data->times_error_reported, 0, sizeof data->times_error_reported);
+  memcpy (text, data->buffer, size);
 
-  data->buffer_pointer = data->buffer;
+  source_text	      = new_source_text (text, size, parameters);
+  source_text->buffer = data->buffer;
 
-  data->buffer_offset_in_file = 0;
-  if (bytes_parsed) {
-    *bytes_parsed = 0;
-    data->bytes_parsed = bytes_parsed;
-  }
-  else
-    data->bytes_parsed = &dummy_bytes_parsed;
+  return source_text;
+}
 
-  data->file_error = 0;
-  data->cancelled  = 0;
 
-  if (cancellation_flag)
-    data->cancellation_flag = cancellation_flag;
-  else {
-    dummy_cancellation_flag = 0;
-    data->cancellation_flag = &dummy_cancellation_flag;
-  }
+/* Create source text with one reference, taking ownership of `text'. */
+static SgfSourceText *
+new_source_text (char *text, size_t size,
+		 const SgfParserParameters *parameters)
+{
+  SgfSourceText *source_text = utils_malloc (sizeof (SgfSourceText));
 
-  data->token = 0;
+  source_text->reference_count = 1;
 
-  data->line				  = 0;
-  data->pending_column			  = 0;
-  data->first_column			  = parameters->first_column;
-  data->ko_property_error_position.line	  = 0;
-  data->non_sgf_point_error_position.line = 0;
-  data->zero_byte_error_position.line	  = 0;
+#if USE_PTHREADS
+  pthread_mutex_init (&source_text->lock, NULL);
+#endif
 
-  data->board = NULL;
-  data->error_list = *error_list;
+  source_text->text   = text;
+  source_text->size   = size;
+  source_text->buffer = NULL;
 
-  data->latin1_to_utf8 = iconv_open ("UTF-8", "ISO-8859-1");
-  assert (data->latin1_to_utf8 != (iconv_t) (-1));
+  source_text->parameters		  = *parameters;
+  source_text->parameters.lazy_game_trees = 0;
+  source_text->parameters.run_jobs	  = NULL;
 
-  next_token (data);
+  return source_text;
+}
 
-  do {
-    /* Skip any junk that might appear before game tree. */
-    if (data->token == '(') {
-      next_token (data);
-      if (data->token != ';')
-	continue;
-    }
-    else {
-      next_token (data);
+
+/* Find the end of the game tree that is being parsed, the same way
+ * next_character() would, and point the tree to its text in the
+ * source text.  Called right after the opening `(;' of the tree is
+ * read.  Irregular trees are left alone, so that they are parsed
+ * completely.
+ */
+static void
+find_game_tree_end (SgfParsingData *data, const char *tree_start,
+		    int tree_start_line, int tree_start_column)
+{
+  SgfSourceText *source_text = data->source_text;
+  SgfGameTree *tree = data->tree;
+  const char *pointer = data->buffer_pointer;
+  int line = data->line;
+  ptrdiff_t line_start = data->line_start;
+  int column_adjustment = data->column_adjustment;
+  int line_break_column = data->line_break_column;
+  int depth = 1;
+  int in_value = 0;
+  int escaped = 0;
+  char expected_token = 0;
+
+  while (pointer < data->buffer_end) {
+    char character = *pointer++;
+
+    if (character == '\n' || character == '\r') {
+      line_break_column = ((pointer - 1 - data->buffer) - line_start
+			   + column_adjustment);
+
+      if (pointer < data->buffer_end
+	  && character + *pointer == '\n' + '\r')
+	pointer++;
+
+      line++;
+      line_start	= pointer - data->buffer;
+      column_adjustment = 0;
+      escaped		= 0;
       continue;
     }
 
-    /* Parse the tree. */
-    data->tree = sgf_game_tree_new ();
-    if (parse_root (data))
-      sgf_collection_add_game_tree (*collection, data->tree);
-    else
-      sgf_game_tree_delete (data->tree);
-
-    if (data->tree_char_set_to_utf8 != data->latin1_to_utf8
-	&& data->tree_char_set_to_utf8 != NULL)
-      iconv_close (data->tree_char_set_to_utf8);
-  } while (data->token != SGF_END);
+    if (character == '\t') {
+      int column = ((pointer - 1 - data->buffer) - line_start
+		    + column_adjustment);
 
-  if (data->board)
-    board_delete (data->board);
+      column_adjustment += ROUND_UP (column + 1, 8) - (column + 1);
+    }
 
-  iconv_close (data->latin1_to_utf8);
+    if (escaped)
+      escaped = 0;
+    else if (in_value) {
+      if (character == ']')
+	in_value = 0;
+      else if (character == '\\')
+	escaped = 1;
+    }
+    else if (character == ' ' || character == '\t' || character == '\v'
+	     || character == '\f' || character == 0)
+      continue;
+    else {
+      /* The parser recovers from junk after variations or before the
+       * first node of a variation in a way not mimicked here.  Such
+       * trees are just parsed at once.
+       */
+      if (expected_token == ';' && character != ';')
+	return;
+      if (expected_token == '(' && character != '(' && character != ')')
+	return;
 
-  if (data->cancelled || (*collection)->num_trees == 0) {
-    string_list_delete (*error_list);
-    *error_list = NULL;
+      expected_token = 0;
 
-    sgf_collection_delete (*collection);
-    *collection = NULL;
+      if (character == '[')
+	in_value = 1;
+      else if (character == '(') {
+	depth++;
+	expected_token = ';';
+      }
+      else if (character == ')') {
+	if (--depth == 0)
+	  break;
 
-    if (data->file_error)
-      return SGF_ERROR_READING_FILE;
-    else
-      return data->cancelled ? SGF_PARSING_CANCELLED : SGF_INVALID_FILE;
+	expected_token = '(';
+      }
+    }
   }
 
-  if (string_list_is_empty (*error_list)) {
-    string_list_delete (*error_list);
-    *error_list = NULL;
-  }
+  data->game_tree_end			= pointer;
+  data->game_tree_end_line		= line;
+  data->game_tree_end_line_start	= line_start;
+  data->game_tree_end_column_adjustment = column_adjustment;
+  data->game_tree_end_line_break_column = line_break_column;
+  data->game_tree_end_token		= (depth == 0 ? ')' : SGF_END);
+
+  tree->unparsed_text	     = (source_text->text
+				+ (tree_start - source_text->buffer));
+  tree->unparsed_text_length = pointer - tree_start;
+  tree->unparsed_text_line   = tree_start_line;
+  tree->unparsed_text_column = tree_start_column;
+
+#if USE_PTHREADS
+  pthread_mutex_lock (&source_text->lock);
+  source_text->reference_count++;
+  pthread_mutex_unlock (&source_text->lock);
+#else
+  source_text->reference_count++;
+#endif
 
-  return SGF_PARSED;
+  tree->source_text = source_text;
+}
+
+
+/* Jump over the rest of a lazily parsed game tree.  Afterwards, the
+ * parser looks at the closing bracket of the tree, as if it parsed
+ * all the nodes.
+ */
+static void
+skip_to_game_tree_end (SgfParsingData *data)
+{
+  data->buffer_pointer	  = data->game_tree_end;
+  data->line		  = data->game_tree_end_line;
+  data->line_start	  = data->game_tree_end_line_start;
+  data->column_adjustment = data->game_tree_end_column_adjustment;
+  data->line_break_column = data->game_tree_end_line_break_column;
+  data->token		  = data->game_tree_end_token;
+
+  data->game_tree_end = NULL;
 }
 
 
@@ -447,7 +1711,8 @@ parse_root (SgfParsingData *data)
   SgfGameTree *tree = data->tree;
   BufferPositionStorage storage;
 
-  data->tree_char_set_to_utf8 = data->latin1_to_utf8;
+  data->tree_char_set_to_utf8	    = data->latin1_to_utf8;
+  data->tree_char_set_extends_ascii = 1;
 
   STORE_BUFFER_POSITION (data, 1, storage);
 
@@ -522,12 +1787,18 @@ parse_root (SgfParsingData *data)
 	utils_free (char_set_uppercased);
 
 	if (data->tree_char_set_to_utf8 != (iconv_t) (-1)) {
+	  if (data->tree_char_set_to_utf8) {
+	    data->tree_char_set_extends_ascii
+	      = char_set_extends_ascii (data->tree_char_set_to_utf8);
+	  }
+
 	  if (data->game && data->board_width)
 	    break;
 	}
 	else {
 	  data->tree_char_set_to_utf8 = data->latin1_to_utf8;
 	  utils_free (tree->char_set);
+	  tree->char_set = NULL;
 	}
       }
     }
@@ -677,8 +1948,7 @@ parse_node_sequence (SgfParsingData *data, SgfNode *node)
       data->buffer_refresh_point = data->buffer_end;
     }
 
-    *data->bytes_parsed = (data->buffer_offset_in_file
-			   + (data->buffer_pointer - data->buffer));
+    update_bytes_parsed (data);
 
     if (data->buffer_pointer > data->buffer_refresh_point)
       refresh_buffer (data);
@@ -694,6 +1964,12 @@ parse_node_sequence (SgfParsingData *data, SgfNode *node)
 						    && data->token != '('));
       node = data->node;
 
+      if (data->game_tree_end
+	  && (data->token == ';' || data->token == '(')) {
+	skip_to_game_tree_end (data);
+	break;
+      }
+
       if (data->token == ';') {
 	STORE_ERROR_POSITION (data, data->node_error_position);
 	next_token (data);
@@ -794,6 +2070,12 @@ parse_property (SgfParsingData *data)
       else {
 	SgfError error;
 
+	/* Value parsers add properties of `property_type' to the
+	 * current node.  Note it in advance, since a superfluous bit
+	 * in the mask is harmless.
+	 */
+	data->node->property_mask |= SGF_PROPERTY_MASK_BIT (property_type);
+
 	error = property_info[property_type].value_parser (data);
 	if (error > SGF_LAST_FATAL_ERROR) {
 	  if (SGF_FIRST_GAME_INFO_PROPERTY <= property_type
@@ -829,6 +2111,7 @@ parse_property (SgfParsingData *data)
 					   name_end - data->buffer, &link)) {
 	*link = sgf_property_new (data->tree, SGF_UNKNOWN, *link);
 	(*link)->value.unknown_value_list = string_list_new ();
+	data->node->property_mask |= SGF_PROPERTY_MASK_BIT (SGF_UNKNOWN);
 	string_list_add_from_buffer ((*link)->value.unknown_value_list,
 				     data->buffer, name_end - data->buffer);
       }
@@ -855,20 +2138,18 @@ parse_property (SgfParsingData *data)
 static void
 refresh_buffer (SgfParsingData *data)
 {
-  int unused_bytes = data->buffer_end - data->buffer_pointer;
-  int bytes_to_read = data->buffer_size - (unused_bytes + 1);
+  size_t unused_bytes = data->buffer_end - data->buffer_pointer;
+  size_t bytes_to_read = data->buffer_size - (unused_bytes + 1);
+  ssize_t bytes_read;
 
   memcpy (data->buffer + 1, data->buffer_pointer, unused_bytes);
 
-  if (data->file_bytes_remaining <= bytes_to_read) {
+  if (data->file_bytes_remaining < (off_t) bytes_to_read)
     bytes_to_read = data->file_bytes_remaining;
-    data->buffer_end = (data->buffer + 1) + unused_bytes + bytes_to_read;
-    data->buffer_refresh_point = data->buffer_end;
-  }
 
-  if (fread ((data->buffer + 1) + unused_bytes, bytes_to_read, 1,
-	     data->file)
-      != 1) {
+  bytes_read = read_file_data (data, (data->buffer + 1) + unused_bytes,
+			       bytes_to_read);
+  if (bytes_read == -1) {
     data->file_error	       = 1;
     data->cancelled	       = 1;
     data->buffer_end	       = data->buffer_pointer;
@@ -878,11 +2159,21 @@ refresh_buffer (SgfParsingData *data)
     return;
   }
 
+  /* Compressed files end when they end. */
+  if ((size_t) bytes_read < bytes_to_read)
+    data->file_bytes_remaining = bytes_read;
+
+  if (data->file_bytes_remaining == bytes_read) {
+    data->buffer_end = (data->buffer + 1) + unused_bytes + bytes_read;
+    data->buffer_refresh_point = data->buffer_end;
+  }
+
+  data->line_start	      -= data->buffer_pointer - (data->buffer + 1);
   data->buffer_pointer	       = data->buffer + 1;
-  data->file_bytes_remaining  -= bytes_to_read;
+  data->file_bytes_remaining  -= bytes_read;
   data->buffer_offset_in_file += data->buffer_size - (unused_bytes + 1);
-  *data->bytes_parsed	       = (data->buffer_offset_in_file
-				  + (data->buffer_pointer - data->buffer));
+
+  update_bytes_parsed (data);
 }
 
 
@@ -895,18 +2186,19 @@ static void
 expand_buffer (SgfParsingData *data)
 {
   const char *original_buffer = data->buffer;
-  int buffer_increase = data->buffer_size_increment;
+  size_t buffer_increase = data->buffer_size_increment;
+  ssize_t bytes_read;
 
-  if (data->file_bytes_remaining <= 2 * buffer_increase)
+  if (data->file_bytes_remaining <= 2 * (off_t) buffer_increase)
     buffer_increase = data->file_bytes_remaining;
 
   data->buffer = utils_realloc ((char *) data->buffer,
 				data->buffer_size + buffer_increase);
   data->buffer_pointer = data->buffer + data->buffer_size;
 
-  if (fread ((char *) data->buffer + data->buffer_size,
-	     buffer_increase, 1, data->file)
-      != 1) {
+  bytes_read = read_file_data (data, data->buffer + data->buffer_size,
+			       buffer_increase);
+  if (bytes_read == -1) {
     data->file_error	       = 1;
     data->cancelled	       = 1;
     data->buffer_end	       = data->buffer_pointer;
@@ -916,13 +2208,16 @@ expand_buffer (SgfParsingData *data)
     return;
   }
 
-  data->buffer_size		  += buffer_increase;
+  if ((size_t) bytes_read < buffer_increase)
+    data->file_bytes_remaining = bytes_read;
+
+  data->buffer_size		  += bytes_read;
   data->buffer_end		   = data->buffer + data->buffer_size;
   data->temp_buffer		  += data->buffer - original_buffer;
   data->stored_buffer_pointers[0] += data->buffer - original_buffer;
   data->stored_buffer_pointers[1] += data->buffer - original_buffer;
 
-  data->file_bytes_remaining -= buffer_increase;
+  data->file_bytes_remaining -= bytes_read;
   if (data->file_bytes_remaining > 0) {
     data->buffer_refresh_point = (data->buffer_end
 				  - data->buffer_refresh_margin);
@@ -930,8 +2225,87 @@ expand_buffer (SgfParsingData *data)
   else
     data->buffer_refresh_point = data->buffer_end;
 
-  *data->bytes_parsed = (data->buffer_offset_in_file
-			 + (data->buffer_pointer - data->buffer));
+  update_bytes_parsed (data);
+}
+
+
+/* Read `size' bytes from the file, decompressing them if needed.
+ * Returns the number of bytes read, which is less than `size' only
+ * at the end of a compressed file, or -1 on errors.
+ */
+static ssize_t
+read_file_data (SgfParsingData *data, char *buffer, size_t size)
+{
+  if (data->compressed_file) {
+    ssize_t bytes_read = compressed_file_read (data->compressed_file,
+					       buffer, size);
+
+    data->compressed_bytes_read = FTELL (data->file);
+    return bytes_read;
+  }
+
+  return fread (buffer, 1, size, data->file) == size ? (ssize_t) size : -1;
+}
+
+
+/* Get the number of file bytes parsed so far, for progress
+ * reporting.  For compressed files, it is estimated from the number
+ * of compressed bytes read and the compression ratio of the data
+ * decompressed so far, so that it never exceeds file size.
+ */
+inline static off_t
+get_bytes_parsed (const SgfParsingData *data)
+{
+  off_t bytes_parsed = (data->buffer_offset_in_file
+			+ (data->buffer_pointer - data->buffer));
+
+  if (data->compressed_file) {
+    off_t bytes_decompressed = (data->buffer_offset_in_file
+				+ (data->buffer_end - data->buffer));
+
+    return ((double) bytes_parsed * data->compressed_bytes_read
+	    / bytes_decompressed);
+  }
+
+  return bytes_parsed;
+}
+
+
+/* Store the number of bytes parsed so far.  Parts of a collection
+ * also add their progress to the total of all parts from time to
+ * time.
+ */
+inline static void
+update_bytes_parsed (SgfParsingData *data)
+{
+  *data->bytes_parsed = get_bytes_parsed (data);
+
+  if (data->collection_part
+      && (*data->bytes_parsed - data->collection_part->bytes_reported
+	  >= PART_PROGRESS_STEP))
+    report_part_progress (data->collection_part);
+}
+
+
+/* Add progress of a collection part since the last report to the
+ * total.  Parts are parsed concurrently, so the total is locked.
+ */
+static void
+report_part_progress (SgfCollectionPart *part)
+{
+  SgfPartsProgress *progress = part->progress;
+
+#if USE_PTHREADS
+  pthread_mutex_lock (&progress->lock);
+#endif
+
+  *progress->bytes_parsed += part->bytes_parsed - part->bytes_reported;
+
+#if USE_PTHREADS
+  pthread_mutex_unlock (&progress->lock);
+#endif
+
+  part->bytes_reported = part->bytes_parsed;
 }
 
 
@@ -967,7 +2341,8 @@ complete_node_and_update_board (SgfParsingData *data, int is_leaf_node)
     position_lists[SPECIAL_ON_GRID_VALUE] = NULL;
   }
 
-  if (has_setup_add_properties && data->use_board) {
+  if (has_setup_add_properties && data->use_board
+      && !data->skip_board_replay) {
     board_apply_changes (data->board,
 			 (const BoardPositionList **) position_lists);
     num_undos++;
@@ -978,6 +2353,7 @@ complete_node_and_update_board (SgfParsingData *data, int is_leaf_node)
    */
   if (data->game == GAME_AMAZONS
       && data->node->move_color != EMPTY
+      && !data->skip_board_replay
       && (data->board->grid[POINT_TO_POSITION (data->node->data.amazons.from)]
 	  != data->node->move_color)) {
     insert_error (data, SGF_ERROR_SENSELESS_MOVE,
@@ -1073,7 +2449,13 @@ complete_node_and_update_board (SgfParsingData *data, int is_leaf_node)
 			   data->board_territory_mark);
   }
 
-  if (IS_STONE (data->node->move_color) && !is_leaf_node && data->use_board) {
+  /* Drop mask bits noted by parse_property() for values that are not
+   * stored as properties (moves, failed values.)
+   */
+  sgf_node_update_property_mask (data->node);
+
+  if (IS_STONE (data->node->move_color) && !is_leaf_node && data->use_board
+      && !data->skip_board_replay) {
     sgf_utils_play_node_move (data->node, data->board);
     num_undos++;
   }
@@ -1505,6 +2887,18 @@ sgf_parse_color (SgfParsingData *data)
  */
 static char *
 do_parse_simple_text (SgfParsingData *data, char extra_stop_character)
+{
+  return (read_simple_text (data, extra_stop_character)
+	  ? convert_text_to_utf8 (data, NULL) : NULL);
+}
+
+
+/* Do the actual work for do_parse_simple_text().  Parsed text is left
+ * between `data->buffer' and `data->temp_buffer'.  Return zero if the
+ * value is empty.
+ */
+static int
+read_simple_text (SgfParsingData *data, char extra_stop_character)
 {
   data->temp_buffer = data->buffer;
 
@@ -1527,8 +2921,10 @@ do_parse_simple_text (SgfParsingData *data, char extra_stop_character)
       || (data->token != ']' && data->token != extra_stop_character
 	  && data->token != SGF_END)) {
     do {
-      if (data->token != '\\' && data->token != '\n')
+      if (data->token != '\\' && data->token != '\n') {
 	*data->temp_buffer++ = data->token;
+	copy_plain_text (data, extra_stop_character);
+      }
       else if (data->token == '\\') {
 	next_character (data);
 	if (data->token != '\n')
@@ -1545,10 +2941,10 @@ do_parse_simple_text (SgfParsingData *data, char extra_stop_character)
     while (*(data->temp_buffer - 1) == ' ')
       data->temp_buffer--;
 
-    return convert_text_to_utf8 (data, NULL);
+    return 1;
   }
 
-  return NULL;
+  return 0;
 }
 
 
@@ -1559,8 +2955,10 @@ do_parse_text (SgfParsingData *data, char *existing_text)
 
   data->temp_buffer = data->buffer;
   while (data->token != ']' && data->token != SGF_END) {
-    if (data->token != '\\')
+    if (data->token != '\\') {
       *data->temp_buffer++ = data->token;
+      copy_plain_text (data, SGF_END);
+    }
     else {
       next_character (data);
       if (data->token != '\n')
@@ -1585,13 +2983,172 @@ do_parse_text (SgfParsingData *data, char *existing_text)
 
   next_token (data);
 
-  if (existing_text)
-    existing_text = utils_cat_as_string (existing_text, "\n\n", 2);
+  if (!existing_text) {
+    return store_text_value (data, (data->temp_buffer - data->buffer
+				    <= MAX_INTERNED_TEXT_LENGTH));
+  }
+
+  /* Merged values cannot be stored in the arena, since they are
+   * reallocated with each new part.
+   */
+  if (memory_arena_owns (data->value_arena, existing_text))
+    existing_text = utils_duplicate_string (existing_text);
 
+  existing_text = utils_cat_as_string (existing_text, "\n\n", 2);
   return convert_text_to_utf8 (data, existing_text);
 }
 
 
+/* Copy all plain text characters that follow the current token to
+ * `data->temp_buffer' at once.  The current token is left unchanged,
+ * so the caller should go on with next_character() as usually.
+ */
+inline static void
+copy_plain_text (SgfParsingData *data, char extra_stop_character)
+{
+  int length = scan_plain_text (data->buffer_pointer, data->buffer_end,
+				extra_stop_character);
+
+  if (length > 0) {
+    memmove (data->temp_buffer, data->buffer_pointer, length);
+    data->temp_buffer	 += length;
+    data->buffer_pointer += length;
+  }
+}
+
+
+/* Return the number of characters at `pointer' that need no special
+ * handling in text values: anything but `]', `\', line breaks, zero
+ * bytes, other whitespace and `extra_stop_character'.  All characters
+ * below 14 are treated as special, since this covers all whitespace
+ * and zero byte at once.  With SSE2, 16 bytes are checked at a time.
+ */
+inline static int
+scan_plain_text (const char *pointer, const char *end,
+		 char extra_stop_character)
+{
+  const char *start = pointer;
+
+#ifdef __SSE2__
+
+  const __m128i control_limit = _mm_set1_epi8 (13);
+  const __m128i bracket	      = _mm_set1_epi8 (']');
+  const __m128i backslash     = _mm_set1_epi8 ('\\');
+  const __m128i extra	      = _mm_set1_epi8 (extra_stop_character);
+
+  while (end - pointer >= 16) {
+    __m128i block = _mm_loadu_si128 ((const __m128i *) pointer);
+    __m128i controls = _mm_cmpeq_epi8 (_mm_min_epu8 (block, control_limit),
+				       block);
+    __m128i escapes = _mm_or_si128 (_mm_cmpeq_epi8 (block, bracket),
+				    _mm_cmpeq_epi8 (block, backslash));
+    __m128i stops = _mm_or_si128 (_mm_or_si128 (controls, escapes),
+				  _mm_cmpeq_epi8 (block, extra));
+
+    if (_mm_movemask_epi8 (stops))
+      break;
+
+    pointer += 16;
+  }
+
+#endif /* __SSE2__ */
+
+  while (pointer < end
+	 && (unsigned char) *pointer >= 14
+	 && *pointer != ']' && *pointer != '\\'
+	 && *pointer != extra_stop_character)
+    pointer++;
+
+  return pointer - start;
+}
+
+
+/* Determine if text bounded by `data->buffer' and `data->temp_buffer'
+ * needs to be passed through iconv().  Text in UTF-8 doesn't, and
+ * neither does plain ASCII text in character sets that extend ASCII,
+ * which covers most values in most files.
+ */
+inline static int
+text_needs_conversion (const SgfParsingData *data)
+{
+  return (data->tree_char_set_to_utf8
+	  && !(data->tree_char_set_extends_ascii
+	       && is_plain_ascii (data->buffer, data->temp_buffer)));
+}
+
+
+/* Determine if all characters between `pointer' and `end' are
+ * printable ASCII characters or newlines.  Other control characters
+ * are not accepted, since they have special meaning in some character
+ * sets (e.g. escape sequences of ISO-2022 family.)  With SSE2, 16
+ * bytes are checked at a time.
+ */
+inline static int
+is_plain_ascii (const char *pointer, const char *end)
+{
+#ifdef __SSE2__
+
+  const __m128i last_control = _mm_set1_epi8 (0x1f);
+  const __m128i newline	     = _mm_set1_epi8 ('\n');
+
+  /* Bytes are compared as signed, so anything above 0x7f is below
+   * `last_control' too.
+   */
+  while (end - pointer >= 16) {
+    __m128i block = _mm_loadu_si128 ((const __m128i *) pointer);
+    __m128i plain = _mm_or_si128 (_mm_cmpgt_epi8 (block, last_control),
+				  _mm_cmpeq_epi8 (block, newline));
+
+    if (_mm_movemask_epi8 (plain) != 0xffff)
+      return 0;
+
+    pointer += 16;
+  }
+
+#endif /* __SSE2__ */
+
+  for (; pointer < end; pointer++) {
+    if ((*pointer < 0x20 || *pointer > 0x7f) && *pointer != '\n')
+      return 0;
+  }
+
+  return 1;
+}
+
+
+/* Determine if a character set, given by its converter to UTF-8,
+ * leaves printable ASCII characters and newlines unchanged, so that
+ * plain ASCII text need not be converted.  This is the case for
+ * nearly all character sets, but not e.g. for UTF-7 or HZ.
+ */
+static int
+char_set_extends_ascii (iconv_t char_set_to_utf8)
+{
+  char ascii_characters[0x80 - 0x20 + 1];
+  char utf8_buffer[sizeof ascii_characters];
+  char *original_text = ascii_characters;
+  size_t original_bytes_left = sizeof ascii_characters;
+  char *utf8_text = utf8_buffer;
+  size_t utf8_bytes_left = sizeof utf8_buffer;
+  int k;
+
+  for (k = 0; k < 0x80 - 0x20; k++)
+    ascii_characters[k] = 0x20 + k;
+
+  ascii_characters[k] = '\n';
+
+  iconv (char_set_to_utf8, &original_text, &original_bytes_left,
+	 &utf8_text, &utf8_bytes_left);
+
+  /* Reset the converter to its initial state. */
+  iconv (char_set_to_utf8, NULL, NULL, NULL, NULL);
+
+  return (original_bytes_left == 0 && utf8_bytes_left == 0
+	  && memcmp (ascii_characters, utf8_buffer,
+		     sizeof ascii_characters) == 0);
+}
+
+
 /* Convert text to UTF-8 encoding.  Text to be converted is bounded by
  * `data->buffer' and `data->temp_buffer' pointers.  Memory between
  * `data->temp_buffer' and `data->buffer_pointer' can be used as
@@ -1604,7 +3161,7 @@ do_parse_text (SgfParsingData *data, char *existing_text)
 static char *
 convert_text_to_utf8 (SgfParsingData *data, char *existing_text)
 {
-  if (data->tree_char_set_to_utf8) {
+  if (text_needs_conversion (data)) {
     char local_buffer[0x1000];
     char *original_text = data->buffer;
     size_t original_bytes_left = data->temp_buffer - data->buffer;
@@ -1635,13 +3192,63 @@ convert_text_to_utf8 (SgfParsingData *data, char *existing_text)
     return existing_text;
   }
   else {
-    /* The text is already in UTF-8, no conversion needed. */
+    /* The text is already in UTF-8 or is plain ASCII, no conversion
+     * needed.
+     */
     return utils_cat_as_string (existing_text, data->buffer,
 				data->temp_buffer - data->buffer);
   }
 }
 
 
+/* Store text bounded by `data->buffer' and `data->temp_buffer' in
+ * the value arena, converting it to UTF-8 as convert_text_to_utf8()
+ * does.  If `intern' is nonzero, the text is shared with all equal
+ * texts in the arena.  This is meant for property values only; other
+ * texts must be heap-allocated.
+ */
+static char *
+store_text_value (SgfParsingData *data, int intern)
+{
+  char local_buffer[0x1000];
+  char *text = data->buffer;
+  size_t length = data->temp_buffer - data->buffer;
+  char *converted_text = NULL;
+  char *value;
+
+  if (text_needs_conversion (data)) {
+    /* Four bytes per character is the UTF-8 maximum. */
+    if (length <= sizeof local_buffer / 4) {
+      char *utf8_text = local_buffer;
+      size_t utf8_bytes_left = sizeof local_buffer;
+
+      iconv (data->tree_char_set_to_utf8, &text, &length,
+	     &utf8_text, &utf8_bytes_left);
+
+      text   = local_buffer;
+      length = utf8_text - local_buffer;
+    }
+    else {
+      converted_text = convert_text_to_utf8 (data, NULL);
+      if (!converted_text)
+	return NULL;
+
+      text   = converted_text;
+      length = strlen (converted_text);
+    }
+  }
+
+  if (intern)
+    value = memory_arena_intern_as_string (data->value_arena, text, length);
+  else
+    value = memory_arena_duplicate_as_string (data->value_arena, text, length);
+
+  utils_free (converted_text);
+
+  return value;
+}
+
+
 /* Parse a simple text value, that is, a line of text. */
 SgfError
 sgf_parse_simple_text (SgfParsingData *data)
@@ -1652,7 +3259,8 @@ sgf_parse_simple_text (SgfParsingData *data)
   if (sgf_node_find_property (data->node, data->property_type, &link))
     return SGF_FATAL_DUPLICATE_PROPERTY;
 
-  text = do_parse_simple_text (data, SGF_END);
+  text = (read_simple_text (data, SGF_END)
+	  ? store_text_value (data, 1) : NULL);
   if (text) {
     next_token (data);
 
@@ -2758,7 +4366,9 @@ sgf_parse_setup_property (SgfParsingData *data)
 
   if (do_parse_list_of_point (data, data->changed_positions,
 			      data->board_change_mark, color,
-			      SGF_ERROR_DUPLICATE_SETUP, data->board->grid)) {
+			      SGF_ERROR_DUPLICATE_SETUP,
+			      (data->skip_board_replay
+			       ? NULL : data->board->grid))) {
     data->has_any_setup_property = 1;
     data->has_setup_add_properties[color] = 1;
   }
@@ -2966,8 +4576,9 @@ add_error (SgfParsingData *data, SgfError error, ...)
 
     string_list_add_ready (data->error_list,
 			   string_buffer_steal_string (&buffer));
-    data->error_list->last->line = data->line;
-    data->error_list->last->column = data->column + data->first_column;
+    get_position (data, &data->error_list->last->line,
+		  &data->error_list->last->column);
+    data->error_list->last->column += data->first_column;
 
     if (error != SGF_WARNING_ERROR_SUPPRESSED
 	&& ++data->times_error_reported[error] == MAX_TIMES_TO_REPORT_ERROR)
@@ -3027,7 +4638,8 @@ invalid_game_info_property (SgfParsingData *data, SgfProperty *property,
 			    BufferPositionStorage *storage)
 {
   RESTORE_BUFFER_POSITION (data, 0, *storage);
-  property->value.text = do_parse_simple_text (data, SGF_END);
+  property->value.text = (read_simple_text (data, SGF_END)
+			  ? store_text_value (data, 1) : NULL);
 
   RESTORE_BUFFER_POSITION (data, 0, *storage);
   next_character (data);
@@ -3282,7 +4894,9 @@ next_token_in_value (SgfParsingData *data)
  * allowed by SGF (LF, CR, CR LF, LF CR) are replaced with a single
  * '\n'.  All other whitespace characters ('\t', '\v' and '\f') are
  * converted to spaces.  The function also keeps track of the current
- * line and column in the buffer.
+ * line in the buffer.  Columns are only adjusted for characters that
+ * don't take exactly one column (tabs and zero bytes), since the rest
+ * is derived from the offset in get_position().
  */
 static void
 next_character (SgfParsingData *data)
@@ -3290,13 +4904,6 @@ next_character (SgfParsingData *data)
   if (data->buffer_pointer < data->buffer_end) {
     char token = *data->buffer_pointer++;
 
-    /* Update current line and column based on the _previous_
-     * character.  This way newlines appear at ends of lines.
-     */
-    data->column = data->pending_column;
-    if (data->column == 0)
-      data->line++;
-
     if (token != '\n' && token != '\r') {
       if (token == 0) {
 	if (!data->zero_byte_error_position.line) {
@@ -3306,24 +4913,29 @@ next_character (SgfParsingData *data)
 	  STORE_ERROR_POSITION (data, data->zero_byte_error_position);
 	}
 
+	/* The first zero byte takes no column, the rest take one
+	 * column each.
+	 */
+	data->column_adjustment--;
 	while (data->buffer_pointer < data->buffer_end
-	       && *data->buffer_pointer == 0) {
+	       && *data->buffer_pointer == 0)
 	  data->buffer_pointer++;
-	  data->pending_column++;
-	}
 
 	next_character (data);
 	return;
       }
 
       data->token = token;
-      data->pending_column++;
 
       /* SGF specification tells to handle '\t', '\v' and '\f' as a
        * space.  Also, '\t' updates column in a non-standard way.
        */
       if (token == '\t') {
-	data->pending_column = ROUND_UP (data->pending_column, 8);
+	int line;
+	int column;
+
+	get_position (data, &line, &column);
+	data->column_adjustment += ROUND_UP (column + 1, 8) - (column + 1);
 	data->token = ' ';
       }
 
@@ -3331,6 +4943,10 @@ next_character (SgfParsingData *data)
 	data->token = ' ';
     }
     else {
+      data->line_break_column = ((data->buffer_pointer - 1 - data->buffer)
+				 - data->line_start
+				 + data->column_adjustment);
+
       if (data->buffer_pointer == data->buffer_end
 	  && data->buffer_refresh_point < data->buffer_end)
 	expand_buffer (data);
@@ -3342,7 +4958,10 @@ next_character (SgfParsingData *data)
       }
 
       data->token = '\n';
-      data->pending_column = 0;
+
+      data->line++;
+      data->line_start	      = data->buffer_pointer - data->buffer;
+      data->column_adjustment = 0;
     }
   }
   else {
@@ -3356,6 +4975,27 @@ next_character (SgfParsingData *data)
 }
 
 
+/* Determine line and column of the current token.  A line break
+ * token is at the end of the line it terminates, so, if nothing has
+ * been read since the last line break, we are still on the previous
+ * line.
+ */
+inline static void
+get_position (const SgfParsingData *data, int *line, int *column)
+{
+  ptrdiff_t offset = data->buffer_pointer - data->buffer;
+
+  if (offset != data->line_start) {
+    *line   = data->line;
+    *column = offset - 1 - data->line_start + data->column_adjustment;
+  }
+  else {
+    *line   = data->line - 1;
+    *column = data->line_break_column;
+  }
+}
+
+
 /*
  * Local Variables:
  * tab-width: 8
@@ -31,14 +31,22 @@
 #include "quarry.h"
 
 #include <iconv.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 
 #define MAX_TIMES_TO_REPORT_ERROR	10
 
+/* Largest value of `off_t', which is a signed type of unknown size. */
+#define OFF_T_MAX							\
+  ((((off_t) 1 << (sizeof (off_t) * CHAR_BIT - 2)) - 1) * 2 + 1)
+
 
 typedef struct _SgfErrorPosition	SgfErrorPosition;
 typedef struct _SgfParsingData		SgfParsingData;
+typedef struct _SgfCollectionPart	SgfCollectionPart;
 
 struct _SgfErrorPosition {
   int		     line;
@@ -48,8 +56,9 @@ struct _SgfErrorPosition {
 
 struct _SgfParsingData {
   char		      *buffer;
-  int		       buffer_size;
-  int		       buffer_size_increment;
+  size_t	       buffer_size;
+  int		       buffer_is_mapped;
+  size_t	       buffer_size_increment;
   const char	      *buffer_pointer;
   const char	      *buffer_end;
   char		      *temp_buffer;
@@ -67,15 +76,35 @@ struct _SgfParsingData {
 
   iconv_t	       latin1_to_utf8;
   iconv_t	       tree_char_set_to_utf8;
+  int		       tree_char_set_extends_ascii;
 
   FILE		      *file;
-  int		       file_bytes_remaining;
-  int		       buffer_offset_in_file;
-  int		      *bytes_parsed;
-
+  off_t		       file_bytes_remaining;
+
+  /* Size and modification time of the file when it was opened. */
+  off_t		       file_size;
+  time_t	       file_modification_time;
+  off_t		       buffer_offset_in_file;
+  off_t		      *bytes_parsed;
+
+  /* Set when parsing a part of a collection.  See `sgf-parser.c'. */
+  SgfCollectionPart   *collection_part;
+
+  /* For compressed files, `file_bytes_remaining' is unknown and set
+   * to OFF_T_MAX until the end of file is reached.
+   */
+  CompressedFile      *compressed_file;
+  off_t		       compressed_bytes_read;
+
+  /* Only line breaks update these fields.  Column of the current
+   * token is derived from its offset when needed, see get_position()
+   * in `sgf-parser.c'.  `line_start' is the offset of current line
+   * from the buffer beginning.
+   */
   int		       line;
-  int		       column;
-  int		       pending_column;
+  ptrdiff_t	       line_start;
+  int		       column_adjustment;
+  int		       line_break_column;
   int		       first_column;
 
   int		       in_parse_root;
@@ -90,11 +119,22 @@ struct _SgfParsingData {
   int		       board_width;
   int		       board_height;
   int		       use_board;
+  int		       skip_board_replay;
   Board		      *board;
 
   SgfNode	      *game_info_node;
 
+  /* Set if game trees are parsed lazily.  See `sgf-parser.c'. */
+  SgfSourceText	      *source_text;
+  const char	      *game_tree_end;
+  int		       game_tree_end_line;
+  ptrdiff_t	       game_tree_end_line_start;
+  int		       game_tree_end_column_adjustment;
+  int		       game_tree_end_line_break_column;
+  char		       game_tree_end_token;
+
   SgfGameTree	      *tree;
+  MemoryArena	      *value_arena;
   SgfNode	      *node;
   SgfType	       property_type;
 
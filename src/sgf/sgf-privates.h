@@ -74,15 +74,44 @@ struct _SgfPropertyInfo {
 extern const SgfPropertyInfo	property_info[];
 
 
-/* Defined in `sgf-tree.c' and is only used from `sgf-utils.c'. */
+/* Defined in `sgf-tree.c' and is used from `sgf-utils.c' and
+ * `sgf-undo.c'.
+ */
 void		sgf_property_free_value (SgfValueType value_type,
-					 SgfValue *value);
+					 SgfValue *value, SgfGameTree *tree);
+
+/* Defined in `sgf-tree.c' and used from `sgf-parser.c' and
+ * `sgf-undo.c'.
+ */
+void		sgf_node_update_property_mask (SgfNode *node);
+
+/* Defined in `sgf-tree.c' and is only used from `sgf-parser.c'. */
+void		sgf_game_tree_replace_nodes (SgfGameTree *tree,
+					     SgfGameTree *donor_tree);
+
+/* Defined in `sgf-parser.c' and used from `sgf-snapshot.c' and
+ * `sgf-tree.c'.
+ */
+void		sgf_game_tree_set_unparsed_text
+		  (SgfGameTree *tree, const char *text, size_t length,
+		   int line, int column,
+		   const SgfParserParameters *parameters);
+void		sgf_source_text_unref (SgfSourceText *source_text);
+
+/* Defined in `sgf-snapshot.c' and used from `sgf-parser.c' and
+ * `sgf-tree.c'.
+ */
+void		sgf_snapshot_decode_remaining_nodes (SgfGameTree *tree);
+void		sgf_snapshot_release (SgfGameTree *tree);
 
 /* Defined in `sgf-utils.c', but also used from `sgf-undo.c'. */
 inline void	sgf_utils_do_switch_to_given_node (SgfGameTree *tree,
 						   SgfNode *node);
 void		sgf_utils_descend_nodes (SgfGameTree *tree, int num_nodes);
 void		sgf_utils_ascend_nodes (SgfGameTree *tree, int num_nodes);
+void		sgf_utils_forget_board_checkpoints (SgfGameTree *tree);
+void		sgf_utils_forget_board_checkpoints_below
+		  (SgfGameTree *tree, const SgfNode *node);
 
 
 #endif /* QUARRY_SGF_PRIVATES_H */
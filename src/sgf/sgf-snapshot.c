@@ -0,0 +1,1366 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+ * This file is part of Quarry.                                    *
+ *                                                                 *
+ * Copyright (C) 2003, 2004, 2005, 2006 Paul Pogonyshev.           *
+ *                                                                 *
+ * This program is free software; you can redistribute it and/or   *
+ * modify it under the terms of the GNU General Public License as  *
+ * published by the Free Software Foundation; either version 2 of  *
+ * the License, or (at your option) any later version.             *
+ *                                                                 *
+ * This program is distributed in the hope that it will be useful, *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of  *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the   *
+ * GNU General Public License for more details.                    *
+ *                                                                 *
+ * You should have received a copy of the GNU General Public       *
+ * License along with this program; if not, write to the Free      *
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,     *
+ * Boston, MA 02110-1301, USA.                                     *
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Snapshots are binary images of parsed SGF collections.  Loading a
+ * snapshot is much faster than parsing SGF: there is no tokenizing,
+ * no character set conversion and no validation, all values are
+ * stored exactly as they are in memory.  Snapshots are meant to be
+ * used as a cache of large SGF files and so they remember size and
+ * modification time of the file they were made of.
+ *
+ * A snapshot consists of 32-bit words in native byte order.  All
+ * references are offsets from the beginning of the file, so it is
+ * simply mapped in memory when loaded.  Only root nodes are decoded
+ * at load time, the rest of each tree is decoded when the tree is
+ * entered (see sgf_parse_remaining_nodes()).
+ *
+ * Game trees that have not been fully parsed when the snapshot is
+ * written (see `lazy_game_trees' parser parameter) are stored as the
+ * root node plus the unparsed SGF text of the tree.  Thus a snapshot
+ * can be written right after a lazy parse without parsing the whole
+ * collection.
+ */
+
+
+#include "sgf.h"
+#include "sgf-privates.h"
+#include "board.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <iconv.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HAVE_SYS_STAT_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if HAVE_MMAP && HAVE_SYS_MMAN_H
+#include <sys/types.h>
+#include <sys/mman.h>
+#define USE_MMAP	1
+#else
+#define USE_MMAP	0
+#endif
+
+
+#define SNAPSHOT_MAGIC			"Quarry snapshot\n"
+#define SNAPSHOT_MAGIC_LENGTH		16
+#define SNAPSHOT_FORMAT_VERSION		2
+#define SNAPSHOT_BYTE_ORDER_MARK	0x01020304
+
+#define MAX_INTERNED_TEXT_LENGTH	64
+
+/* Fields of the second word of a node record. */
+#define NODE_MOVE_COLOR_MASK		0x03
+#define NODE_TO_PLAY_COLOR_SHIFT	2
+#define NODE_TO_PLAY_COLOR_MASK		0x0C
+#define NODE_IS_COLLAPSED		0x10
+#define NODE_IS_CURRENT_VARIATION	0x20
+#define NODE_NUM_PROPERTIES_SHIFT	8
+
+/* First word of figure description values. */
+#define FIGURE_IS_EMPTY			0
+#define FIGURE_HAS_NO_DIAGRAM_NAME	1
+#define FIGURE_HAS_DIAGRAM_NAME		2
+
+#define PACK_POINT(point)						\
+  (((unsigned char) (point).x) | ((unsigned char) (point).y) << 8)
+
+#define UNPACK_POINT(point, word)					\
+  do {									\
+    (point).x = (signed char) ((word) & 0xFF);				\
+    (point).y = (signed char) (((word) >> 8) & 0xFF);			\
+  } while (0)
+
+#define POINT_IS_ON_GRID(tree, point)					\
+  ON_SIZED_GRID ((tree)->board_width, (tree)->board_height,		\
+		 (point).x, (point).y)
+
+#define MOVE_POINT_IS_VALID(tree, point)				\
+  (POINT_IS_ON_GRID ((tree), (point))					\
+   || IS_NULL_POINT ((point).x, (point).y))
+
+#define POSITION_IS_ON_GRID(tree, pos)					\
+  ((unsigned int) (pos) < BOARD_GRID_SIZE				\
+   && ON_SIZED_GRID ((tree)->board_width, (tree)->board_height,	\
+		     POSITION_X (pos), POSITION_Y (pos)))
+
+/* Number of words taken by a string of given length, including the
+ * length word and the terminating zero.
+ */
+#define STRING_NUM_WORDS(length)					\
+  (1 + ((length) + 1 + sizeof (unsigned int) - 1) / sizeof (unsigned int))
+
+#define STRING_OFFSET_IS_VALID(header, offset)				\
+  ((offset) % sizeof (unsigned int) == 0				\
+   && (offset) < (header)->trees_offset)
+
+#define WORDS_AT(snapshot, offset)					\
+  ((snapshot)->data + (offset) / sizeof (unsigned int))
+
+#define SNAPSHOT_END(snapshot)						\
+  WORDS_AT ((snapshot), (snapshot)->size)
+
+#define SNAPSHOT_TREES(snapshot)					\
+  ((const SnapshotTree *)						\
+   WORDS_AT ((snapshot),						\
+	     ((const SnapshotHeader *) (snapshot)->data)->trees_offset))
+
+
+typedef struct _SnapshotHeader		SnapshotHeader;
+typedef struct _SnapshotTree		SnapshotTree;
+typedef struct _SnapshotWritingData	SnapshotWritingData;
+
+struct _SnapshotHeader {
+  char			  magic[SNAPSHOT_MAGIC_LENGTH];
+  unsigned int		  format_version;
+  unsigned int		  byte_order_mark;
+
+  /* Property types are stored as is, so their numbering must match. */
+  unsigned int		  num_property_types;
+
+  unsigned int		  file_size;
+
+  /* Size and modification time of the SGF file the snapshot was made
+   * of, split into 32-bit halves.  All zeros if there was no file.
+   */
+  unsigned int		  source_size[2];
+  unsigned int		  source_mtime[2];
+
+  unsigned int		  num_trees;
+  unsigned int		  trees_offset;
+};
+
+/* Strings are stored as a length word followed by the characters and
+ * a terminating zero, padded to a word boundary.  String offsets are
+ * zero for NULL strings.
+ */
+struct _SnapshotTree {
+  unsigned int		  game;
+  unsigned int		  board_width;
+  unsigned int		  board_height;
+
+  unsigned int		  file_format;
+  unsigned int		  style_is_set;
+  unsigned int		  style;
+
+  unsigned int		  char_set;
+  unsigned int		  application_name;
+  unsigned int		  application_version;
+
+  /* Node records in preorder, starting with the root. */
+  unsigned int		  nodes_offset;
+  unsigned int		  nodes_end;
+  unsigned int		  num_nodes;
+
+  /* If non-zero, only the root node is stored in node records and
+   * this is the full SGF text of the tree.  Its position in the SGF
+   * file follows.
+   */
+  unsigned int		  unparsed_text;
+  unsigned int		  unparsed_text_line;
+  unsigned int		  unparsed_text_column;
+};
+
+struct _SgfSnapshot {
+  int			  reference_count;
+
+  unsigned int		 *data;
+  int			  size;
+  int			  is_mapped;
+
+  /* Parameters to parse unparsed SGF text of trees with. */
+  SgfParserParameters	  parameters;
+};
+
+struct _SnapshotWritingData {
+  FILE			 *file;
+  unsigned long		  offset;
+
+  int			 *parent_indices;
+  int			  parent_indices_size;
+};
+
+
+static int	    get_source_key (const char *source_filename,
+				    unsigned int source_size[2],
+				    unsigned int source_mtime[2]);
+static void	    encode_source_key (off_t size, time_t mtime,
+				       unsigned int source_size[2],
+				       unsigned int source_mtime[2]);
+static FILE *	    create_temporary_file (const char *filename,
+					   char **temporary_filename);
+
+static void	    write_tree (SnapshotWritingData *data, SgfGameTree *tree,
+				SnapshotTree *record);
+static void	    write_node (SnapshotWritingData *data,
+				const SgfGameTree *tree, const SgfNode *node,
+				int parent_index);
+static void	    write_value (SnapshotWritingData *data,
+				 SgfValueType value_type,
+				 const SgfValue *value);
+static unsigned int write_string (SnapshotWritingData *data,
+				  const char *string, int length);
+inline static void  write_word (SnapshotWritingData *data, unsigned int word);
+
+static SgfSnapshot *
+		    open_snapshot (const char *filename);
+static void	    unref_snapshot (SgfSnapshot *snapshot);
+static int	    check_snapshot (const SgfSnapshot *snapshot,
+				    const char *source_filename);
+
+static SgfGameTree *
+		    load_tree (SgfSnapshot *snapshot, int tree_index,
+			       MemoryArena *value_arena,
+			       const char **known_char_set);
+static int	    decode_nodes (const SgfSnapshot *snapshot,
+				  const SnapshotTree *record, int num_nodes,
+				  SgfGameTree *tree);
+static int	    decode_value (const unsigned int **pointer,
+				  const unsigned int *end,
+				  SgfValueType value_type, SgfValue *value,
+				  const SgfGameTree *tree);
+static const char * decode_string (const unsigned int **pointer,
+				   const unsigned int *end, int *length);
+static char *	    get_string (const SgfSnapshot *snapshot,
+				unsigned int offset);
+
+
+
+/* Write a snapshot of the `collection' to given file.  If
+ * `source_filename' is not NULL, it must be the file the collection
+ * has been parsed from and the snapshot is tied to the state of that
+ * file at parsing time, see sgf_load_snapshot().  If the file has
+ * changed since, no snapshot is written.  Game trees that are not
+ * fully parsed are written as SGF text and remain so.
+ *
+ * The snapshot is written to a temporary file which then replaces
+ * `filename'.  An existing snapshot may be mapped in memory, by this
+ * or another process, and even be the source of `collection' trees,
+ * so it must never be truncated or overwritten in place.
+ *
+ * Return NULL on success or a dynamically allocated error string.
+ */
+char *
+sgf_write_snapshot (const char *filename, SgfCollection *collection,
+		    const char *source_filename)
+{
+  SnapshotWritingData data;
+  SnapshotHeader header;
+  SnapshotTree *records;
+  SgfGameTree *tree;
+  char *temporary_filename;
+  int num_trees;
+  int error_number = 0;
+
+  assert (filename);
+  assert (collection);
+
+  memset (&header, 0, sizeof header);
+  if (source_filename) {
+    unsigned int source_size[2];
+    unsigned int source_mtime[2];
+
+    if (!get_source_key (source_filename, source_size, source_mtime))
+      return utils_duplicate_string (strerror (errno));
+
+    encode_source_key (collection->source_file_size,
+		       collection->source_file_mtime,
+		       header.source_size, header.source_mtime);
+
+    if (collection->source_file_size == 0
+	|| memcmp (source_size, header.source_size, sizeof source_size) != 0
+	|| memcmp (source_mtime, header.source_mtime,
+		   sizeof source_mtime) != 0)
+      return utils_duplicate_string ("source file has changed");
+  }
+
+  data.file = create_temporary_file (filename, &temporary_filename);
+  if (!data.file) {
+    error_number = errno;
+    utils_free (temporary_filename);
+    return utils_duplicate_string (strerror (error_number));
+  }
+
+  /* The header is written again when all offsets are known. */
+  fwrite (&header, sizeof header, 1, data.file);
+  data.offset = sizeof header;
+
+  data.parent_indices	   = NULL;
+  data.parent_indices_size = 0;
+
+  records = utils_malloc (collection->num_trees * sizeof (SnapshotTree));
+
+  for (tree = collection->first_tree, num_trees = 0; tree;
+       tree = tree->next, num_trees++)
+    write_tree (&data, tree, records + num_trees);
+
+  header.trees_offset = data.offset;
+  fwrite (records, sizeof (SnapshotTree), num_trees, data.file);
+  data.offset += num_trees * sizeof (SnapshotTree);
+
+  memcpy (header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH);
+  header.format_version	    = SNAPSHOT_FORMAT_VERSION;
+  header.byte_order_mark    = SNAPSHOT_BYTE_ORDER_MARK;
+  header.num_property_types = SGF_NUM_PROPERTIES;
+  header.file_size	    = data.offset;
+  header.num_trees	    = num_trees;
+
+  if (fseek (data.file, 0, SEEK_SET) == 0)
+    fwrite (&header, sizeof header, 1, data.file);
+
+  if (ferror (data.file))
+    error_number = errno;
+  else if (data.offset != header.file_size)
+    error_number = EFBIG;
+
+  if (fclose (data.file) != 0 && !error_number)
+    error_number = errno;
+
+  if (!error_number && rename (temporary_filename, filename) != 0)
+    error_number = errno;
+
+  utils_free (records);
+  utils_free (data.parent_indices);
+
+  if (error_number) {
+    remove (temporary_filename);
+    utils_free (temporary_filename);
+    return utils_duplicate_string (strerror (error_number));
+  }
+
+  utils_free (temporary_filename);
+  return NULL;
+}
+
+
+/* Load a snapshot written with sgf_write_snapshot().  If
+ * `source_filename' is not NULL, the snapshot is only loaded if it
+ * has been made of that file and the file has not been changed since.
+ * Trees stored as SGF text are parsed with given `parameters' when
+ * entered.
+ *
+ * Return SGF_PARSED on success, SGF_ERROR_READING_FILE if the snapshot
+ * cannot be read and SGF_INVALID_FILE if it is not a valid snapshot,
+ * has been written by an incompatible Quarry version or is stale.
+ */
+int
+sgf_load_snapshot (const char *filename, const char *source_filename,
+		   SgfCollection **collection,
+		   const SgfParserParameters *parameters)
+{
+  SgfSnapshot *snapshot;
+  const SnapshotHeader *header;
+  MemoryArena *value_arena;
+  const char *known_char_set = NULL;
+  int k;
+
+  assert (filename);
+  assert (collection);
+  assert (parameters);
+
+  snapshot = open_snapshot (filename);
+  if (!snapshot)
+    return SGF_ERROR_READING_FILE;
+
+  snapshot->parameters = *parameters;
+
+  if (!check_snapshot (snapshot, source_filename)) {
+    unref_snapshot (snapshot);
+    return SGF_INVALID_FILE;
+  }
+
+  header      = (const SnapshotHeader *) snapshot->data;
+  *collection = sgf_collection_new ();
+  value_arena = memory_arena_new ();
+
+  for (k = 0; k < (int) header->num_trees; k++) {
+    SgfGameTree *tree = load_tree (snapshot, k, value_arena,
+				   &known_char_set);
+
+    if (!tree) {
+      sgf_collection_delete (*collection);
+      *collection = NULL;
+      break;
+    }
+
+    sgf_collection_add_game_tree (*collection, tree);
+  }
+
+  memory_arena_unref (value_arena);
+  unref_snapshot (snapshot);
+
+  return *collection ? SGF_PARSED : SGF_INVALID_FILE;
+}
+
+
+/* Decode all nodes of a game tree loaded from a snapshot.  If the tree
+ * is stored as SGF text, only set its `unparsed_text' field.
+ */
+void
+sgf_snapshot_decode_remaining_nodes (SgfGameTree *tree)
+{
+  SgfSnapshot *snapshot = tree->snapshot;
+  const SnapshotTree *record;
+
+  assert (snapshot);
+
+  record = SNAPSHOT_TREES (snapshot) + tree->snapshot_tree_index;
+
+  if (record->unparsed_text) {
+    const unsigned int *pointer = WORDS_AT (snapshot, record->unparsed_text);
+    int length;
+    const char *text = decode_string (&pointer, SNAPSHOT_END (snapshot),
+				      &length);
+
+    if (text) {
+      sgf_game_tree_set_unparsed_text (tree, text, length,
+				       record->unparsed_text_line,
+				       record->unparsed_text_column,
+				       &snapshot->parameters);
+    }
+  }
+  else if (record->num_nodes > 1) {
+    SgfGameTree *donor_tree = sgf_game_tree_new ();
+
+    sgf_game_tree_set_game (donor_tree, tree->game);
+    donor_tree->board_width  = tree->board_width;
+    donor_tree->board_height = tree->board_height;
+    donor_tree->value_arena  = memory_arena_new ();
+
+    if (decode_nodes (snapshot, record, record->num_nodes, donor_tree))
+      sgf_game_tree_replace_nodes (tree, donor_tree);
+    else
+      sgf_game_tree_delete (donor_tree);
+  }
+
+  tree->snapshot = NULL;
+  unref_snapshot (snapshot);
+}
+
+
+/* Drop the tree's reference to the snapshot it was loaded from.  Used
+ * when the tree is deleted before being entered.
+ */
+void
+sgf_snapshot_release (SgfGameTree *tree)
+{
+  assert (tree->snapshot);
+
+  unref_snapshot (tree->snapshot);
+  tree->snapshot = NULL;
+}
+
+
+
+static int
+get_source_key (const char *source_filename,
+		unsigned int source_size[2], unsigned int source_mtime[2])
+{
+#if HAVE_SYS_STAT_H
+
+  struct stat file_statistics;
+
+  if (stat (source_filename, &file_statistics) != 0)
+    return 0;
+
+  encode_source_key (file_statistics.st_size, file_statistics.st_mtime,
+		     source_size, source_mtime);
+  return 1;
+
+#else
+
+  UNUSED (source_filename);
+  UNUSED (source_size);
+  UNUSED (source_mtime);
+
+  errno = ENOSYS;
+  return 0;
+
+#endif
+}
+
+
+static void
+encode_source_key (off_t size, time_t mtime,
+		   unsigned int source_size[2], unsigned int source_mtime[2])
+{
+  /* Double shifts avoid warnings when the types are 32 bits wide. */
+  source_size[0]  = (unsigned int) size;
+  source_size[1]  = (unsigned int) ((size >> 16) >> 16);
+  source_mtime[0] = (unsigned int) mtime;
+  source_mtime[1] = (unsigned int) ((mtime >> 16) >> 16);
+}
+
+
+/* Create and open a new file in the directory of `filename', with a
+ * name no other process uses.  Store the name in
+ * `temporary_filename', which the caller must free.
+ */
+static FILE *
+create_temporary_file (const char *filename, char **temporary_filename)
+{
+#if HAVE_MKSTEMP
+
+  int file_descriptor;
+  FILE *file;
+
+  *temporary_filename = utils_cat_strings (NULL, filename, ".XXXXXX", NULL);
+
+  file_descriptor = mkstemp (*temporary_filename);
+  if (file_descriptor == -1)
+    return NULL;
+
+  file = fdopen (file_descriptor, "wb");
+  if (!file) {
+    int error_number = errno;
+
+    close (file_descriptor);
+    remove (*temporary_filename);
+    errno = error_number;
+  }
+
+  return file;
+
+#else
+
+  *temporary_filename = utils_cat_strings (NULL, filename, ".tmp", NULL);
+  return fopen (*temporary_filename, "wb");
+
+#endif
+}
+
+
+
+static void
+write_tree (SnapshotWritingData *data, SgfGameTree *tree,
+	    SnapshotTree *record)
+{
+  const SgfNode *node;
+  int node_index;
+  int depth;
+
+  if (tree->snapshot)
+    sgf_snapshot_decode_remaining_nodes (tree);
+
+  /* Strings are limited in length, see decode_string(). */
+  if (tree->unparsed_text && tree->unparsed_text_length > INT_MAX / 2) {
+    SgfErrorList *error_list = sgf_parse_remaining_nodes (tree);
+
+    if (error_list)
+      string_list_delete (error_list);
+  }
+
+  record->game		      = tree->game;
+  record->board_width	      = tree->board_width;
+  record->board_height	      = tree->board_height;
+
+  record->file_format	      = tree->file_format;
+  record->style_is_set	      = tree->style_is_set;
+  record->style		      = tree->style;
+
+  record->char_set	      = write_string (data, tree->char_set, -1);
+  record->application_name    = write_string (data, tree->application_name,
+					      -1);
+  record->application_version = write_string (data,
+					      tree->application_version, -1);
+
+  record->unparsed_text	      = write_string (data, tree->unparsed_text,
+					      tree->unparsed_text_length);
+  record->unparsed_text_line   = tree->unparsed_text_line;
+  record->unparsed_text_column = tree->unparsed_text_column;
+
+  record->nodes_offset	      = data->offset;
+
+  if (tree->unparsed_text) {
+    write_node (data, tree, tree->root, -1);
+    record->nodes_end = data->offset;
+    record->num_nodes = 1;
+
+    return;
+  }
+
+  /* Write nodes in preorder, keeping indices of all ancestors of the
+   * current node.
+   */
+  for (node = tree->root, node_index = 0, depth = 0; ; node_index++) {
+    write_node (data, tree, node,
+		depth > 0 ? data->parent_indices[depth - 1] : -1);
+
+    if (node->child) {
+      if (depth == data->parent_indices_size) {
+	data->parent_indices_size = MAX (2 * data->parent_indices_size, 256);
+	data->parent_indices = utils_realloc (data->parent_indices,
+					      (data->parent_indices_size
+					       * sizeof (int)));
+      }
+
+      data->parent_indices[depth++] = node_index;
+      node = node->child;
+    }
+    else {
+      while (!node->next && depth > 0) {
+	node = node->parent;
+	depth--;
+      }
+
+      if (depth == 0)
+	break;
+
+      node = node->next;
+    }
+  }
+
+  record->nodes_end = data->offset;
+  record->num_nodes = node_index + 1;
+}
+
+
+/* Node record consists of parent index plus one (zero for the root),
+ * a word of flags and property count, packed move point and, for
+ * Amazons, packed arrow and queen start points.  Then properties
+ * follow, each is a type word followed by the value.
+ */
+static void
+write_node (SnapshotWritingData *data, const SgfGameTree *tree,
+	    const SgfNode *node, int parent_index)
+{
+  const SgfProperty *property;
+  unsigned int flags;
+  int num_properties = 0;
+
+  for (property = node->properties; property; property = property->next)
+    num_properties++;
+
+  flags = (node->move_color
+	   | (node->to_play_color << NODE_TO_PLAY_COLOR_SHIFT)
+	   | (num_properties << NODE_NUM_PROPERTIES_SHIFT));
+  if (node->is_collapsed)
+    flags |= NODE_IS_COLLAPSED;
+  if (node->parent && node->parent->current_variation == node)
+    flags |= NODE_IS_CURRENT_VARIATION;
+
+  write_word (data, parent_index + 1);
+  write_word (data, flags);
+  write_word (data, PACK_POINT (node->move_point));
+
+  if (tree->game == GAME_AMAZONS) {
+    const BoardAmazonsMoveData *move_data = &node->data.amazons;
+
+    write_word (data, (PACK_POINT (move_data->from)
+		       | PACK_POINT (move_data->shoot_arrow_to) << 16));
+  }
+
+  for (property = node->properties; property; property = property->next) {
+    write_word (data, property->type);
+    write_value (data, property_info[property->type].value_type,
+		 &property->value);
+  }
+}
+
+
+static void
+write_value (SnapshotWritingData *data, SgfValueType value_type,
+	     const SgfValue *value)
+{
+  int k;
+
+  switch (value_type) {
+  case SGF_NUMBER:
+  case SGF_DOUBLE:
+  case SGF_COLOR:
+    write_word (data, value->number);
+    break;
+
+  case SGF_REAL:
+    {
+      unsigned int words[(sizeof (double) + sizeof (unsigned int) - 1)
+			 / sizeof (unsigned int)];
+
+#if SGF_REAL_VALUES_ALLOCATED_SEPARATELY
+      memcpy (words, value->real, sizeof (double));
+#else
+      memcpy (words, &value->real, sizeof (double));
+#endif
+
+      for (k = 0; k < (int) (sizeof words / sizeof (unsigned int)); k++)
+	write_word (data, words[k]);
+    }
+
+    break;
+
+  case SGF_SIMPLE_TEXT:
+  case SGF_FAKE_SIMPLE_TEXT:
+  case SGF_TEXT:
+    write_string (data, value->text, -1);
+    break;
+
+  case SGF_LIST_OF_POINT:
+  case SGF_ELIST_OF_POINT:
+    write_word (data, value->position_list->num_positions);
+    for (k = 0; k < value->position_list->num_positions; k++)
+      write_word (data, value->position_list->positions[k]);
+
+    break;
+
+  case SGF_LIST_OF_VECTOR:
+    write_word (data, value->vector_list->num_vectors);
+    for (k = 0; k < value->vector_list->num_vectors; k++) {
+      const SgfVector *vector = value->vector_list->vectors + k;
+
+      write_word (data, (PACK_POINT (vector->from_point)
+			 | PACK_POINT (vector->to_point) << 16));
+    }
+
+    break;
+
+  case SGF_LIST_OF_LABEL:
+    write_word (data, value->label_list->num_labels);
+    for (k = 0; k < value->label_list->num_labels; k++) {
+      write_word (data, PACK_POINT (value->label_list->labels[k].point));
+      write_string (data, value->label_list->labels[k].text, -1);
+    }
+
+    break;
+
+  case SGF_FIGURE_DESCRIPTION:
+    /* Empty figure description is a NULL pointer. */
+    if (!value->figure) {
+      write_word (data, FIGURE_IS_EMPTY);
+      break;
+    }
+
+    if (value->figure->diagram_name) {
+      write_word (data, FIGURE_HAS_DIAGRAM_NAME);
+      write_word (data, value->figure->flags);
+      write_string (data, value->figure->diagram_name, -1);
+    }
+    else {
+      write_word (data, FIGURE_HAS_NO_DIAGRAM_NAME);
+      write_word (data, value->figure->flags);
+    }
+
+    break;
+
+  case SGF_TYPE_UNKNOWN:
+    {
+      const StringListItem *item;
+      int num_items = 0;
+
+      for (item = value->unknown_value_list->first; item; item = item->next)
+	num_items++;
+
+      write_word (data, num_items);
+      for (item = value->unknown_value_list->first; item; item = item->next)
+	write_string (data, item->text, -1);
+    }
+
+    break;
+
+  default:
+    /* Make sure all property types are handled. */
+    assert (value_type == SGF_NONE);
+  }
+}
+
+
+/* Write a string and return its offset.  If `length' is negative, the
+ * string is zero-terminated.  NULL strings are not written and get
+ * zero offset.
+ */
+static unsigned int
+write_string (SnapshotWritingData *data, const char *string, int length)
+{
+  static const char padding[sizeof (unsigned int)];
+  unsigned int offset = data->offset;
+  int num_padding_bytes;
+
+  if (!string)
+    return 0;
+
+  if (length < 0)
+    length = strlen (string);
+
+  num_padding_bytes = ((STRING_NUM_WORDS (length) - 1) * sizeof (unsigned int)
+		       - length);
+
+  write_word (data, length);
+  fwrite (string, 1, length, data->file);
+  fwrite (padding, 1, num_padding_bytes, data->file);
+
+  data->offset += length + num_padding_bytes;
+
+  return offset;
+}
+
+
+inline static void
+write_word (SnapshotWritingData *data, unsigned int word)
+{
+  fwrite (&word, sizeof (unsigned int), 1, data->file);
+  data->offset += sizeof (unsigned int);
+}
+
+
+
+/* Map the snapshot file in memory or, if that is not possible, read
+ * it.  Return NULL on failure.
+ */
+static SgfSnapshot *
+open_snapshot (const char *filename)
+{
+  SgfSnapshot *snapshot;
+  FILE *file;
+  long file_size;
+  void *data;
+
+  file = fopen (filename, "rb");
+  if (!file)
+    return NULL;
+
+  if (fseek (file, 0, SEEK_END) == -1
+      || (file_size = ftell (file)) < (long) sizeof (SnapshotHeader)
+      || file_size > INT_MAX) {
+    fclose (file);
+    return NULL;
+  }
+
+#if USE_MMAP
+
+  data = mmap (NULL, file_size, PROT_READ, MAP_SHARED, fileno (file), 0);
+  if (data != MAP_FAILED) {
+    fclose (file);
+
+    snapshot = utils_malloc (sizeof (SgfSnapshot));
+    snapshot->is_mapped = 1;
+  }
+  else
+
+#endif /* USE_MMAP */
+
+  {
+    data = utils_malloc (file_size);
+
+    rewind (file);
+    if (fread (data, file_size, 1, file) != 1) {
+      utils_free (data);
+      fclose (file);
+
+      return NULL;
+    }
+
+    fclose (file);
+
+    snapshot = utils_malloc (sizeof (SgfSnapshot));
+    snapshot->is_mapped = 0;
+  }
+
+  snapshot->reference_count = 1;
+  snapshot->data	    = data;
+  snapshot->size	    = file_size;
+
+  return snapshot;
+}
+
+
+static void
+unref_snapshot (SgfSnapshot *snapshot)
+{
+  assert (snapshot->reference_count > 0);
+
+  if (--snapshot->reference_count > 0)
+    return;
+
+#if USE_MMAP
+  if (snapshot->is_mapped)
+    munmap (snapshot->data, snapshot->size);
+  else
+    utils_free (snapshot->data);
+#else
+  utils_free (snapshot->data);
+#endif
+
+  utils_free (snapshot);
+}
+
+
+/* Check that the snapshot is compatible with this Quarry version,
+ * complete and not stale.  Node records are checked only when they
+ * are decoded.
+ */
+static int
+check_snapshot (const SgfSnapshot *snapshot, const char *source_filename)
+{
+  const SnapshotHeader *header = (const SnapshotHeader *) snapshot->data;
+  const SnapshotTree *records;
+  unsigned int k;
+
+  if (memcmp (header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH) != 0
+      || header->format_version != SNAPSHOT_FORMAT_VERSION
+      || header->byte_order_mark != SNAPSHOT_BYTE_ORDER_MARK
+      || header->num_property_types != SGF_NUM_PROPERTIES
+      || header->file_size != (unsigned int) snapshot->size
+      || header->trees_offset % sizeof (unsigned int) != 0
+      || header->trees_offset > header->file_size
+      || ((header->file_size - header->trees_offset) / sizeof (SnapshotTree)
+	  < header->num_trees))
+    return 0;
+
+  if (source_filename) {
+    unsigned int source_size[2];
+    unsigned int source_mtime[2];
+
+    if (!get_source_key (source_filename, source_size, source_mtime)
+	|| source_size[0] != header->source_size[0]
+	|| source_size[1] != header->source_size[1]
+	|| source_mtime[0] != header->source_mtime[0]
+	|| source_mtime[1] != header->source_mtime[1])
+      return 0;
+  }
+
+  records = SNAPSHOT_TREES (snapshot);
+
+  for (k = 0; k < header->num_trees; k++) {
+    const SnapshotTree *record = records + k;
+
+    if ((int) record->game < FIRST_GAME || (int) record->game > LAST_GAME
+	|| record->board_width < BOARD_MIN_WIDTH
+	|| record->board_width > BOARD_MAX_WIDTH
+	|| record->board_height < BOARD_MIN_HEIGHT
+	|| record->board_height > BOARD_MAX_HEIGHT
+	|| record->num_nodes < 1
+	|| record->nodes_offset % sizeof (unsigned int) != 0
+	|| record->nodes_offset > record->nodes_end
+	|| record->nodes_end > header->trees_offset
+	|| (record->num_nodes
+	    > ((record->nodes_end - record->nodes_offset)
+	       / (3 * sizeof (unsigned int))))
+	|| !STRING_OFFSET_IS_VALID (header, record->char_set)
+	|| !STRING_OFFSET_IS_VALID (header, record->application_name)
+	|| !STRING_OFFSET_IS_VALID (header, record->application_version)
+	|| !STRING_OFFSET_IS_VALID (header, record->unparsed_text))
+      return 0;
+  }
+
+  return 1;
+}
+
+
+
+/* Create a game tree with the root node decoded.  The rest of nodes is
+ * decoded when the tree is entered.  `known_char_set' is the last
+ * character set found valid, so that iconv is not asked for it again.
+ */
+static SgfGameTree *
+load_tree (SgfSnapshot *snapshot, int tree_index, MemoryArena *value_arena,
+	   const char **known_char_set)
+{
+  const SnapshotTree *record = SNAPSHOT_TREES (snapshot) + tree_index;
+  SgfGameTree *tree = sgf_game_tree_new ();
+
+  sgf_game_tree_set_game (tree, record->game);
+  tree->board_width	    = record->board_width;
+  tree->board_height	    = record->board_height;
+  tree->value_arena	    = memory_arena_ref (value_arena);
+
+  tree->file_format	    = record->file_format;
+  tree->style_is_set	    = record->style_is_set;
+  tree->style		    = record->style;
+
+  tree->char_set	    = get_string (snapshot, record->char_set);
+  tree->application_name    = get_string (snapshot, record->application_name);
+  tree->application_version = get_string (snapshot,
+					  record->application_version);
+
+  /* The parser drops character sets unknown to iconv and the writer
+   * relies on that.
+   */
+  if (tree->char_set && strcmp (tree->char_set, "UTF-8") != 0
+      && !(*known_char_set && strcmp (tree->char_set, *known_char_set) == 0)) {
+    iconv_t char_set_handle = iconv_open (tree->char_set, "UTF-8");
+
+    if (char_set_handle == (iconv_t) (-1)) {
+      sgf_game_tree_delete (tree);
+      return NULL;
+    }
+
+    iconv_close (char_set_handle);
+    *known_char_set = tree->char_set;
+  }
+
+  if (!decode_nodes (snapshot, record, 1, tree)) {
+    sgf_game_tree_delete (tree);
+    return NULL;
+  }
+
+  tree->current_node = tree->root;
+
+  if (record->num_nodes > 1 || record->unparsed_text) {
+    snapshot->reference_count++;
+
+    tree->snapshot	      = snapshot;
+    tree->snapshot_tree_index = tree_index;
+  }
+
+  return tree;
+}
+
+
+/* Decode the first `num_nodes' node records of a tree.  Nodes are
+ * linked in the order they come, so siblings keep their order.  Fail
+ * if a record is malformed or refers to points outside the board.
+ */
+static int
+decode_nodes (const SgfSnapshot *snapshot, const SnapshotTree *record,
+	      int num_nodes, SgfGameTree *tree)
+{
+  const unsigned int *pointer = WORDS_AT (snapshot, record->nodes_offset);
+  const unsigned int *end = WORDS_AT (snapshot, record->nodes_end);
+  int node_words = (tree->game == GAME_AMAZONS ? 4 : 3);
+  SgfNode **nodes = utils_malloc (2 * num_nodes * sizeof (SgfNode *));
+  SgfNode **last_children = nodes + num_nodes;
+  int node_index;
+
+  for (node_index = 0; node_index < num_nodes; node_index++) {
+    SgfNode *parent = NULL;
+    SgfNode *node;
+    SgfProperty **link;
+    unsigned int flags;
+    int num_properties;
+
+    if (end - pointer < node_words
+	|| pointer[0] > (unsigned int) node_index
+	|| (pointer[0] == 0) != (node_index == 0))
+      break;
+
+    if (pointer[0] > 0)
+      parent = nodes[pointer[0] - 1];
+
+    node = sgf_node_new (tree, parent);
+    nodes[node_index]	      = node;
+    last_children[node_index] = NULL;
+
+    if (parent) {
+      if (last_children[pointer[0] - 1])
+	last_children[pointer[0] - 1]->next = node;
+      else
+	parent->child = node;
+
+      last_children[pointer[0] - 1] = node;
+    }
+    else
+      tree->root = node;
+
+    flags = pointer[1];
+    node->move_color	= flags & NODE_MOVE_COLOR_MASK;
+    node->to_play_color = ((flags & NODE_TO_PLAY_COLOR_MASK)
+			   >> NODE_TO_PLAY_COLOR_SHIFT);
+    node->is_collapsed	= (flags & NODE_IS_COLLAPSED ? 1 : 0);
+
+    if ((flags & NODE_IS_CURRENT_VARIATION) && parent)
+      parent->current_variation = node;
+
+    UNPACK_POINT (node->move_point, pointer[2]);
+    if (tree->game == GAME_AMAZONS) {
+      UNPACK_POINT (node->data.amazons.from, pointer[3]);
+      UNPACK_POINT (node->data.amazons.shoot_arrow_to, pointer[3] >> 16);
+    }
+
+    /* Points of nodes without a move are not initialized. */
+    if (IS_STONE (node->move_color)
+	&& (!MOVE_POINT_IS_VALID (tree, node->move_point)
+	    || (tree->game == GAME_AMAZONS
+		&& !IS_NULL_POINT (node->move_point.x, node->move_point.y)
+		&& (!POINT_IS_ON_GRID (tree, node->data.amazons.from)
+		    || !POINT_IS_ON_GRID (tree,
+					  node->data.amazons.shoot_arrow_to)))))
+      break;
+
+    pointer += node_words;
+
+    link = &node->properties;
+    for (num_properties = flags >> NODE_NUM_PROPERTIES_SHIFT;
+	 num_properties > 0; num_properties--) {
+      SgfType type;
+      SgfValue value;
+
+      if (pointer == end || *pointer >= SGF_NUM_PROPERTIES)
+	break;
+
+      type = *pointer++;
+      if (!decode_value (&pointer, end, property_info[type].value_type,
+			 &value, tree))
+	break;
+
+      *link = sgf_property_new (tree, type, NULL);
+      (*link)->value = value;
+      link = &(*link)->next;
+
+      node->property_mask |= SGF_PROPERTY_MASK_BIT (type);
+    }
+
+    if (num_properties > 0)
+      break;
+  }
+
+  utils_free (nodes);
+
+  return node_index == num_nodes;
+}
+
+
+/* Decode a property value of given tree, advancing the `pointer'.
+ * Texts are stored in the tree's arena, everything else is allocated
+ * on the heap.  Points must be on the tree's board.
+ */
+static int
+decode_value (const unsigned int **pointer, const unsigned int *end,
+	      SgfValueType value_type, SgfValue *value,
+	      const SgfGameTree *tree)
+{
+  const char *string;
+  int length;
+  int num_items;
+  int k;
+
+  if (value_type == SGF_NONE)
+    return 1;
+
+  if (*pointer == end)
+    return 0;
+
+  switch (value_type) {
+  case SGF_NUMBER:
+  case SGF_DOUBLE:
+  case SGF_COLOR:
+    value->number = *(*pointer)++;
+    return 1;
+
+  case SGF_REAL:
+    if ((end - *pointer) * sizeof (unsigned int) < sizeof (double))
+      return 0;
+
+#if SGF_REAL_VALUES_ALLOCATED_SEPARATELY
+    value->real = utils_duplicate_buffer (*pointer, sizeof (double));
+#else
+    memcpy (&value->real, *pointer, sizeof (double));
+#endif
+
+    *pointer += ((sizeof (double) + sizeof (unsigned int) - 1)
+		 / sizeof (unsigned int));
+    return 1;
+
+  case SGF_SIMPLE_TEXT:
+  case SGF_FAKE_SIMPLE_TEXT:
+  case SGF_TEXT:
+    string = decode_string (pointer, end, &length);
+    if (!string)
+      return 0;
+
+    if (value_type != SGF_TEXT || length <= MAX_INTERNED_TEXT_LENGTH) {
+      value->text = memory_arena_intern_as_string (tree->value_arena,
+						   string, length);
+    }
+    else {
+      value->text = memory_arena_duplicate_as_string (tree->value_arena,
+						      string, length);
+    }
+
+    return 1;
+
+  case SGF_LIST_OF_POINT:
+  case SGF_ELIST_OF_POINT:
+    num_items = *(*pointer)++;
+    if ((unsigned int) num_items >= BOARD_MAX_POSITIONS
+	|| end - *pointer < num_items)
+      return 0;
+
+    for (k = 0; k < num_items; k++) {
+      if (!POSITION_IS_ON_GRID (tree, (*pointer)[k]))
+	return 0;
+    }
+
+    value->position_list = board_position_list_new ((const int *) *pointer,
+						    num_items);
+    *pointer += num_items;
+    return 1;
+
+  case SGF_LIST_OF_VECTOR:
+    num_items = *(*pointer)++;
+    if ((unsigned int) num_items > BOARD_MAX_POSITIONS * BOARD_MAX_POSITIONS
+	|| end - *pointer < num_items)
+      return 0;
+
+    value->vector_list = sgf_vector_list_new (num_items);
+    for (k = 0; k < num_items; k++) {
+      SgfVector *vector = value->vector_list->vectors + k;
+
+      UNPACK_POINT (vector->from_point, (*pointer)[k]);
+      UNPACK_POINT (vector->to_point, (*pointer)[k] >> 16);
+
+      if (!POINT_IS_ON_GRID (tree, vector->from_point)
+	  || !POINT_IS_ON_GRID (tree, vector->to_point)) {
+	sgf_vector_list_delete (value->vector_list);
+	return 0;
+      }
+    }
+
+    value->vector_list->num_vectors = num_items;
+    *pointer += num_items;
+    return 1;
+
+  case SGF_LIST_OF_LABEL:
+    num_items = *(*pointer)++;
+    if ((unsigned int) num_items >= BOARD_MAX_POSITIONS
+	|| end - *pointer < 2 * num_items)
+      return 0;
+
+    value->label_list = sgf_label_list_new_empty (num_items);
+    for (k = 0; k < num_items; k++) {
+      SgfLabel *label = value->label_list->labels + k;
+
+      UNPACK_POINT (label->point, **pointer);
+      (*pointer)++;
+
+      string = (POINT_IS_ON_GRID (tree, label->point)
+		? decode_string (pointer, end, &length) : NULL);
+      if (!string) {
+	value->label_list->num_labels = k;
+	sgf_label_list_delete (value->label_list);
+
+	return 0;
+      }
+
+      label->text = utils_duplicate_as_string (string, length);
+    }
+
+    return 1;
+
+  case SGF_FIGURE_DESCRIPTION:
+    if (**pointer == FIGURE_IS_EMPTY) {
+      value->figure = NULL;
+      (*pointer)++;
+
+      return 1;
+    }
+
+    if (end - *pointer < 2)
+      return 0;
+
+    if ((*pointer)[0] == FIGURE_HAS_DIAGRAM_NAME) {
+      int flags = (*pointer)[1];
+
+      *pointer += 2;
+      string = decode_string (pointer, end, &length);
+      if (!string)
+	return 0;
+
+      value->figure
+	= sgf_figure_description_new (flags,
+				      utils_duplicate_as_string (string,
+								 length));
+    }
+    else {
+      value->figure = sgf_figure_description_new ((*pointer)[1], NULL);
+      *pointer += 2;
+    }
+
+    return 1;
+
+  case SGF_TYPE_UNKNOWN:
+    /* Property name and at least one value. */
+    num_items = *(*pointer)++;
+    if (num_items < 2)
+      return 0;
+
+    value->unknown_value_list = string_list_new ();
+
+    for (k = 0; k < num_items; k++) {
+      string = decode_string (pointer, end, &length);
+      if (!string) {
+	string_list_delete (value->unknown_value_list);
+	return 0;
+      }
+
+      string_list_add_from_buffer (value->unknown_value_list, string, length);
+    }
+
+    return 1;
+
+  default:
+    /* Properties of other types are never written. */
+    return 0;
+  }
+}
+
+
+static const char *
+decode_string (const unsigned int **pointer, const unsigned int *end,
+	       int *length)
+{
+  const char *string;
+
+  if (*pointer == end || **pointer > INT_MAX / 2
+      || end - *pointer < (int) STRING_NUM_WORDS (**pointer))
+    return NULL;
+
+  *length = **pointer;
+  string  = (const char *) (*pointer + 1);
+
+  *pointer += STRING_NUM_WORDS (*length);
+
+  return string;
+}
+
+
+/* Return a heap copy of string at given offset or NULL. */
+static char *
+get_string (const SgfSnapshot *snapshot, unsigned int offset)
+{
+  const unsigned int *pointer = WORDS_AT (snapshot, offset);
+  const char *string;
+  int length;
+
+  if (!offset)
+    return NULL;
+
+  string = decode_string (&pointer, SNAPSHOT_END (snapshot), &length);
+
+  return string ? utils_duplicate_as_string (string, length) : NULL;
+}
+
+
+/*
+ * Local Variables:
+ * tab-width: 8
+ * c-basic-offset: 2
+ * End:
+ */
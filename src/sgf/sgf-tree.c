@@ -32,7 +32,14 @@
 #include <string.h>
 
 
-inline static void  free_property_value (SgfProperty *property);
+/* Only texts are ever stored in value arenas. */
+#define VALUE_IS_IN_ARENA(tree, value_type, pointer)			\
+  ((value_type) <= SGF_TEXT && (tree) && (tree)->value_arena		\
+   && memory_arena_owns ((tree)->value_arena, (pointer)))
+
+
+inline static void  free_property_value (SgfProperty *property,
+					 SgfGameTree *tree);
 
 static int	    compare_sgf_labels (const void *first_label,
 					const void *second_label);
@@ -54,6 +61,9 @@ sgf_collection_new (void)
   collection->num_modified_undo_histories = 0;
   collection->is_irreversibly_modified	  = 0;
 
+  collection->source_file_size		  = 0;
+  collection->source_file_mtime		  = 0;
+
   collection->notification_callback	  = NULL;
   collection->user_data			  = NULL;
 
@@ -170,12 +180,17 @@ sgf_game_tree_new (void)
 
   tree->board		      = NULL;
   tree->board_state	      = NULL;
+  tree->board_checkpoints     = NULL;
 
   tree->undo_history	      = NULL;
   tree->undo_history_list     = NULL;
 
   tree->undo_operation_level  = 0;
 
+  tree->unparsed_text	      = NULL;
+  tree->source_text	      = NULL;
+  tree->snapshot	      = NULL;
+  tree->value_arena	      = NULL;
   tree->char_set	      = NULL;
 
   tree->application_name      = NULL;
@@ -251,6 +266,7 @@ sgf_game_tree_delete (SgfGameTree *tree)
     tree->notification_callback (tree, SGF_GAME_TREE_DELETED, tree->user_data);
 
   sgf_game_tree_invalidate_map (tree, NULL);
+  sgf_utils_forget_board_checkpoints (tree);
 
   undo_history = tree->undo_history_list;
   while (undo_history) {
@@ -262,8 +278,9 @@ sgf_game_tree_delete (SgfGameTree *tree)
 
 #if ENABLE_MEMORY_POOLS
 
-  memory_pool_traverse (&tree->property_pool,
-			(MemoryPoolCallback) free_property_value);
+  memory_pool_traverse_data (&tree->property_pool,
+			     (MemoryPoolDataCallback) free_property_value,
+			     tree);
 
   memory_pool_flush (&tree->property_pool);
   if (tree->node_pool.item_size > 0)
@@ -276,6 +293,15 @@ sgf_game_tree_delete (SgfGameTree *tree)
 
 #endif
 
+  if (tree->value_arena)
+    memory_arena_unref (tree->value_arena);
+
+  if (tree->snapshot)
+    sgf_snapshot_release (tree);
+
+  if (tree->source_text)
+    sgf_source_text_unref (tree->source_text);
+
   utils_free (tree->char_set);
   utils_free (tree->application_name);
   utils_free (tree->application_version);
@@ -284,6 +310,45 @@ sgf_game_tree_delete (SgfGameTree *tree)
 }
 
 
+/* Replace all nodes of `tree' with nodes of `donor_tree' and delete
+ * the latter.  Both trees must be of the same game.  Current node of
+ * `tree' is reset to root.
+ */
+void
+sgf_game_tree_replace_nodes (SgfGameTree *tree, SgfGameTree *donor_tree)
+{
+  SgfNode *root = tree->root;
+  MemoryPool node_pool = tree->node_pool;
+  MemoryPool property_pool = tree->property_pool;
+  MemoryArena *value_arena = tree->value_arena;
+
+  assert (tree);
+  assert (donor_tree);
+  assert (donor_tree->game == tree->game);
+
+  sgf_game_tree_invalidate_map (tree, NULL);
+  sgf_utils_forget_board_checkpoints (tree);
+
+  /* Swap node storage, so that old nodes are freed together with the
+   * donor tree.
+   */
+  tree->root		    = donor_tree->root;
+  tree->node_pool	    = donor_tree->node_pool;
+  tree->property_pool	    = donor_tree->property_pool;
+  tree->value_arena	    = donor_tree->value_arena;
+
+  donor_tree->root	    = root;
+  donor_tree->node_pool	    = node_pool;
+  donor_tree->property_pool = property_pool;
+  donor_tree->value_arena   = value_arena;
+
+  tree->current_node	    = tree->root;
+  tree->current_node_depth  = 0;
+
+  sgf_game_tree_delete (donor_tree);
+}
+
+
 void
 sgf_game_tree_set_game (SgfGameTree *tree, Game game)
 {
@@ -493,6 +558,7 @@ sgf_node_new (SgfGameTree *tree, SgfNode *parent)
   node->move_color		  = EMPTY;
 
   node->properties		  = NULL;
+  node->property_mask		  = 0;
 
   return node;
 }
@@ -606,6 +672,8 @@ sgf_node_duplicate (const SgfNode *node, SgfGameTree *tree, SgfNode *parent)
        property = property->next, link = & (*link)->next)
     *link = sgf_property_duplicate (property, tree, NULL);
 
+  node_copy->property_mask = node->property_mask;
+
   return node_copy;
 }
 
@@ -692,6 +760,12 @@ sgf_node_find_property (SgfNode *node, SgfType type, SgfProperty ***link)
 
   assert (node);
 
+  /* The insertion link is needed even if there is no such property,
+   * so the mask only helps plain lookups.
+   */
+  if (!link && !(node->property_mask & SGF_PROPERTY_MASK_BIT (type)))
+    return 0;
+
   for (internal_link = &node->properties; *internal_link;
        internal_link = & (*internal_link)->next) {
     if ((*internal_link)->type >= type) {
@@ -772,6 +846,8 @@ sgf_node_is_game_info_node (const SgfNode *node)
     const SgfProperty *property;					\
     assert (node);							\
     assert (type_assertion);						\
+    if (!(node->property_mask & SGF_PROPERTY_MASK_BIT (type)))		\
+      return fail_value;						\
     for (property = node->properties;					\
 	 property && property->type <= type;				\
 	 property = property->next) {					\
@@ -795,6 +871,9 @@ sgf_node_get_number_property_value (const SgfNode *node, SgfType type,
   assert (node);
   assert (property_info[type].value_type == SGF_NUMBER);
 
+  if (!(node->property_mask & SGF_PROPERTY_MASK_BIT (type)))
+    return 0;
+
   for (property = node->properties; property && property->type <= type;
        property = property->next) {
     if (property->type == type) {
@@ -932,6 +1011,9 @@ sgf_node_get_real_property_value (const SgfNode *node, SgfType type,
   assert (node);
   assert (property_info[type].value_type == SGF_REAL);
 
+  if (!(node->property_mask & SGF_PROPERTY_MASK_BIT (type)))
+    return 0;
+
   for (property = node->properties; property && property->type <= type;
        property = property->next) {
     if (property->type == type) {
@@ -999,6 +1081,7 @@ sgf_node_add_none_property (SgfNode *node, SgfGameTree *tree, SgfType type)
 
   if (!sgf_node_find_property (node, type, &link)) {
     *link = sgf_property_new (tree, type, *link);
+    node->property_mask |= SGF_PROPERTY_MASK_BIT (type);
 
     return 1;
   }
@@ -1020,6 +1103,7 @@ sgf_node_add_number_property (SgfNode *node, SgfGameTree *tree,
 
   if (!sgf_node_find_property (node, type, &link)) {
     *link = sgf_property_new (tree, type, *link);
+    node->property_mask |= SGF_PROPERTY_MASK_BIT (type);
     (*link)->value.number = number;
 
     return 1;
@@ -1045,6 +1129,7 @@ sgf_node_add_real_property (SgfNode *node, SgfGameTree *tree,
 
   if (!sgf_node_find_property (node, type, &link)) {
     *link = sgf_property_new (tree, type, *link);
+    node->property_mask |= SGF_PROPERTY_MASK_BIT (type);
 
 #if SGF_REAL_VALUES_ALLOCATED_SEPARATELY
     (*link)->value.real = utils_duplicate_buffer (&value, sizeof (double));
@@ -1084,6 +1169,7 @@ sgf_node_add_pointer_property (SgfNode *node, SgfGameTree *tree,
 
   if (!sgf_node_find_property (node, type, &link)) {
     *link = sgf_property_new (tree, type, *link);
+    node->property_mask |= SGF_PROPERTY_MASK_BIT (type);
     (*link)->value.memory_block = pointer;
 
     return 1;
@@ -1093,7 +1179,10 @@ sgf_node_add_pointer_property (SgfNode *node, SgfGameTree *tree,
 
   switch (property_info[type].value_type) {
   default:
-    utils_free (pointer_to_free);
+    if (!VALUE_IS_IN_ARENA (tree, property_info[type].value_type,
+			    pointer_to_free))
+      utils_free (pointer_to_free);
+
     break;
 
   case  SGF_LIST_OF_LABEL:
@@ -1133,6 +1222,8 @@ sgf_node_delete_property (SgfNode *node, SgfGameTree *tree, SgfType type)
     sgf_property_delete (*link, tree);
     *link = next_property;
 
+    sgf_node_update_property_mask (node);
+
     return 1;
   }
 
@@ -1166,6 +1257,8 @@ sgf_node_split (SgfNode *node, SgfGameTree *tree)
   node_link = &node->properties;
   child_link = &node->child->properties;
 
+  node->property_mask = 0;
+
   for (property = node->properties; property; property = property->next) {
     /* This is mainly to avoid GCC warning. */
     SgfType type = property->type;
@@ -1178,10 +1271,12 @@ sgf_node_split (SgfNode *node, SgfGameTree *tree)
 	|| type == SGF_NODE_NAME) {
       *node_link = property;
       node_link = &property->next;
+      node->property_mask |= SGF_PROPERTY_MASK_BIT (type);
     }
     else {
       *child_link = property;
       child_link = &property->next;
+      node->child->property_mask |= SGF_PROPERTY_MASK_BIT (type);
     }
   }
 
@@ -1190,6 +1285,25 @@ sgf_node_split (SgfNode *node, SgfGameTree *tree)
 }
 
 
+/* Recompute `property_mask' of the node from its property list.  This
+ * is needed after property deletion, since other properties might
+ * share the deleted property's bit.
+ */
+void
+sgf_node_update_property_mask (SgfNode *node)
+{
+  const SgfProperty *property;
+  unsigned int property_mask = 0;
+
+  assert (node);
+
+  for (property = node->properties; property; property = property->next)
+    property_mask |= SGF_PROPERTY_MASK_BIT (property->type);
+
+  node->property_mask = property_mask;
+}
+
+
 /* Get ``next'' node in tree-traversing sense.  See
  * sgf_game_tree_traverse_forward() for details.
  */
@@ -1294,7 +1408,7 @@ sgf_property_delete (SgfProperty *property, SgfGameTree *tree)
   assert (property);
   assert (tree);
 
-  free_property_value (property);
+  free_property_value (property, tree);
   memory_pool_free (&tree->property_pool, property);
 }
 
@@ -1379,15 +1493,21 @@ sgf_property_duplicate (const SgfProperty *property, SgfGameTree *tree,
 }
 
 
+/* Free a value of given type that belongs to `tree', unless it is
+ * stored in the tree's value arena.
+ */
 void
-sgf_property_free_value (SgfValueType value_type, SgfValue *value)
+sgf_property_free_value (SgfValueType value_type, SgfValue *value,
+			 SgfGameTree *tree)
 {
   /* `SGF_REAL' type may or may not belong to this range. */
   if (SGF_FIRST_MALLOC_TYPE <= value_type
       && value_type <= SGF_LAST_MALLOC_TYPE) {
     switch (value_type) {
     default:
-      utils_free (value->memory_block);
+      if (!VALUE_IS_IN_ARENA (tree, value_type, value->memory_block))
+	utils_free (value->memory_block);
+
       break;
 
     case SGF_LIST_OF_LABEL:
@@ -1409,10 +1529,10 @@ sgf_property_free_value (SgfValueType value_type, SgfValue *value)
 
 
 inline static void
-free_property_value (SgfProperty *property)
+free_property_value (SgfProperty *property, SgfGameTree *tree)
 {
   sgf_property_free_value (property_info[property->type].value_type,
-			   &property->value);
+			   &property->value, tree);
 }
 
 
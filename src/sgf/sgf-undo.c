@@ -46,6 +46,20 @@
 #endif
 
 
+/* Whether a property of given type can change board position or
+ * board state at its node and below.  Time control properties are not
+ * in board checkpoints, but they are listed here for safety.
+ */
+#define AFFECTS_BOARD_STATE(type)					\
+  ((SGF_FIRST_GAME_INFO_PROPERTY <= (type)				\
+    && (type) <= SGF_LAST_GAME_INFO_PROPERTY)				\
+   || (SGF_FIRST_SETUP_PROPERTY <= (type)				\
+       && (type) <= SGF_LAST_SETUP_PROPERTY)				\
+   || (SGF_TIME_LEFT_FOR_BLACK <= (type)				\
+       && (type) <= SGF_MOVES_LEFT_FOR_WHITE)				\
+   || (type) == SGF_MOVE_NUMBER)
+
+
 inline static void  delete_undo_history_entry (SgfUndoHistoryEntry *entry,
 					       int is_applied,
 					       SgfGameTree *tree);
@@ -642,6 +656,7 @@ sgf_operation_add_node (SgfUndoHistoryEntry *entry, SgfGameTree *tree)
 
   * find_node_link (node->parent, node->next) = node;
   sgf_game_tree_invalidate_map (tree, node->parent);
+  sgf_utils_forget_board_checkpoints_below (tree, node->parent);
 }
 
 
@@ -661,6 +676,7 @@ sgf_operation_delete_node (SgfUndoHistoryEntry *entry, SgfGameTree *tree)
 			       ->parent_current_variation);
 
   sgf_game_tree_invalidate_map (tree, parent);
+  sgf_utils_forget_board_checkpoints_below (tree, parent);
 }
 
 
@@ -699,6 +715,7 @@ sgf_operation_delete_node_children_undo (SgfUndoHistoryEntry *entry,
     = ((SgfNodeOperationEntry *) entry)->parent_current_variation;
 
   sgf_game_tree_invalidate_map (tree, parent);
+  sgf_utils_forget_board_checkpoints_below (tree, parent);
 }
 
 
@@ -717,6 +734,7 @@ sgf_operation_delete_node_children_redo (SgfUndoHistoryEntry *entry,
   parent->current_variation = NULL;
 
   sgf_game_tree_invalidate_map (tree, parent);
+  sgf_utils_forget_board_checkpoints_below (tree, parent);
 }
 
 
@@ -781,6 +799,7 @@ sgf_operation_swap_nodes_do_swap (SgfUndoHistoryEntry *entry,
   *link = node1;
 
   sgf_game_tree_invalidate_map (tree, parent);
+  sgf_utils_forget_board_checkpoints_below (tree, parent);
 }
 
 
@@ -802,6 +821,8 @@ sgf_operation_change_node_move_color_do_change (SgfUndoHistoryEntry *entry,
   temp_color			= color_entry->node->move_color;
   color_entry->node->move_color = color_entry->color;
   color_entry->color		= temp_color;
+
+  sgf_utils_forget_board_checkpoints_below (tree, color_entry->node);
 }
 
 
@@ -824,6 +845,8 @@ sgf_operation_change_node_to_play_color_do_change (SgfUndoHistoryEntry *entry,
   node->to_play_color = color_entry->color;
   color_entry->color  = temp_color;
 
+  sgf_utils_forget_board_checkpoints_below (tree, node);
+
   if (node == tree->current_node)
     sgf_utils_find_board_state_data (tree, 1, 0);
 }
@@ -839,6 +862,10 @@ sgf_operation_add_property (SgfUndoHistoryEntry *entry, SgfGameTree *tree)
     tree->node_to_switch_to = node;
 
   * find_property_link (node, property->next) = property;
+  node->property_mask |= SGF_PROPERTY_MASK_BIT (property->type);
+
+  if (AFFECTS_BOARD_STATE (property->type))
+    sgf_utils_forget_board_checkpoints_below (tree, node);
 }
 
 
@@ -852,6 +879,10 @@ sgf_operation_delete_property (SgfUndoHistoryEntry *entry, SgfGameTree *tree)
     tree->node_to_switch_to = node;
 
   * find_property_link (node, property) = property->next;
+  sgf_node_update_property_mask (node);
+
+  if (AFFECTS_BOARD_STATE (property->type))
+    sgf_utils_forget_board_checkpoints_below (tree, node);
 }
 
 
@@ -894,6 +925,9 @@ sgf_operation_change_property_do_change (SgfUndoHistoryEntry *entry,
   if (!change_entry->side_effect)
     tree->node_to_switch_to = node;
 
+  if (AFFECTS_BOARD_STATE (property->type))
+    sgf_utils_forget_board_checkpoints_below (tree, node);
+
   switch (property_info[property->type].value_type) {
   case SGF_NUMBER:
   case SGF_DOUBLE:
@@ -986,13 +1020,13 @@ sgf_operation_change_property_free_data (SgfUndoHistoryEntry *entry,
     = ((SgfChangePropertyOperationEntry *) entry)->property;
   SgfValue *value = & ((SgfChangePropertyOperationEntry *) entry)->value;
 
-  UNUSED (tree);
   UNUSED (is_applied);
 
   /* We free the value unconditionally: if the entry has been undone,
    * it contains the new value, else---the original.
    */
-  sgf_property_free_value (property_info[property->type].value_type, value);
+  sgf_property_free_value (property_info[property->type].value_type, value,
+			   tree);
 }
 
 
@@ -1015,6 +1049,9 @@ sgf_operation_change_real_property_do_change (SgfUndoHistoryEntry *entry,
   if (!change_entry->side_effect)
     tree->node_to_switch_to = node;
 
+  if (AFFECTS_BOARD_STATE (property->type))
+    sgf_utils_forget_board_checkpoints_below (tree, node);
+
   temp_value		= *property->value.real;
   *property->value.real = change_entry->value;
   change_entry->value	= temp_value;
@@ -1028,6 +1065,9 @@ sgf_operation_custom_undo (SgfUndoHistoryEntry *entry, SgfGameTree *tree)
 {
   SgfCustomOperationEntry *custom_entry = (SgfCustomOperationEntry *) entry;
 
+  /* We cannot know what custom operations change. */
+  sgf_utils_forget_board_checkpoints (tree);
+
   if (custom_entry->entry_data->undo)
     custom_entry->entry_data->undo (custom_entry->user_data, tree);
 
@@ -1041,6 +1081,9 @@ sgf_operation_custom_redo (SgfUndoHistoryEntry *entry, SgfGameTree *tree)
 {
   SgfCustomOperationEntry *custom_entry = (SgfCustomOperationEntry *) entry;
 
+  /* We cannot know what custom operations change. */
+  sgf_utils_forget_board_checkpoints (tree);
+
   if (custom_entry->entry_data->redo)
     custom_entry->entry_data->redo (custom_entry->user_data, tree);
 
@@ -35,6 +35,53 @@
 #endif
 
 
+/* Board checkpoints are added at visited nodes with depth divisible
+ * by this number.
+ */
+#define BOARD_CHECKPOINT_INTERVAL	16
+
+/* Least recently used checkpoints are forgotten when memory used by a
+ * tree's checkpoints exceeds this limit.
+ */
+#define BOARD_CHECKPOINTS_MEMORY_LIMIT	(1024 * 1024)
+
+#define MIN_BOARD_CHECKPOINTS_HASH_SIZE	64
+
+#define BOARD_CHECKPOINT_HASH(node, hash_size)				\
+  ((((unsigned long) (node) >> 4) * 2654435761UL) & ((hash_size) - 1))
+
+#define BOARD_CHECKPOINT_SIZE(checkpoint)				\
+  (sizeof (SgfBoardCheckpoint)						\
+   + board_snapshot_get_size ((checkpoint)->snapshot))
+
+
+typedef struct _SgfBoardCheckpoint	SgfBoardCheckpoint;
+
+struct _SgfBoardCheckpoint {
+  SgfBoardCheckpoint	 *next_in_bucket;
+
+  /* Doubly linked list, ordered by the time of last use. */
+  SgfBoardCheckpoint	 *newer;
+  SgfBoardCheckpoint	 *older;
+
+  SgfNode		 *node;
+  int			  depth;
+
+  SgfBoardState		  board_state;
+  BoardSnapshot		 *snapshot;
+};
+
+struct _SgfBoardCheckpoints {
+  SgfBoardCheckpoint	**buckets;
+  int			  hash_size;
+  int			  num_checkpoints;
+  int			  memory_used;
+
+  SgfBoardCheckpoint	 *newest;
+  SgfBoardCheckpoint	 *oldest;
+};
+
+
 typedef int (* ValuesComparator) (const void *first_value,
 				  const void *second_value);
 
@@ -46,6 +93,19 @@ static void	add_horizontal_line (const SgfGameTree *tree,
 
 static void	do_enter_tree (SgfGameTree *tree, SgfNode *down_to);
 
+static SgfBoardCheckpoint *
+		find_board_checkpoint (SgfBoardCheckpoints *checkpoints,
+				       const SgfNode *node);
+static void	add_board_checkpoint (SgfGameTree *tree, SgfNode *node,
+				      int depth);
+static void	delete_board_checkpoint (SgfBoardCheckpoints *checkpoints,
+					 SgfBoardCheckpoint *checkpoint);
+static void	link_newest_board_checkpoint
+		  (SgfBoardCheckpoints *checkpoints,
+		   SgfBoardCheckpoint *checkpoint);
+static void	unlink_board_checkpoint (SgfBoardCheckpoints *checkpoints,
+					 SgfBoardCheckpoint *checkpoint);
+
 static void	find_board_state_data (const SgfGameTree *tree,
 				       SgfNode *node,
 				       int need_color_to_move,
@@ -63,6 +123,12 @@ static int	strings_are_equal (const void *first_string,
 				   const void *second_string);
 
 
+/* A fake SGF node used as parent of tree root when entering a tree,
+ * so that sgf_utils_descend_nodes() has something to descend from.
+ */
+static SgfNode	root_predecessor;
+
+
 inline void
 sgf_utils_play_node_move (const SgfNode *node, Board *board)
 {
@@ -117,15 +183,25 @@ sgf_utils_format_node_move (const SgfGameTree *tree, const SgfNode *node,
 }
 
 
+/* Enter the tree, parsing its remaining nodes if needed.  Errors
+ * found then are dropped; call sgf_parse_remaining_nodes() beforehand
+ * to get them.
+ */
 void
 sgf_utils_enter_tree (SgfGameTree *tree, Board *board,
 		      SgfBoardState *board_state)
 {
+  SgfErrorList *error_list;
+
   assert (tree);
   assert (tree->root);
   assert (tree->current_node);
   assert (board_state);
 
+  error_list = sgf_parse_remaining_nodes (tree);
+  if (error_list)
+    string_list_delete (error_list);
+
   tree->board	    = board;
   tree->board_state = board_state;
 
@@ -1677,14 +1753,48 @@ add_horizontal_line (const SgfGameTree *tree, StringBuffer *buffer,
 
 
 
+/* Set up tree's board and board state for node `down_to', which
+ * must be reachable from root by following current variations.  If
+ * there is a board checkpoint on the path, only moves below it are
+ * replayed.
+ */
 static void
 do_enter_tree (SgfGameTree *tree, SgfNode *down_to)
 {
-  static SgfNode root_predecessor;
   SgfBoardState *const board_state = tree->board_state;
+  SgfBoardCheckpoint *checkpoint = NULL;
   SgfNode *node;
   int num_nodes = 1;
 
+  for (node = tree->root; node != down_to; node = node->current_variation) {
+    assert (node);
+
+    if (tree->board_checkpoints
+	&& num_nodes > 1 && (num_nodes - 1) % BOARD_CHECKPOINT_INTERVAL == 0) {
+      SgfBoardCheckpoint *this_checkpoint
+	= find_board_checkpoint (tree->board_checkpoints, node);
+
+      if (this_checkpoint)
+	checkpoint = this_checkpoint;
+    }
+
+    num_nodes++;
+  }
+
+  if (checkpoint) {
+    board_restore_snapshot (tree->board, checkpoint->snapshot);
+    *board_state = checkpoint->board_state;
+
+    tree->current_node	     = checkpoint->node;
+    tree->current_node_depth = checkpoint->depth;
+
+    unlink_board_checkpoint (tree->board_checkpoints, checkpoint);
+    link_newest_board_checkpoint (tree->board_checkpoints, checkpoint);
+
+    sgf_utils_descend_nodes (tree, (num_nodes - 1) - checkpoint->depth);
+    return;
+  }
+
   board_set_parameters (tree->board, tree->game,
 			tree->board_width, tree->board_height);
 
@@ -1700,14 +1810,6 @@ do_enter_tree (SgfGameTree *tree, SgfNode *down_to)
   board_state->moves_left[BLACK_INDEX]	= -1;
   board_state->moves_left[WHITE_INDEX]	= -1;
 
-  for (node = tree->root; node != down_to; node = node->current_variation) {
-    assert (node);
-    num_nodes++;
-  }
-
-  /* Use a fake SGF node so that sgf_utils_descend_nodes() has
-   * something to descend from.
-   */
   root_predecessor.child	     = tree->root;
   root_predecessor.current_variation = tree->root;
   tree->current_node		     = &root_predecessor;
@@ -1805,6 +1907,23 @@ sgf_utils_descend_nodes (SgfGameTree *tree, int num_nodes)
       sgf_node_get_number_property_value (node, SGF_MOVE_NUMBER,
 					  (int *) &tree->board->move_number);
     }
+
+    /* Checkpoints are only added at real moves and setup nodes.  At
+     * passes, part of the move stack that is needed to detect game
+     * end would be lost on restoring.
+     */
+    if ((tree->current_node_depth - (num_nodes - 1))
+	% BOARD_CHECKPOINT_INTERVAL == 0
+	&& (node->move_color == SETUP_NODE
+	    || (IS_STONE (node->move_color)
+		&& !IS_PASS (node->move_point.x, node->move_point.y)))) {
+      int depth = tree->current_node_depth - (num_nodes - 1);
+
+      if (depth > 0
+	  && !(tree->board_checkpoints
+	       && find_board_checkpoint (tree->board_checkpoints, node)))
+	add_board_checkpoint (tree, node, depth);
+    }
   } while (--num_nodes != 0);
 
   if (node != tree->current_node) {
@@ -1835,7 +1954,11 @@ sgf_utils_ascend_nodes (SgfGameTree *tree, int num_nodes)
       board_state->last_main_variation_node = NULL;
   }
 
-  if (node->parent) {
+  /* The board might have been restored from a checkpoint below the
+   * node, in which case it cannot be undone that far.
+   */
+  if (node->parent
+      && board_get_num_undoable_moves (tree->board) >= num_nodes) {
     board_undo (tree->board, num_nodes);
 
     find_board_state_data (tree, node, 1, 1);
@@ -1851,7 +1974,219 @@ sgf_utils_ascend_nodes (SgfGameTree *tree, int num_nodes)
     determine_final_color_to_play (tree);
   }
   else
-    do_enter_tree (tree, tree->root);
+    do_enter_tree (tree, node);
+}
+
+
+/* Free all board checkpoints of the `tree'.  This must be done
+ * whenever the tree is changed in a way not limited to one subtree.
+ */
+void
+sgf_utils_forget_board_checkpoints (SgfGameTree *tree)
+{
+  SgfBoardCheckpoints *checkpoints = tree->board_checkpoints;
+
+  if (checkpoints) {
+    while (checkpoints->oldest)
+      delete_board_checkpoint (checkpoints, checkpoints->oldest);
+
+    utils_free (checkpoints->buckets);
+    utils_free (checkpoints);
+
+    tree->board_checkpoints = NULL;
+  }
+}
+
+
+/* Free board checkpoints at the `node' and below it.  This must be
+ * done whenever the `node' or its subtree is changed in a way that
+ * affects board positions.
+ */
+void
+sgf_utils_forget_board_checkpoints_below (SgfGameTree *tree,
+					  const SgfNode *node)
+{
+  SgfBoardCheckpoints *checkpoints = tree->board_checkpoints;
+  SgfBoardCheckpoint *checkpoint;
+  SgfBoardCheckpoint *older;
+  const SgfNode *scan;
+  int depth;
+
+  if (!checkpoints)
+    return;
+
+  if (!node->parent) {
+    sgf_utils_forget_board_checkpoints (tree);
+    return;
+  }
+
+  for (depth = 0, scan = node->parent; scan; scan = scan->parent)
+    depth++;
+
+  for (checkpoint = checkpoints->newest; checkpoint; checkpoint = older) {
+    older = checkpoint->older;
+
+    if (checkpoint->depth >= depth) {
+      int k;
+
+      for (k = checkpoint->depth - depth, scan = checkpoint->node;
+	   k > 0 && scan; k--)
+	scan = scan->parent;
+
+      if (scan == node)
+	delete_board_checkpoint (checkpoints, checkpoint);
+    }
+  }
+}
+
+
+static SgfBoardCheckpoint *
+find_board_checkpoint (SgfBoardCheckpoints *checkpoints, const SgfNode *node)
+{
+  SgfBoardCheckpoint *checkpoint
+    = checkpoints->buckets[BOARD_CHECKPOINT_HASH (node,
+						  checkpoints->hash_size)];
+
+  while (checkpoint && checkpoint->node != node)
+    checkpoint = checkpoint->next_in_bucket;
+
+  return checkpoint;
+}
+
+
+/* Add a checkpoint for the current board position, which must be at
+ * `node'.  This is called from sgf_utils_descend_nodes() in the middle
+ * of updating board state, so some of its fields are computed here.
+ */
+static void
+add_board_checkpoint (SgfGameTree *tree, SgfNode *node, int depth)
+{
+  SgfBoardCheckpoints *checkpoints = tree->board_checkpoints;
+  SgfBoardCheckpoint *checkpoint;
+  SgfBoardState *board_state = tree->board_state;
+  int bucket;
+
+  if (!checkpoints) {
+    checkpoints = utils_malloc (sizeof (SgfBoardCheckpoints));
+
+    checkpoints->hash_size	 = MIN_BOARD_CHECKPOINTS_HASH_SIZE;
+    checkpoints->buckets	 = utils_malloc0 (MIN_BOARD_CHECKPOINTS_HASH_SIZE
+						  * sizeof (SgfBoardCheckpoint *));
+    checkpoints->num_checkpoints = 0;
+    checkpoints->memory_used	 = 0;
+    checkpoints->newest		 = NULL;
+    checkpoints->oldest		 = NULL;
+
+    tree->board_checkpoints = checkpoints;
+  }
+
+  checkpoint		= utils_malloc (sizeof (SgfBoardCheckpoint));
+  checkpoint->node	= node;
+  checkpoint->depth	= depth;
+  checkpoint->snapshot	= board_snapshot_new (tree->board);
+
+  checkpoint->board_state = *board_state;
+  if (board_state->last_move_x != NULL_X) {
+    checkpoint->board_state.last_move_y
+      = board_state->last_move_node->move_point.y;
+  }
+  else
+    checkpoint->board_state.last_move_y = NULL_Y;
+
+  /* Time control data is only looked up after descending, so scan all
+   * the way up to root.
+   */
+  checkpoint->board_state.time_left[BLACK_INDEX]  = -1.0;
+  checkpoint->board_state.time_left[WHITE_INDEX]  = -1.0;
+  checkpoint->board_state.moves_left[BLACK_INDEX] = -1;
+  checkpoint->board_state.moves_left[WHITE_INDEX] = -1;
+
+  root_predecessor.child = tree->root;
+  tree->board_state	 = &checkpoint->board_state;
+  find_time_control_data (tree, &root_predecessor, node);
+  tree->board_state	 = board_state;
+
+  if (checkpoints->num_checkpoints >= checkpoints->hash_size) {
+    SgfBoardCheckpoint *scan;
+    int new_hash_size = 2 * checkpoints->hash_size;
+
+    utils_free (checkpoints->buckets);
+    checkpoints->buckets   = utils_malloc0 (new_hash_size
+					    * sizeof (SgfBoardCheckpoint *));
+    checkpoints->hash_size = new_hash_size;
+
+    for (scan = checkpoints->newest; scan; scan = scan->older) {
+      bucket = BOARD_CHECKPOINT_HASH (scan->node, new_hash_size);
+      scan->next_in_bucket	    = checkpoints->buckets[bucket];
+      checkpoints->buckets[bucket] = scan;
+    }
+  }
+
+  bucket = BOARD_CHECKPOINT_HASH (node, checkpoints->hash_size);
+  checkpoint->next_in_bucket	= checkpoints->buckets[bucket];
+  checkpoints->buckets[bucket] = checkpoint;
+
+  link_newest_board_checkpoint (checkpoints, checkpoint);
+
+  checkpoints->num_checkpoints++;
+  checkpoints->memory_used += BOARD_CHECKPOINT_SIZE (checkpoint);
+
+  while (checkpoints->memory_used > BOARD_CHECKPOINTS_MEMORY_LIMIT)
+    delete_board_checkpoint (checkpoints, checkpoints->oldest);
+}
+
+
+static void
+delete_board_checkpoint (SgfBoardCheckpoints *checkpoints,
+			 SgfBoardCheckpoint *checkpoint)
+{
+  SgfBoardCheckpoint **link
+    = &checkpoints->buckets[BOARD_CHECKPOINT_HASH (checkpoint->node,
+						   checkpoints->hash_size)];
+
+  while (*link != checkpoint)
+    link = &(*link)->next_in_bucket;
+
+  *link = checkpoint->next_in_bucket;
+  unlink_board_checkpoint (checkpoints, checkpoint);
+
+  checkpoints->num_checkpoints--;
+  checkpoints->memory_used -= BOARD_CHECKPOINT_SIZE (checkpoint);
+
+  board_snapshot_delete (checkpoint->snapshot);
+  utils_free (checkpoint);
+}
+
+
+static void
+link_newest_board_checkpoint (SgfBoardCheckpoints *checkpoints,
+			      SgfBoardCheckpoint *checkpoint)
+{
+  checkpoint->newer = NULL;
+  checkpoint->older = checkpoints->newest;
+
+  if (checkpoints->newest)
+    checkpoints->newest->newer = checkpoint;
+  else
+    checkpoints->oldest = checkpoint;
+
+  checkpoints->newest = checkpoint;
+}
+
+
+static void
+unlink_board_checkpoint (SgfBoardCheckpoints *checkpoints,
+			 SgfBoardCheckpoint *checkpoint)
+{
+  if (checkpoint->newer)
+    checkpoint->newer->older = checkpoint->older;
+  else
+    checkpoints->newest = checkpoint->older;
+
+  if (checkpoint->older)
+    checkpoint->older->newer = checkpoint->newer;
+  else
+    checkpoints->oldest = checkpoint->newer;
 }
 
 
@@ -2010,7 +2345,8 @@ do_set_pointer_property (SgfNode *node, SgfGameTree *tree, SgfType type,
 	SgfValue value;
 
 	value.memory_block = new_value;
-	sgf_property_free_value (property_info[type].value_type, &value);
+	sgf_property_free_value (property_info[type].value_type, &value,
+				 tree);
 	return 0;
       }
 
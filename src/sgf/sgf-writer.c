@@ -71,9 +71,20 @@ sgf_write_file (const char *filename, SgfCollection *collection,
 {
   SgfWritingData data;
   const char *initialization_error;
+  SgfGameTree *tree;
 
   assert (collection);
 
+  /* Lazily parsed trees may point into a mapping of the very file
+   * that is about to be overwritten.
+   */
+  for (tree = collection->first_tree; tree; tree = tree->next) {
+    SgfErrorList *error_list = sgf_parse_remaining_nodes (tree);
+
+    if (error_list)
+      string_list_delete (error_list);
+  }
+
   initialization_error = buffered_writer_init (&data.writer, filename,
 					       SGF_WRITER_BUFFER_SIZE);
   if (initialization_error)
@@ -130,13 +141,20 @@ write_collection (SgfWritingData *data, SgfCollection *collection,
 static void
 write_game_tree (SgfWritingData *data, SgfGameTree *tree, int force_utf8)
 {
-  SgfNode *root = tree->root;
+  SgfNode *root;
   const BoardPositionList *root_black_stones;
   const BoardPositionList *root_white_stones;
   BoardPositionList *black_stones;
   BoardPositionList *white_stones;
+  SgfErrorList *error_list;
   int default_setup_hidden = 0;
 
+  error_list = sgf_parse_remaining_nodes (tree);
+  if (error_list)
+    string_list_delete (error_list);
+
+  root = tree->root;
+
   buffered_writer_cprintf (&data->writer, "(;GM[%d]FF[4]\n", tree->game);
 
   if (force_utf8 || tree->char_set) {
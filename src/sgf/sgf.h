@@ -29,6 +29,10 @@
 #include "utils.h"
 #include "quarry.h"
 
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
 
 
 /* `sgf-tree.c' global declarations and functions. */
@@ -127,6 +131,7 @@ typedef void (* SgfUndoHistoryNotificationCallback)
   (SgfUndoHistory *undo_history, void *user_data);
 
 typedef struct _SgfGameTree			SgfGameTree;
+typedef struct _SgfBoardCheckpoints		SgfBoardCheckpoints;
 
 typedef void (* SgfCustomOperationEntryFunction) (void *user_data,
 						  SgfGameTree *tree);
@@ -143,6 +148,9 @@ typedef void (* SgfGameTreeNotificationCallback)
 
 typedef struct _SgfCollection			SgfCollection;
 
+typedef struct _SgfSnapshot			SgfSnapshot;
+typedef struct _SgfSourceText			SgfSourceText;
+
 typedef void (* SgfCollectionNotificationCallback) (SgfCollection *collection,
 						    void *user_data);
 
@@ -230,6 +238,15 @@ struct _SgfProperty {
 };
 
 
+/* Bit of SgfNode's `property_mask' for properties of given type.
+ * There are more property types than bits, so types 32 apart share a
+ * bit.  A node's mask has bits of all its properties set, therefore
+ * if a bit is clear, the node surely has no properties of its types.
+ * A set bit proves nothing and the property list has to be scanned.
+ */
+#define SGF_PROPERTY_MASK_BIT(type)	(1U << ((type) & 31))
+
+
 /* This strucuture is used for game-independent node access.  However,
  * accessing to game-specific fields (in `data' union) is only allowed
  * if the node belongs to game tree for corresponding game.  Otherwise
@@ -247,6 +264,8 @@ struct _SgfNode {
   unsigned int		  move_color : 2;
   BoardPoint		  move_point;
 
+  unsigned int		  property_mask;
+
   SgfNode		 *parent;
   SgfNode		 *child;
   SgfNode		 *next;
@@ -273,6 +292,8 @@ struct _SgfNodeGeneric {
   unsigned int		  move_color : 2;
   BoardPoint		  move_point;
 
+  unsigned int		  property_mask;
+
   SgfNode		 *parent;
   SgfNode		 *child;
   SgfNode		 *next;
@@ -292,6 +313,8 @@ struct _SgfNodeAmazons {
   unsigned int		  move_color : 2;
   BoardPoint		  move_point;
 
+  unsigned int		  property_mask;
+
   SgfNode		 *parent;
   SgfNode		 *child;
   SgfNode		 *next;
@@ -386,6 +409,12 @@ struct _SgfGameTree {
   Board			 *board;
   SgfBoardState		 *board_state;
 
+  /* Board snapshots at some of the visited nodes, used to enter the
+   * tree at an arbitrary node without replaying all moves from root.
+   * Private to `sgf-utils.c'.
+   */
+  SgfBoardCheckpoints	 *board_checkpoints;
+
   /* The currently active undo history. */
   SgfUndoHistory	 *undo_history;
 
@@ -405,6 +434,31 @@ struct _SgfGameTree {
   unsigned int		  could_undo : 1;
   unsigned int		  could_redo : 1;
 
+  /* If only the root node has been parsed so far (see
+   * `lazy_game_trees' parser parameter), the text of the whole game
+   * tree and its position in the file.  The text points into the
+   * source text of the collection, which the tree holds a reference
+   * to.  Use sgf_parse_remaining_nodes() to parse it.
+   */
+  const char		 *unparsed_text;
+  size_t		  unparsed_text_length;
+  int			  unparsed_text_line;
+  int			  unparsed_text_column;
+  SgfSourceText		 *source_text;
+
+  /* If the tree has been loaded from a snapshot and only its root
+   * node is decoded so far, the snapshot and index of the tree in it.
+   * sgf_parse_remaining_nodes() decodes the rest.
+   */
+  SgfSnapshot		 *snapshot;
+  int			  snapshot_tree_index;
+
+  /* Parser stores texts here rather than on the heap.  The arena is
+   * shared by all trees parsed from the same buffer.  Such texts must
+   * be neither modified nor freed; see sgf_property_free_value().
+   */
+  MemoryArena		 *value_arena;
+
   int			  file_format;
   char			 *char_set;
   char			 *application_name;
@@ -444,6 +498,13 @@ struct _SgfCollection {
   int			  num_modified_undo_histories;
   int			  is_irreversibly_modified;
 
+  /* Size and modification time of the file the collection has been
+   * parsed from, as they were when the file was opened.  Size is zero
+   * if the collection doesn't come from a file.
+   */
+  off_t			  source_file_size;
+  time_t		  source_file_mtime;
+
   SgfCollectionNotificationCallback  notification_callback;
   void			 *user_data;
 };
@@ -719,12 +780,57 @@ enum {
 
 typedef struct _SgfParserParameters	SgfParserParameters;
 
+typedef void (* SgfParsingJob) (void *job_data);
+typedef void (* SgfParsingJobRunner) (SgfParsingJob job, void **job_data,
+				      int num_jobs, void *runner_data);
+
 struct _SgfParserParameters {
-  int		max_buffer_size;
-  int		buffer_refresh_margin;
-  int		buffer_size_increment;
+  int		       max_buffer_size;
+  int		       buffer_refresh_margin;
+  int		       buffer_size_increment;
+
+  int		       first_column;
 
-  int		first_column;
+  /* If set and the whole input is in memory, only root nodes of game
+   * trees are parsed.  The rest of the trees is kept as text and
+   * parsed with the same parameters only when a tree is entered.
+   * The text is copied, so the file may change meanwhile.
+   */
+  int		       lazy_game_trees;
+
+  /* If set, moves and setup are not replayed on a board while
+   * parsing.  This is faster, but setup points without effect and
+   * senseless Amazons moves are then neither reported nor deleted.
+   * Use sgf_game_tree_validate() to find them later.
+   */
+  int		       skip_board_replay;
+
+  /* If set, big collections are split into parts parsed independently
+   * by calling `job' on every element of `job_data'.  The runner may
+   * run jobs in parallel threads, but must not return before all of
+   * them are complete.  Ignored if POSIX threads are not available.
+   */
+  SgfParsingJobRunner  run_jobs;
+  void		      *run_jobs_data;
+};
+
+
+/* Callbacks of sgf_read_file() and sgf_read_buffer().  Any of them
+ * can be NULL.  Game trees have `depth' 1, their variations have
+ * greater depths.  Property values are given as in the file, except
+ * that escapes and soft line breaks are removed, line breaks are
+ * normalized to LF and other whitespace to spaces.  No character set
+ * conversion is done.  `identifier' is only meaningful if `type' is
+ * SGF_UNKNOWN.  Value strings are only valid during the call.
+ */
+typedef struct _SgfReaderCallbacks	SgfReaderCallbacks;
+
+struct _SgfReaderCallbacks {
+  void (* begin_game_tree) (int depth, void *user_data);
+  void (* end_game_tree) (int depth, void *user_data);
+  void (* begin_node) (void *user_data);
+  void (* property_value) (SgfType type, const char *identifier,
+			   const char *value, void *user_data);
 };
 
 
@@ -774,15 +880,29 @@ int		 sgf_parse_file (const char *filename,
 				 SgfCollection **collection,
 				 SgfErrorList **error_list,
 				 const SgfParserParameters *parameters,
-				 int *file_size, int *bytes_parsed,
+				 off_t *file_size, off_t *bytes_parsed,
 				 const int *cancellation_flag);
-int		 sgf_parse_buffer (char *buffer, int size,
+int		 sgf_parse_buffer (char *buffer, size_t size,
 				   SgfCollection **collection,
 				   SgfErrorList **error_list,
 				   const SgfParserParameters *parameters,
-				   int *bytes_parsed,
+				   off_t *bytes_parsed,
 				   const int *cancellation_flag);
 
+SgfErrorList *	 sgf_parse_remaining_nodes (SgfGameTree *tree);
+SgfErrorList *	 sgf_game_tree_validate (SgfGameTree *tree);
+
+int		 sgf_read_file (const char *filename,
+				const SgfReaderCallbacks *callbacks,
+				void *user_data,
+				const SgfParserParameters *parameters,
+				off_t *file_size, off_t *bytes_parsed,
+				const int *cancellation_flag);
+int		 sgf_read_buffer (char *buffer, size_t size,
+				  const SgfReaderCallbacks *callbacks,
+				  void *user_data, off_t *bytes_parsed,
+				  const int *cancellation_flag);
+
 
 extern const SgfParserParameters	sgf_parser_defaults;
 
@@ -796,6 +916,18 @@ char *		 sgf_write_in_memory (SgfCollection *collection,
 				      int force_utf8, int *sgf_length);
 
 
+
+/* `sgf-snapshot.c' global functions. */
+
+char *		 sgf_write_snapshot (const char *filename,
+				     SgfCollection *collection,
+				     const char *source_filename);
+int		 sgf_load_snapshot (const char *filename,
+				    const char *source_filename,
+				    SgfCollection **collection,
+				    const SgfParserParameters *parameters);
+
+
 
 /* `sgf-utils.c' global declarations and functions. */
 
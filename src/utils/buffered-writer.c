@@ -29,6 +29,9 @@
  *
  * - Tracks current column in the output stream, thus making output
  *   formatting easier for higher level code.
+ *
+ * - Compresses output if file name has `.gz', `.xz' or `.zst'
+ *   extension (see `compressed-file.c').
  */
 
 
@@ -61,10 +64,27 @@ buffered_writer_init (BufferedWriter *writer,
   assert (writer);
   assert (buffer_size > MB_LEN_MAX);
 
+  writer->compressed_file = NULL;
+
   if (filename) {
+    CompressionFormat compression
+      = compression_format_from_filename (filename);
+
+    if (!compression_format_is_supported (compression))
+      return "Compression format is not supported";
+
     writer->file = fopen (filename, "wb");
     if (!writer->file)
       return strerror (errno);
+
+    if (compression != COMPRESSION_NONE) {
+      writer->compressed_file
+	= compressed_file_open_for_writing (writer->file, compression);
+      if (!writer->compressed_file) {
+	fclose (writer->file);
+	return strerror (ENOMEM);
+      }
+    }
   }
   else
     writer->file = stdout;
@@ -95,6 +115,7 @@ buffered_writer_init_memory (BufferedWriter *writer, size_t buffer_size)
   assert (buffer_size > sizeof (BufferedWriterChunkData) + MB_LEN_MAX);
 
   writer->file		 = NULL;
+  writer->compressed_file = NULL;
   writer->first_chunk    = utils_malloc (buffer_size);
 
   writer->buffer_size	 = buffer_size;
@@ -123,6 +144,15 @@ buffered_writer_dispose (BufferedWriter *writer)
   if (writer->buffer_pointer != writer->buffer)
     flush_buffer (writer);
 
+  if (writer->compressed_file) {
+    /* Even with empty buffer, compressor may have pending output. */
+    if (!compressed_file_close (writer->compressed_file)
+	&& writer->successful) {
+      writer->successful   = 0;
+      writer->error_string = utils_duplicate_string (strerror (errno));
+    }
+  }
+
   if (writer->file != stdout)
     fclose (writer->file);
 
@@ -293,9 +323,16 @@ buffered_writer_cat_as_string (BufferedWriter *writer,
       /* Dumb <iconv.h> doesn't apply `const' to input buffer?!  This
        * is nasty, but a warning for nothing is even worse.
        */
-      iconv (writer->iconv_handle,
-	     (char **) (void *) &buffer, &length,
-	     &writer->buffer_pointer, &output_bytes_left);
+      if (iconv (writer->iconv_handle,
+		 (char **) (void *) &buffer, &length,
+		 &writer->buffer_pointer, &output_bytes_left) == (size_t) -1
+	  && errno != E2BIG) {
+	/* Drop a byte that cannot be converted instead of looping
+	 * forever on it.
+	 */
+	buffer++;
+	length--;
+      }
 
       if (writer->buffer_pointer == writer->buffer_end)
 	flush_buffer (writer);
@@ -425,9 +462,17 @@ flush_buffer (BufferedWriter *writer)
 {
   if (writer->file) {
     if (writer->successful) {
-      writer->successful = fwrite (writer->buffer,
-				   writer->buffer_pointer - writer->buffer, 1,
-				   writer->file);
+      if (writer->compressed_file) {
+	writer->successful
+	  = compressed_file_write (writer->compressed_file, writer->buffer,
+				   writer->buffer_pointer - writer->buffer);
+      }
+      else {
+	writer->successful = fwrite (writer->buffer,
+				     writer->buffer_pointer - writer->buffer,
+				     1, writer->file);
+      }
+
       writer->buffer_pointer = writer->buffer;
 
       if (!writer->successful)
@@ -0,0 +1,697 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+ * This file is part of Quarry.                                    *
+ *                                                                 *
+ * Copyright (C) 2003, 2004, 2005, 2006 Paul Pogonyshev.           *
+ *                                                                 *
+ * This program is free software; you can redistribute it and/or   *
+ * modify it under the terms of the GNU General Public License as  *
+ * published by the Free Software Foundation; either version 2 of  *
+ * the License, or (at your option) any later version.             *
+ *                                                                 *
+ * This program is distributed in the hope that it will be useful, *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of  *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the   *
+ * GNU General Public License for more details.                    *
+ *                                                                 *
+ * You should have received a copy of the GNU General Public       *
+ * License along with this program; if not, write to the Free      *
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,     *
+ * Boston, MA 02110-1301, USA.                                     *
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Compressed files are streams of data in gzip, xz or zstd format,
+ * decompressed while reading or compressed while writing.  Each
+ * format is only supported if its library was found by `configure'.
+ *
+ * A compressed file is layered on top of an open stdio file and never
+ * seeks in it, so that pipes can be read and written too.  Closing a
+ * compressed file leaves the underlying file open.
+ *
+ * Errors are reported through `errno', like those of stdio functions.
+ * Corrupted compressed data sets it to EIO.
+ */
+
+
+#include "utils.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#if HAVE_ZLIB_H && HAVE_LIBZ
+/* Make `next_in' a pointer to constant, it is never written to. */
+#define ZLIB_CONST
+#include <zlib.h>
+#define USE_ZLIB	1
+#else
+#define USE_ZLIB	0
+#endif
+
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+#include <lzma.h>
+#define USE_LZMA	1
+#else
+#define USE_LZMA	0
+#endif
+
+#if HAVE_ZSTD_H && HAVE_LIBZSTD
+#include <zstd.h>
+#define USE_ZSTD	1
+#else
+#define USE_ZSTD	0
+#endif
+
+
+#define BUFFER_SIZE		0x10000
+
+
+struct _CompressedFile {
+  FILE			 *file;
+  CompressionFormat	  format;
+  int			  is_for_writing;
+
+  union {
+#if USE_ZLIB
+    z_stream		  zlib;
+#endif
+#if USE_LZMA
+    lzma_stream		  lzma;
+#endif
+#if USE_ZSTD
+    ZSTD_DCtx		 *zstd_decoder;
+    ZSTD_CCtx		 *zstd_encoder;
+#endif
+    int			  dummy;
+  } stream;
+
+  /* Set when the decoder has reached end of compressed data and
+   * wouldn't produce any more output unless given more input.
+   */
+  int			  stream_is_complete;
+  int			  end_of_file;
+
+  /* When reading, the unused compressed input.  When writing,
+   * compressed output not yet written to the file.
+   */
+  char			 *buffer_pointer;
+  char			 *buffer_end;
+  char			  buffer[BUFFER_SIZE];
+};
+
+
+static int	fill_buffer (CompressedFile *file);
+static int	flush_buffer (CompressedFile *file);
+
+static int	decompress_data (CompressedFile *file,
+			    char **output, const char *output_end);
+static int	compress_data (CompressedFile *file,
+			  const char **input, const char *input_end,
+			  int finish);
+
+
+
+/* Determine compression format from the first bytes of a file.  At
+ * least COMPRESSION_MAGIC_LENGTH bytes should be given, unless the
+ * file is shorter.
+ */
+CompressionFormat
+compression_format_from_magic (const char *buffer, int length)
+{
+  const unsigned char *bytes = (const unsigned char *) buffer;
+
+  assert (buffer);
+
+  if (length >= 2 && bytes[0] == 0x1F && bytes[1] == 0x8B)
+    return COMPRESSION_GZIP;
+
+  if (length >= 6 && memcmp (bytes, "\xFD" "7zXZ\0", 6) == 0)
+    return COMPRESSION_XZ;
+
+  if (length >= 4 && memcmp (bytes, "\x28\xB5\x2F\xFD", 4) == 0)
+    return COMPRESSION_ZSTD;
+
+  return COMPRESSION_NONE;
+}
+
+
+/* Determine compression format from file name extension. */
+CompressionFormat
+compression_format_from_filename (const char *filename)
+{
+  int length;
+
+  assert (filename);
+
+  length = strlen (filename);
+
+  if (length > 3 && strcmp (filename + length - 3, ".gz") == 0)
+    return COMPRESSION_GZIP;
+
+  if (length > 3 && strcmp (filename + length - 3, ".xz") == 0)
+    return COMPRESSION_XZ;
+
+  if (length > 4 && strcmp (filename + length - 4, ".zst") == 0)
+    return COMPRESSION_ZSTD;
+
+  return COMPRESSION_NONE;
+}
+
+
+int
+compression_format_is_supported (CompressionFormat format)
+{
+  switch (format) {
+  case COMPRESSION_NONE:
+    return 1;
+
+  case COMPRESSION_GZIP:
+    return USE_ZLIB;
+
+  case COMPRESSION_XZ:
+    return USE_LZMA;
+
+  case COMPRESSION_ZSTD:
+    return USE_ZSTD;
+  }
+
+  return 0;
+}
+
+
+
+/* Start decompressing data from `file', which must be open for
+ * reading.  Returns NULL if the format is not supported or the
+ * decoder cannot be initialized.
+ */
+CompressedFile *
+compressed_file_open_for_reading (FILE *file, CompressionFormat format)
+{
+  CompressedFile *compressed_file;
+  int success = 0;
+
+  assert (file);
+
+  if (format == COMPRESSION_NONE || !compression_format_is_supported (format))
+    return NULL;
+
+  compressed_file = utils_malloc (sizeof (CompressedFile));
+
+  compressed_file->file		      = file;
+  compressed_file->format	      = format;
+  compressed_file->is_for_writing     = 0;
+  compressed_file->stream_is_complete = 0;
+  compressed_file->end_of_file	      = 0;
+  compressed_file->buffer_pointer     = compressed_file->buffer;
+  compressed_file->buffer_end	      = compressed_file->buffer;
+
+  switch (format) {
+#if USE_ZLIB
+  case COMPRESSION_GZIP:
+    memset (&compressed_file->stream.zlib, 0, sizeof (z_stream));
+
+    /* Adding 16 to window bits selects gzip format. */
+    success = (inflateInit2 (&compressed_file->stream.zlib, 15 + 16)
+	       == Z_OK);
+    break;
+#endif
+
+#if USE_LZMA
+  case COMPRESSION_XZ:
+    {
+      lzma_stream initializer = LZMA_STREAM_INIT;
+
+      compressed_file->stream.lzma = initializer;
+      success = (lzma_stream_decoder (&compressed_file->stream.lzma,
+				      UINT64_MAX, LZMA_CONCATENATED)
+		 == LZMA_OK);
+    }
+
+    break;
+#endif
+
+#if USE_ZSTD
+  case COMPRESSION_ZSTD:
+    compressed_file->stream.zstd_decoder = ZSTD_createDCtx ();
+    success = (compressed_file->stream.zstd_decoder != NULL);
+    break;
+#endif
+
+  default:
+    break;
+  }
+
+  if (!success) {
+    utils_free (compressed_file);
+    return NULL;
+  }
+
+  return compressed_file;
+}
+
+
+/* Start compressing data to `file', which must be open for writing.
+ * Returns NULL if the format is not supported or the encoder cannot
+ * be initialized.
+ */
+CompressedFile *
+compressed_file_open_for_writing (FILE *file, CompressionFormat format)
+{
+  CompressedFile *compressed_file;
+  int success = 0;
+
+  assert (file);
+
+  if (format == COMPRESSION_NONE || !compression_format_is_supported (format))
+    return NULL;
+
+  compressed_file = utils_malloc (sizeof (CompressedFile));
+
+  compressed_file->file		      = file;
+  compressed_file->format	      = format;
+  compressed_file->is_for_writing     = 1;
+  compressed_file->stream_is_complete = 0;
+  compressed_file->end_of_file	      = 0;
+  compressed_file->buffer_pointer     = compressed_file->buffer;
+  compressed_file->buffer_end	      = compressed_file->buffer + BUFFER_SIZE;
+
+  switch (format) {
+#if USE_ZLIB
+  case COMPRESSION_GZIP:
+    memset (&compressed_file->stream.zlib, 0, sizeof (z_stream));
+    success = (deflateInit2 (&compressed_file->stream.zlib,
+			     Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+			     8, Z_DEFAULT_STRATEGY)
+	       == Z_OK);
+    break;
+#endif
+
+#if USE_LZMA
+  case COMPRESSION_XZ:
+    {
+      lzma_stream initializer = LZMA_STREAM_INIT;
+
+      compressed_file->stream.lzma = initializer;
+      success = (lzma_easy_encoder (&compressed_file->stream.lzma,
+				    LZMA_PRESET_DEFAULT, LZMA_CHECK_CRC64)
+		 == LZMA_OK);
+    }
+
+    break;
+#endif
+
+#if USE_ZSTD
+  case COMPRESSION_ZSTD:
+    compressed_file->stream.zstd_encoder = ZSTD_createCCtx ();
+    success = (compressed_file->stream.zstd_encoder != NULL);
+    break;
+#endif
+
+  default:
+    break;
+  }
+
+  if (!success) {
+    utils_free (compressed_file);
+    return NULL;
+  }
+
+  return compressed_file;
+}
+
+
+/* Finish the compressed stream if writing and free the file.  The
+ * underlying stdio file is not closed.  Returns zero if any data
+ * could not be written.
+ */
+int
+compressed_file_close (CompressedFile *file)
+{
+  int success = 1;
+
+  assert (file);
+
+  if (file->is_for_writing) {
+    const char *input = NULL;
+
+    while ((success = compress_data (file, &input, NULL, 1)) == 0) {
+      if (!flush_buffer (file))
+	break;
+    }
+
+    success = (success == 1 && flush_buffer (file));
+  }
+
+  switch (file->format) {
+#if USE_ZLIB
+  case COMPRESSION_GZIP:
+    if (file->is_for_writing)
+      deflateEnd (&file->stream.zlib);
+    else
+      inflateEnd (&file->stream.zlib);
+
+    break;
+#endif
+
+#if USE_LZMA
+  case COMPRESSION_XZ:
+    lzma_end (&file->stream.lzma);
+    break;
+#endif
+
+#if USE_ZSTD
+  case COMPRESSION_ZSTD:
+    if (file->is_for_writing)
+      ZSTD_freeCCtx (file->stream.zstd_encoder);
+    else
+      ZSTD_freeDCtx (file->stream.zstd_decoder);
+
+    break;
+#endif
+
+  default:
+    assert (0);
+  }
+
+  utils_free (file);
+
+  return success;
+}
+
+
+/* Read up to `size' bytes of decompressed data.  Like fread(), this
+ * function returns less than `size' only at the end of the file.
+ * Returns -1 on errors, including truncated compressed data.
+ */
+ssize_t
+compressed_file_read (CompressedFile *file, char *buffer, size_t size)
+{
+  char *output = buffer;
+  const char *output_end = buffer + size;
+
+  assert (file);
+  assert (!file->is_for_writing);
+  assert (buffer);
+
+  while (output < output_end) {
+    const char *input_pointer = file->buffer_pointer;
+    const char *output_pointer = output;
+
+    if (file->buffer_pointer == file->buffer_end) {
+      if (!file->end_of_file && !fill_buffer (file))
+	return -1;
+
+      if (file->end_of_file && file->stream_is_complete)
+	break;
+    }
+
+    if (!decompress_data (file, &output, output_end))
+      return -1;
+
+    if (output == output_pointer && file->buffer_pointer == input_pointer
+	&& file->end_of_file && !file->stream_is_complete) {
+      /* The decoder needs more input, but there is none. */
+      errno = EIO;
+      return -1;
+    }
+  }
+
+  return output - buffer;
+}
+
+
+/* Compress and write `length' bytes at `buffer'.  Returns zero on
+ * errors.
+ */
+int
+compressed_file_write (CompressedFile *file, const char *buffer, int length)
+{
+  const char *input_end = buffer + length;
+
+  assert (file);
+  assert (file->is_for_writing);
+  assert (buffer);
+  assert (length >= 0);
+
+  while (buffer < input_end) {
+    if (compress_data (file, &buffer, input_end, 0) == -1)
+      return 0;
+
+    if (file->buffer_pointer == file->buffer_end && !flush_buffer (file))
+      return 0;
+  }
+
+  return 1;
+}
+
+
+
+static int
+fill_buffer (CompressedFile *file)
+{
+  size_t bytes_read = fread (file->buffer, 1, BUFFER_SIZE, file->file);
+
+  if (bytes_read == 0) {
+    if (ferror (file->file))
+      return 0;
+
+    file->end_of_file = 1;
+  }
+
+  file->buffer_pointer = file->buffer;
+  file->buffer_end     = file->buffer + bytes_read;
+
+  return 1;
+}
+
+
+static int
+flush_buffer (CompressedFile *file)
+{
+  size_t length = file->buffer_pointer - file->buffer;
+
+  file->buffer_pointer = file->buffer;
+
+  return (length == 0 || fwrite (file->buffer, length, 1, file->file) == 1);
+}
+
+
+/* Decompress as much of the buffered input as fits between `*output'
+ * and `output_end', advancing both.  Returns zero on errors.
+ */
+static int
+decompress_data (CompressedFile *file, char **output, const char *output_end)
+{
+  switch (file->format) {
+#if USE_ZLIB
+  case COMPRESSION_GZIP:
+    {
+      z_stream *stream = &file->stream.zlib;
+      int result;
+
+      if (file->stream_is_complete) {
+	/* Another gzip member follows. */
+	if (inflateReset (stream) != Z_OK)
+	  break;
+
+	file->stream_is_complete = 0;
+      }
+
+      stream->next_in	= (const Bytef *) file->buffer_pointer;
+      stream->avail_in	= file->buffer_end - file->buffer_pointer;
+      stream->next_out	= (Bytef *) *output;
+      stream->avail_out = MIN (output_end - *output, UINT_MAX);
+
+      result = inflate (stream, Z_NO_FLUSH);
+
+      file->buffer_pointer = file->buffer_end - stream->avail_in;
+      *output		   = (char *) stream->next_out;
+
+      if (result == Z_STREAM_END)
+	file->stream_is_complete = 1;
+      else if (result != Z_OK && result != Z_BUF_ERROR)
+	break;
+
+      return 1;
+    }
+#endif
+
+#if USE_LZMA
+  case COMPRESSION_XZ:
+    {
+      lzma_stream *stream = &file->stream.lzma;
+      lzma_ret result;
+
+      stream->next_in	= (const uint8_t *) file->buffer_pointer;
+      stream->avail_in	= file->buffer_end - file->buffer_pointer;
+      stream->next_out	= (uint8_t *) *output;
+      stream->avail_out = output_end - *output;
+
+      /* In concatenated mode the decoder only reports stream end
+       * after being told there is no more input.
+       */
+      result = lzma_code (stream,
+			  file->end_of_file ? LZMA_FINISH : LZMA_RUN);
+
+      file->buffer_pointer = file->buffer_end - stream->avail_in;
+      *output		   = (char *) stream->next_out;
+
+      if (result == LZMA_STREAM_END)
+	file->stream_is_complete = 1;
+      else if (result != LZMA_OK && result != LZMA_BUF_ERROR)
+	break;
+
+      return 1;
+    }
+#endif
+
+#if USE_ZSTD
+  case COMPRESSION_ZSTD:
+    {
+      ZSTD_inBuffer input;
+      ZSTD_outBuffer output_buffer;
+      size_t result;
+
+      input.src		   = file->buffer_pointer;
+      input.size	   = file->buffer_end - file->buffer_pointer;
+      input.pos		   = 0;
+      output_buffer.dst	   = *output;
+      output_buffer.size   = output_end - *output;
+      output_buffer.pos	   = 0;
+
+      result = ZSTD_decompressStream (file->stream.zstd_decoder,
+				      &output_buffer, &input);
+
+      file->buffer_pointer += input.pos;
+      *output		   += output_buffer.pos;
+
+      if (ZSTD_isError (result))
+	break;
+
+      /* Zero result means a frame is complete and fully flushed. */
+      file->stream_is_complete = (result == 0);
+
+      return 1;
+    }
+#endif
+
+  default:
+    UNUSED (output);
+    UNUSED (output_end);
+    assert (0);
+  }
+
+  errno = EIO;
+  return 0;
+}
+
+
+/* Compress input between `*input' and `input_end', advancing
+ * `*input'.  Output is stored in the buffer until it is full.  If
+ * `finish' is set, input must be empty and the compressed stream is
+ * terminated instead.  Returns 1 if the stream is finished, -1 on
+ * errors and zero otherwise.
+ */
+static int
+compress_data (CompressedFile *file, const char **input, const char *input_end,
+	  int finish)
+{
+  switch (file->format) {
+#if USE_ZLIB
+  case COMPRESSION_GZIP:
+    {
+      z_stream *stream = &file->stream.zlib;
+      int result;
+
+      stream->next_in	= (const Bytef *) *input;
+      stream->avail_in	= input_end - *input;
+      stream->next_out	= (Bytef *) file->buffer_pointer;
+      stream->avail_out = file->buffer_end - file->buffer_pointer;
+
+      result = deflate (stream, finish ? Z_FINISH : Z_NO_FLUSH);
+
+      *input		   = (const char *) stream->next_in;
+      file->buffer_pointer = (char *) stream->next_out;
+
+      if (result == Z_STREAM_END)
+	return 1;
+
+      if (result != Z_OK && result != Z_BUF_ERROR)
+	break;
+
+      return 0;
+    }
+#endif
+
+#if USE_LZMA
+  case COMPRESSION_XZ:
+    {
+      lzma_stream *stream = &file->stream.lzma;
+      lzma_ret result;
+
+      stream->next_in	= (const uint8_t *) *input;
+      stream->avail_in	= input_end - *input;
+      stream->next_out	= (uint8_t *) file->buffer_pointer;
+      stream->avail_out = file->buffer_end - file->buffer_pointer;
+
+      result = lzma_code (stream, finish ? LZMA_FINISH : LZMA_RUN);
+
+      *input		   = (const char *) stream->next_in;
+      file->buffer_pointer = (char *) stream->next_out;
+
+      if (result == LZMA_STREAM_END)
+	return 1;
+
+      if (result != LZMA_OK && result != LZMA_BUF_ERROR)
+	break;
+
+      return 0;
+    }
+#endif
+
+#if USE_ZSTD
+  case COMPRESSION_ZSTD:
+    {
+      ZSTD_inBuffer input_buffer;
+      ZSTD_outBuffer output;
+      size_t result;
+
+      input_buffer.src  = *input;
+      input_buffer.size = input_end - *input;
+      input_buffer.pos  = 0;
+      output.dst	= file->buffer_pointer;
+      output.size	= file->buffer_end - file->buffer_pointer;
+      output.pos	= 0;
+
+      result = ZSTD_compressStream2 (file->stream.zstd_encoder,
+				     &output, &input_buffer,
+				     finish ? ZSTD_e_end : ZSTD_e_continue);
+
+      *input		   += input_buffer.pos;
+      file->buffer_pointer += output.pos;
+
+      if (ZSTD_isError (result))
+	break;
+
+      return (finish && result == 0);
+    }
+#endif
+
+  default:
+    UNUSED (input);
+    UNUSED (input_end);
+    UNUSED (finish);
+    assert (0);
+  }
+
+  errno = EIO;
+  return -1;
+}
+
+
+/*
+ * Local Variables:
+ * tab-width: 8
+ * c-basic-offset: 2
+ * End:
+ */
@@ -0,0 +1,375 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+ * This file is part of Quarry.                                    *
+ *                                                                 *
+ * Copyright (C) 2003, 2004, 2005, 2006 Paul Pogonyshev.           *
+ *                                                                 *
+ * This program is free software; you can redistribute it and/or   *
+ * modify it under the terms of the GNU General Public License as  *
+ * published by the Free Software Foundation; either version 2 of  *
+ * the License, or (at your option) any later version.             *
+ *                                                                 *
+ * This program is distributed in the hope that it will be useful, *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of  *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the   *
+ * GNU General Public License for more details.                    *
+ *                                                                 *
+ * You should have received a copy of the GNU General Public       *
+ * License along with this program; if not, write to the Free      *
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor,     *
+ * Boston, MA 02110-1301, USA.                                     *
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Memory arenas store large numbers of strings that are never
+ * modified or freed one by one (e.g. values of parsed SGF
+ * properties).  Strings are simply appended to the current block, so
+ * there is no per-string overhead.  Blocks grow geometrically, which
+ * keeps their number, and so memory_arena_owns() time, low.
+ *
+ * Strings can also be ``interned'': equal interned strings share one
+ * copy.  This is beneficial for values that repeat often, like player
+ * names or application names in game collections.
+ *
+ * An arena is reference counted and is freed as a whole when the last
+ * reference is dropped.  Code that stores both arena and heap strings
+ * in same places must use memory_arena_owns() to tell if a string
+ * needs freeing.  Blocks are also kept in an array sorted by address,
+ * so that the check is a binary search: it is done for every string
+ * when a big game collection is deleted.
+ *
+ * Reference counts are not atomic, so an arena must never be shared
+ * by trees used from different threads.
+ */
+
+
+#include "utils.h"
+
+#include <assert.h>
+#include <string.h>
+
+
+#define MIN_BLOCK_SIZE			0x1000
+#define MAX_BLOCK_SIZE			0x100000
+
+#define INITIAL_INTERN_TABLE_SIZE	0x100
+#define SORTED_BLOCKS_INCREMENT		0x20
+
+
+typedef struct _MemoryArenaBlock	MemoryArenaBlock;
+typedef struct _InternedString		InternedString;
+
+struct _MemoryArenaBlock {
+  MemoryArenaBlock	 *next;
+  const char		 *end;
+
+  char			  memory[1];
+};
+
+/* Interned strings are stored in the arena too, right after their
+ * table entries.
+ */
+struct _InternedString {
+  InternedString	 *next;
+  unsigned int		  hash;
+  int			  length;
+
+  char			  string[1];
+};
+
+struct _MemoryArena {
+  int			  reference_count;
+
+  /* The first block is the one being filled. */
+  MemoryArenaBlock	 *first_block;
+  char			 *free_pointer;
+  int			  next_block_size;
+
+  MemoryArenaBlock	**sorted_blocks;
+  int			  num_blocks;
+  int			  sorted_blocks_size;
+
+  InternedString	**intern_table;
+  int			  intern_table_size;
+  int			  num_interned_strings;
+};
+
+
+static char *	allocate (MemoryArena *arena, int size, int alignment);
+static void	add_sorted_block (MemoryArena *arena,
+				  MemoryArenaBlock *block);
+static void	grow_intern_table (MemoryArena *arena);
+
+
+
+/* Create a new empty arena with reference count of one. */
+MemoryArena *
+memory_arena_new (void)
+{
+  MemoryArena *arena = utils_malloc (sizeof (MemoryArena));
+
+  arena->reference_count      = 1;
+
+  arena->first_block	      = NULL;
+  arena->free_pointer	      = NULL;
+  arena->next_block_size      = MIN_BLOCK_SIZE;
+
+  arena->sorted_blocks	      = NULL;
+  arena->num_blocks	      = 0;
+  arena->sorted_blocks_size   = 0;
+
+  arena->intern_table	      = NULL;
+  arena->intern_table_size    = 0;
+  arena->num_interned_strings = 0;
+
+  return arena;
+}
+
+
+MemoryArena *
+memory_arena_ref (MemoryArena *arena)
+{
+  assert (arena);
+
+  arena->reference_count++;
+  return arena;
+}
+
+
+/* Drop a reference to the arena.  When the last one is dropped, the
+ * arena and all strings stored in it are freed.
+ */
+void
+memory_arena_unref (MemoryArena *arena)
+{
+  MemoryArenaBlock *block;
+
+  assert (arena);
+  assert (arena->reference_count > 0);
+
+  if (--arena->reference_count > 0)
+    return;
+
+  for (block = arena->first_block; block;) {
+    MemoryArenaBlock *next_block = block->next;
+
+    utils_free (block);
+    block = next_block;
+  }
+
+  utils_free (arena->sorted_blocks);
+  utils_free (arena->intern_table);
+  utils_free (arena);
+}
+
+
+/* Store a zero-terminated copy of `length' characters at `buffer' in
+ * the arena.  The copy must never be modified or freed.
+ */
+char *
+memory_arena_duplicate_as_string (MemoryArena *arena,
+				  const char *buffer, int length)
+{
+  char *string;
+
+  assert (arena);
+  assert (buffer);
+  assert (length >= 0);
+
+  string = allocate (arena, length + 1, 1);
+  memcpy (string, buffer, length);
+  string[length] = 0;
+
+  return string;
+}
+
+
+/* Same as memory_arena_duplicate_as_string(), but if an equal string
+ * has been interned in the arena before, return it instead of making
+ * another copy.
+ */
+char *
+memory_arena_intern_as_string (MemoryArena *arena,
+			       const char *buffer, int length)
+{
+  InternedString **link;
+  InternedString *entry;
+  unsigned int hash = 0;
+  int k;
+
+  assert (arena);
+  assert (buffer);
+  assert (length >= 0);
+
+  for (k = 0; k < length; k++)
+    hash = hash * 31 + (unsigned char) buffer[k];
+
+  if (arena->intern_table) {
+    for (entry = arena->intern_table[hash & (arena->intern_table_size - 1)];
+	 entry; entry = entry->next) {
+      if (entry->hash == hash && entry->length == length
+	  && memcmp (entry->string, buffer, length) == 0)
+	return entry->string;
+    }
+  }
+
+  if (arena->num_interned_strings >= arena->intern_table_size)
+    grow_intern_table (arena);
+
+  link	= arena->intern_table + (hash & (arena->intern_table_size - 1));
+  entry = (InternedString *) allocate (arena,
+				       sizeof (InternedString) + length,
+				       sizeof (void *));
+
+  entry->next	= *link;
+  entry->hash	= hash;
+  entry->length = length;
+
+  memcpy (entry->string, buffer, length);
+  entry->string[length] = 0;
+
+  *link = entry;
+  arena->num_interned_strings++;
+
+  return entry->string;
+}
+
+
+/* Determine if `pointer' points to a string stored in the arena.  The
+ * time taken is logarithmic in the number of blocks.
+ */
+int
+memory_arena_owns (const MemoryArena *arena, const void *pointer)
+{
+  int low = 0;
+  int high;
+
+  assert (arena);
+
+  /* Find the last block starting at or before `pointer'. */
+  high = arena->num_blocks;
+  while (low < high) {
+    int middle = (low + high) / 2;
+
+    if ((const char *) pointer >= arena->sorted_blocks[middle]->memory)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return (low > 0
+	  && (const char *) pointer < arena->sorted_blocks[low - 1]->end);
+}
+
+
+
+/* Allocate `size' bytes aligned at `alignment', which must be a
+ * power of two.  Large allocations get blocks of their own, so that
+ * space left in the current block is not wasted.
+ */
+static char *
+allocate (MemoryArena *arena, int size, int alignment)
+{
+  MemoryArenaBlock *block = arena->first_block;
+  char *memory;
+
+  if (block) {
+    memory = ((char *) (((unsigned long) arena->free_pointer
+			 + alignment - 1)
+			& ~((unsigned long) alignment - 1)));
+    if (block->end - memory >= size) {
+      arena->free_pointer = memory + size;
+      return memory;
+    }
+  }
+
+  if (size > MAX_BLOCK_SIZE / 4 && block) {
+    block = utils_malloc (sizeof (MemoryArenaBlock) + size);
+    block->end = block->memory + size;
+
+    block->next		     = arena->first_block->next;
+    arena->first_block->next = block;
+
+    add_sorted_block (arena, block);
+
+    return block->memory;
+  }
+
+  block = utils_malloc (sizeof (MemoryArenaBlock)
+			+ MAX (arena->next_block_size, size));
+  block->end  = block->memory + MAX (arena->next_block_size, size);
+  block->next = arena->first_block;
+
+  if (arena->next_block_size < MAX_BLOCK_SIZE)
+    arena->next_block_size *= 2;
+
+  arena->first_block  = block;
+  arena->free_pointer = block->memory + size;
+
+  add_sorted_block (arena, block);
+
+  return block->memory;
+}
+
+
+static void
+add_sorted_block (MemoryArena *arena, MemoryArenaBlock *block)
+{
+  int k;
+
+  if (arena->num_blocks == arena->sorted_blocks_size) {
+    arena->sorted_blocks_size += SORTED_BLOCKS_INCREMENT;
+    arena->sorted_blocks = utils_realloc (arena->sorted_blocks,
+					  (arena->sorted_blocks_size
+					   * sizeof (MemoryArenaBlock *)));
+  }
+
+  for (k = arena->num_blocks; k > 0; k--) {
+    if (arena->sorted_blocks[k - 1]->memory < block->memory)
+      break;
+
+    arena->sorted_blocks[k] = arena->sorted_blocks[k - 1];
+  }
+
+  arena->sorted_blocks[k] = block;
+  arena->num_blocks++;
+}
+
+
+static void
+grow_intern_table (MemoryArena *arena)
+{
+  int new_size = (arena->intern_table_size
+		  ? arena->intern_table_size * 2 : INITIAL_INTERN_TABLE_SIZE);
+  InternedString **new_table = utils_malloc (new_size
+					     * sizeof (InternedString *));
+  int k;
+
+  for (k = 0; k < new_size; k++)
+    new_table[k] = NULL;
+
+  for (k = 0; k < arena->intern_table_size; k++) {
+    InternedString *entry;
+
+    for (entry = arena->intern_table[k]; entry;) {
+      InternedString *next_entry = entry->next;
+      InternedString **link = new_table + (entry->hash & (new_size - 1));
+
+      entry->next = *link;
+      *link	  = entry;
+
+      entry = next_entry;
+    }
+  }
+
+  utils_free (arena->intern_table);
+
+  arena->intern_table	   = new_table;
+  arena->intern_table_size = new_size;
+}
+
+
+/*
+ * Local Variables:
+ * tab-width: 8
+ * c-basic-offset: 2
+ * End:
+ */
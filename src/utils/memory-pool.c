@@ -21,7 +21,9 @@
 
 /* Memory pools are used for storing large numbers of small items of
  * same size (e.g. SGF nodes and properties).  They store the items in
- * chunks, each consisting of NUM_ITEMS_IN_CHUNK items.
+ * chunks.  The first chunk has MIN_ITEMS_IN_CHUNK items and each next
+ * one is twice as large, up to MAX_ITEMS_IN_CHUNK items.  So small
+ * pools stay small, while large pools need few chunks.
  *
  * The advantages are:
  *
@@ -53,6 +55,13 @@
  * Knowing the above, it is possible to say if an item in chunk is
  * free (provided that you have a pointer to chunk).  This fact is
  * used in item traversing.
+ *
+ *
+ * Pools are not locked.  Instead, each pool must only be used by one
+ * thread at a time, which is simple because pools are embedded in
+ * structures they serve (e.g. SGF game trees.)  A worker thread can
+ * build such a structure and then pass it, together with its pools,
+ * to another thread through any synchronized queue.
  */
 
 
@@ -70,7 +79,11 @@
 #endif
 
 
-static MemoryChunk *  memory_chunk_new (int item_size, int index_field_offset);
+/* Size of chunk header, i.e. offset of the first item in chunk. */
+#define CHUNK_HEADER_SIZE	STRUCTURE_FIELD_OFFSET (MemoryChunk, memory)
+
+
+static MemoryChunk *  memory_chunk_new (MemoryPool *pool);
 
 
 #if ENABLE_MEMORY_PROFILING
@@ -96,10 +109,11 @@ memory_pool_init (MemoryPool *pool, int item_size, int index_field_offset)
   assert (item_size > 0);
   assert (0 <= index_field_offset && index_field_offset < item_size);
 
-  pool->item_size	   = item_size;
-  pool->index_field_offset = index_field_offset;
+  pool->item_size		= item_size;
+  pool->index_field_offset	= index_field_offset;
+  pool->num_items_in_next_chunk = MIN_ITEMS_IN_CHUNK;
 
-  chunk = memory_chunk_new (item_size, index_field_offset);
+  chunk = memory_chunk_new (pool);
   chunk->next = NULL;
   chunk->previous = NULL;
 
@@ -111,10 +125,10 @@ memory_pool_init (MemoryPool *pool, int item_size, int index_field_offset)
   pool->number = ++num_pools_initialized;
   fprintf (stderr, ("Memory pool number %d initialized:\n"
 		    "  size of item:  %6d bytes\n"
-		    "  size of chunk: %6d bytes\n\n"),
+		    "  size of chunk: %6d to %d bytes\n\n"),
 	   pool->number, item_size,
-	   (sizeof (MemoryChunk) - sizeof (int)
-	    + NUM_ITEMS_IN_CHUNK * item_size));
+	   (int) (CHUNK_HEADER_SIZE + MIN_ITEMS_IN_CHUNK * item_size),
+	   (int) (CHUNK_HEADER_SIZE + MAX_ITEMS_IN_CHUNK * item_size));
 
   pool->num_chunks_allocated = 1;
   pool->num_chunks_freed = 0;
@@ -156,11 +170,12 @@ memory_pool_alloc (MemoryPool *pool)
       chunk->next = NULL;
       chunk->previous = pool->last_chunk;
 
+      pool->last_chunk->next = chunk;
       pool->last_chunk = chunk;
     }
     else {
       /* We need at least one non-full chunk. */
-      chunk = memory_chunk_new (pool->item_size, pool->index_field_offset);
+      chunk = memory_chunk_new (pool);
       chunk->next = pool->first_chunk;
       chunk->previous = NULL;
 
@@ -197,9 +212,9 @@ memory_pool_free (MemoryPool *pool, void *item)
   assert (pool->item_size > 0);
 
   chunk = (MemoryChunk *) ((char *) item - item_index * pool->item_size
-			   - (sizeof (MemoryChunk) - sizeof (int)));
+			   - CHUNK_HEADER_SIZE);
 
-  if (chunk->num_free_items < NUM_ITEMS_IN_CHUNK - 1) {
+  if (chunk->num_free_items < chunk->num_items - 1) {
     if (chunk->num_free_items == 0 && chunk->previous->num_free_items == 0) {
       /* The chunk is not full now, but is not in "non-full" head of
        * the pool's chunk list.  We have to move it to the head.
@@ -214,6 +229,7 @@ memory_pool_free (MemoryPool *pool, void *item)
       chunk->previous = NULL;
       chunk->next = pool->first_chunk;
 
+      pool->first_chunk->previous = chunk;
       pool->first_chunk = chunk;
     }
   }
@@ -251,10 +267,14 @@ memory_pool_free (MemoryPool *pool, void *item)
      */
   }
 
-  chunk->num_free_items++;
-
+  /* If the chunk is full, `first_free_item' is stale and might even
+   * be equal to `item_index'.  Then the item would look allocated to
+   * memory_pool_traverse(), so store any other index instead.
+   */
   * (ItemIndex *) ((char *) item + pool->index_field_offset)
-    = chunk->first_free_item;
+    = (chunk->num_free_items > 0 ? chunk->first_free_item : item_index + 1);
+
+  chunk->num_free_items++;
   chunk->first_free_item = item_index;
 
 #if ENABLE_MEMORY_PROFILING
@@ -277,7 +297,7 @@ memory_pool_count_items (const MemoryPool *pool)
      * case.
      */
     for (chunk = pool->last_chunk; chunk; chunk = chunk->previous)
-      num_items += NUM_ITEMS_IN_CHUNK - chunk->num_free_items;
+      num_items += chunk->num_items - chunk->num_free_items;
   }
 
   return num_items;
@@ -300,8 +320,8 @@ memory_pool_traverse (const MemoryPool *pool, MemoryPoolCallback callback)
    */
   for (chunk = pool->last_chunk; chunk->num_free_items == 0;
        chunk = chunk->previous) {
-    for (memory = (char *) chunk->memory, k = 0; k < NUM_ITEMS_IN_CHUNK;
-	 memory += pool->item_size, k++)
+    for (memory = (char *) chunk->memory, k = 0; k < chunk->num_items;
+	 memory += item_size, k++)
       callback (memory);
   }
 
@@ -309,8 +329,8 @@ memory_pool_traverse (const MemoryPool *pool, MemoryPoolCallback callback)
    * item is allocated before invoking callback on it.
    */
   do {
-    for (memory = (char *) chunk->memory, k = 0; k < NUM_ITEMS_IN_CHUNK;
-	 memory += pool->item_size, k++) {
+    for (memory = (char *) chunk->memory, k = 0; k < chunk->num_items;
+	 memory += item_size, k++) {
       if (* (ItemIndex *) (memory + pool->index_field_offset) == k)
 	callback (memory);
     }
@@ -337,8 +357,8 @@ memory_pool_traverse_data (const MemoryPool *pool,
    */
   for (chunk = pool->last_chunk; chunk->num_free_items == 0;
        chunk = chunk->previous) {
-    for (memory = (char *) chunk->memory, k = 0; k < NUM_ITEMS_IN_CHUNK;
-	 memory += pool->item_size, k++)
+    for (memory = (char *) chunk->memory, k = 0; k < chunk->num_items;
+	 memory += item_size, k++)
       callback (memory, data);
   }
 
@@ -346,8 +366,8 @@ memory_pool_traverse_data (const MemoryPool *pool,
    * item is allocated before invoking callback on it.
    */
   do {
-    for (memory = (char *) chunk->memory, k = 0; k < NUM_ITEMS_IN_CHUNK;
-	 memory += pool->item_size, k++) {
+    for (memory = (char *) chunk->memory, k = 0; k < chunk->num_items;
+	 memory += item_size, k++) {
       if (* (ItemIndex *) (memory + pool->index_field_offset) == k)
 	callback (memory, data);
     }
@@ -399,21 +419,30 @@ memory_pool_flush (MemoryPool *pool)
 }
 
 
-/* Allocate a new MemoryChunk structure with all items being free. */
+/* Allocate a new MemoryChunk structure with all items being free.
+ * Its size is determined by the pool, which is then prepared for
+ * allocating a larger chunk next time.
+ */
 static MemoryChunk *
-memory_chunk_new (int item_size, int index_field_offset)
+memory_chunk_new (MemoryPool *pool)
 {
-  MemoryChunk *chunk = utils_malloc (sizeof (MemoryChunk) - sizeof (int)
-				     + NUM_ITEMS_IN_CHUNK * item_size);
+  int item_size = pool->item_size;
+  int num_items = pool->num_items_in_next_chunk;
+  MemoryChunk *chunk = utils_malloc (CHUNK_HEADER_SIZE
+				     + num_items * item_size);
   char *memory;
   int k;
 
-  for (memory = (char *) chunk->memory, k = 0; k < NUM_ITEMS_IN_CHUNK;
+  for (memory = (char *) chunk->memory, k = 0; k < num_items;
        memory += item_size, k++)
-    * (ItemIndex *) (memory + index_field_offset) = k + 1;
+    * (ItemIndex *) (memory + pool->index_field_offset) = k + 1;
 
   chunk->first_free_item = 0;
-  chunk->num_free_items = NUM_ITEMS_IN_CHUNK;
+  chunk->num_free_items	 = num_items;
+  chunk->num_items	 = num_items;
+
+  if (num_items < MAX_ITEMS_IN_CHUNK)
+    pool->num_items_in_next_chunk = num_items * 2;
 
   return chunk;
 }
@@ -48,6 +48,11 @@ enum {
 };
 
 
+#if ENABLE_ALLOCATION_COUNTING
+static unsigned int	num_allocations = 0;
+#endif
+
+
 #if ENABLE_MEMORY_PROFILING
 
 static unsigned int	num_mallocs = 0;
@@ -78,6 +83,10 @@ utils_malloc (size_t size)
 {
   void *pointer = malloc (size);
 
+#if ENABLE_ALLOCATION_COUNTING
+  num_allocations++;
+#endif
+
 #if ENABLE_MEMORY_PROFILING
 
   num_mallocs++;
@@ -133,6 +142,11 @@ utils_realloc (void *pointer, size_t size)
 
 #endif
 
+#if ENABLE_ALLOCATION_COUNTING
+  if (size)
+    num_allocations++;
+#endif
+
   pointer = realloc (pointer, size);
   if (pointer || size == 0)
     return pointer;
@@ -144,6 +158,20 @@ utils_realloc (void *pointer, size_t size)
 }
 
 
+#if ENABLE_ALLOCATION_COUNTING
+
+/* Return the number of utils_malloc() and (non-freeing)
+ * utils_realloc() calls made so far.
+ */
+unsigned int
+utils_get_num_allocations (void)
+{
+  return num_allocations;
+}
+
+#endif
+
+
 #if ENABLE_MEMORY_PROFILING
 
 
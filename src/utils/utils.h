@@ -32,6 +32,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 
 /* Set to zero to disable memory pools. */
@@ -40,6 +41,14 @@
 /* Set to 1 to get lots of information about memory allocation. */
 #define ENABLE_MEMORY_PROFILING	0
 
+/* Set to 1 (e.g. with `CPPFLAGS=-DENABLE_ALLOCATION_COUNTING=1') to
+ * count memory allocations for benchmarks.  The counter is not
+ * thread-safe, so this is off by default.
+ */
+#ifndef ENABLE_ALLOCATION_COUNTING
+#define ENABLE_ALLOCATION_COUNTING	0
+#endif
+
 
 /* FIXME: proper `#ifdef's to make this work under Windows. */
 #define DIRECTORY_SEPARATOR	'/'
@@ -73,6 +82,10 @@ void *		utils_malloc (size_t size);
 void *		utils_malloc0 (size_t size);
 void *		utils_realloc (void *pointer, size_t size);
 
+#if ENABLE_ALLOCATION_COUNTING
+unsigned int	utils_get_num_allocations (void);
+#endif
+
 
 #if ENABLE_MEMORY_PROFILING
 
@@ -149,7 +162,12 @@ extern char    *program_directory;
 #if ENABLE_MEMORY_POOLS
 
 
-#define NUM_ITEMS_IN_CHUNK	128
+/* Chunks start small, so that pools with few items (e.g. in a game
+ * collection with thousands of trees) don't waste memory, and then
+ * double in size.  Item indices must fit in `ItemIndex'.
+ */
+#define MIN_ITEMS_IN_CHUNK	8
+#define MAX_ITEMS_IN_CHUNK	256
 
 /* NOTE: this field is private to memory pool, it should never be
  *	 accessed from other code, especially, it must _never_ be
@@ -158,7 +176,7 @@ extern char    *program_directory;
 #define MEMORY_POOL_ITEM_INDEX	ItemIndex	item_index
 
 
-typedef char			ItemIndex;
+typedef unsigned char		ItemIndex;
 
 typedef struct _MemoryChunk	MemoryChunk;
 typedef struct _MemoryPool	MemoryPool;
@@ -168,7 +186,8 @@ struct _MemoryChunk {
   MemoryChunk	 *previous;
 
   ItemIndex	  first_free_item;
-  unsigned char	  num_free_items;
+  unsigned short  num_free_items;
+  unsigned short  num_items;
 
   /* We use `int' here to force proper memory alignment. */
   int		  memory[1];
@@ -177,6 +196,7 @@ struct _MemoryChunk {
 struct _MemoryPool {
   int		  item_size;
   int		  index_field_offset;
+  int		  num_items_in_next_chunk;
 
   MemoryChunk	 *first_chunk;
   MemoryChunk	 *last_chunk;
@@ -255,6 +275,27 @@ struct _MemoryPool {
 #endif /* not ENABLE_MEMORY_POOLS */
 
 
+
+/* `memory-arena.c' declarations and global functions. */
+
+typedef struct _MemoryArena	MemoryArena;
+
+
+MemoryArena *	memory_arena_new (void);
+MemoryArena *	memory_arena_ref (MemoryArena *arena);
+void		memory_arena_unref (MemoryArena *arena);
+
+char *		memory_arena_duplicate_as_string (MemoryArena *arena,
+						  const char *buffer,
+						  int length);
+char *		memory_arena_intern_as_string (MemoryArena *arena,
+					       const char *buffer,
+					       int length);
+
+int		memory_arena_owns (const MemoryArena *arena,
+				   const void *pointer);
+
+
 
 /* `string-list.c' declarations and global functions. */
 
@@ -506,6 +547,40 @@ void		string_buffer_vcprintf (StringBuffer *string_buffer,
 
 
 
+/* `compressed-file.c' declarations and global functions. */
+
+typedef enum {
+  COMPRESSION_NONE,
+  COMPRESSION_GZIP,
+  COMPRESSION_XZ,
+  COMPRESSION_ZSTD
+} CompressionFormat;
+
+typedef struct _CompressedFile	CompressedFile;
+
+
+/* Number of bytes compression_format_from_magic() needs to see. */
+#define COMPRESSION_MAGIC_LENGTH	6
+
+
+CompressionFormat  compression_format_from_magic (const char *buffer,
+						  int length);
+CompressionFormat  compression_format_from_filename (const char *filename);
+int		   compression_format_is_supported (CompressionFormat format);
+
+CompressedFile *   compressed_file_open_for_reading (FILE *file,
+						     CompressionFormat format);
+CompressedFile *   compressed_file_open_for_writing (FILE *file,
+						     CompressionFormat format);
+int		   compressed_file_close (CompressedFile *file);
+
+ssize_t		   compressed_file_read (CompressedFile *file,
+					 char *buffer, size_t size);
+int		   compressed_file_write (CompressedFile *file,
+					  const char *buffer, int length);
+
+
+
 /* `buffered-writer.c' declarations and global functions. */
 
 typedef struct _BufferedWriter		BufferedWriter;
@@ -513,6 +588,7 @@ typedef struct _BufferedWriterChunkData	BufferedWriterChunkData;
 
 struct _BufferedWriter {
   FILE			   *file;
+  CompressedFile	   *compressed_file;
   BufferedWriterChunkData  *first_chunk;
 
   size_t		    buffer_size;